@@ -33,6 +33,19 @@ const int cArgMissingArg = -5;
 const int cArgShortOpt   = -6;
 const int cArgUnexpStr   = -7;
 
+static bool ArgIsNegNum(char *pStr);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ArgIsNegNum()
+ *
+ * DESCRIPTION
+ * Returns true if pStr starts like a negative number, i.e., a hyphen followed by a digit or a period.
+ *------------------------------------------------------------------------------------------------------------*/
+static bool ArgIsNegNum(char *pStr)
+{
+	return pStr[0] == '-' && ((pStr[1] >= '0' && pStr[1] <= '9') || pStr[1] == '.');
+}
+
 int ArgScan(tArgScan *pScan)
 {
 	if (pScan->index >= pScan->argc) return cArgEnd;
@@ -115,14 +128,15 @@ int ArgScan(tArgScan *pScan)
 			case tArgState_ReqArg:
 				// On entry, pScan->index has been incremented so pScan->argv[pScan->index] should be
 				// the required argument. We handle the case where the required argument is missing, e.g.,
-				// $ binary -o -f, where -o should be followed by an argument.
+				// $ binary -o -f, where -o should be followed by an argument. A hyphen followed by a digit or a
+				// period is a negative number, e.g., $ binary --rotate -1.5, not an option.
 				if (pScan->index >= pScan->argc) {
 					nextState = tArgState_MissingArg;
-				} else if (*pScan->argv[pScan->index] == '-') {
+				} else if (*pScan->argv[pScan->index] == '-' && !ArgIsNegNum(pScan->argv[pScan->index])) {
 					nextState = tArgState_MissingArg;
 				} else {
-					// Following the option, there is a string that does not start with a hyphen, so we will
-					// assume that it is an argument. Make pScan->arg point to it.
+					// Following the option, there is a string that does not start with a hyphen (or is a negative
+					// number), so we will assume that it is an argument. Make pScan->arg point to it.
 					pScan->arg = pScan->argv[pScan->index];
 					retVal = shortOpt ? tArgState_ShortOpt : tArgState_LongOpt;
 					nextState = tArgState_End;
@@ -4,15 +4,23 @@
  * DESCRIPTION
  * Functions for reading and writing BMP images.
  **************************************************************************************************************/
+#define _DEFAULT_SOURCE		// For MAP_ANONYMOUS.
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include "Bmp.h"
 #include "Error.h"
 #include "File.h"
+#include "Hist.h"
+#include "Numa.h"
+#include "Progress.h"
+#include "Thread.h"
+#include "Tune.h"
 
 // Asserts that 'cond' is true. If it is not, then we close the file stream 'stream' and return from the
-// BmpRead() function with the return value 'error'.
+// calling function with the return value 'error'.
 #define BmpAssert(cond, stream, error) if (!(cond)) { if ((stream)) FileClose((stream)); return error; }
 
 const size_t cSizeofBmpHeader     = 14;  // Size of the BMPHEADER struct.
@@ -21,66 +29,304 @@ const size_t cSizeofBmpInfoHeader = 40;  // Size of the BMPINFOHEADER struct.
 // A valid BMP file has to be at least 58 bytes in size.
 const size_t cBmpMinFileSize  = 58;
 
-static int BmpCalcFileSize(int pWidth, int pHeight);
+// Size of the palette of 256 grays of an 8-bit image written by BmpWriteGray().
+static const size_t cSizeofBmpPalette = 4 * 256;
+
+// Whether files of 4 GB or more may be written. See BmpAllowLarge().
+static bool sBmpAllowLarge = false;
+
+// The blocks of a pixel array allocated with NUMA placement, one per chunk of BmpPixelAllocRows(). A pointer
+// to it is kept just before the row pointers, where a pixel array allocated row by row has NULL.
+typedef struct {
+	void	*addr[THREAD_MAX];	// The block of the rows of the chunk, or NULL.
+	size_t	len[THREAD_MAX];	// The size of the block.
+} tBmpBands;
+
+// A pixel array being allocated by BmpPixelAllocRows().
+typedef struct {
+	tBmpBands	*bands;
+	tPixel		**pixel;
+	int			width;
+} tBmpAlloc;
+
+static uint64_t BmpCalcFileSize(int pWidth, int pHeight);
+static uint64_t BmpCalcGrayFileSize(int pWidth, int pHeight);
 static int BmpCalcPad(int pWidth);
+static int BmpIoLines(size_t pLineBytes, int pHeight);
+static void BmpPixelAllocRows(void *pContext, int pThread, int pBegin, int pEnd);
+static tError BmpReadHeaders(FILE *pStream, off_t pFileSize, tBmp *pBmp, bool pGray);
+static uint32_t BmpSizeField(uint64_t pFileSize);
+static tError BmpWriteHeaderFields(FILE *pStream, tBmp *pBmp);
+
+void BmpAllowLarge(bool pAllow)
+{
+	sBmpAllowLarge = pAllow;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: BmpCalcFileSize()
+ *
+ * DESCRIPTION
+ * Returns the size of the file of a 24-bit pWidth x pHeight image. The size is calculated in 64 bits, which
+ * holds it for any width and height up to INT32_MAX.
+ *------------------------------------------------------------------------------------------------------------*/
+static uint64_t BmpCalcFileSize(int pWidth, int pHeight)
+{
+	return (uint64_t)pHeight * (3 * (uint64_t)pWidth + BmpCalcPad(pWidth)) + cSizeofBmpHeader +
+		cSizeofBmpInfoHeader;
+}
 
-static int BmpCalcFileSize(int pWidth, int pHeight)
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: BmpCalcGrayFileSize()
+ *
+ * DESCRIPTION
+ * Returns the size of the file of an 8-bit pWidth x pHeight image with a palette of 256 grays, as written by
+ * BmpWriteGray().
+ *------------------------------------------------------------------------------------------------------------*/
+static uint64_t BmpCalcGrayFileSize(int pWidth, int pHeight)
 {
-	return pHeight * (3 * pWidth + BmpCalcPad(pWidth)) + cSizeofBmpHeader + cSizeofBmpInfoHeader;
+	return (uint64_t)pHeight * (((uint64_t)pWidth + 3) & ~(uint64_t)3) + cSizeofBmpHeader + cSizeofBmpInfoHeader +
+		cSizeofBmpPalette;
 }
 
 static int BmpCalcPad(int pWidth)
 {
-	return (4 - (3 * pWidth) % 4) % 4;
+	return (4 - 3 * (pWidth % 4) % 4) % 4;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: BmpIoLines()
+ *
+ * DESCRIPTION
+ * Returns the number of scanlines of pLineBytes bytes, padding included, of an image of pHeight scanlines
+ * which are read or written at once: as many as fit in the tuned I/O size, but at least one and at most the
+ * whole image.
+ *------------------------------------------------------------------------------------------------------------*/
+static int BmpIoLines(size_t pLineBytes, int pHeight)
+{
+	int lines = (int)(TuneGet()->ioBytes / pLineBytes);
+	if (lines < 1) return 1;
+	return lines < pHeight ? lines : pHeight;
+}
+
+off_t BmpFileSize(tBmp *pBmp)
+{
+	if (pBmp->infoHeader.bitsPerPixel == 8) {
+		return (off_t)BmpCalcGrayFileSize(pBmp->infoHeader.width, pBmp->infoHeader.height);
+	}
+	return (off_t)BmpCalcFileSize(pBmp->infoHeader.width, pBmp->infoHeader.height);
+}
+
+tError BmpFlipInPlace(char *pFilename, bool pHoriz, bool pVert)
+{
+	tBmp bmp;
+	byte header[cSizeofBmpHeader + cSizeofBmpInfoHeader];
+
+	off_t fileSize = FileSize(pFilename);
+	BmpAssert(fileSize >= (off_t)cBmpMinFileSize, NULL, ErrorBmpInv);
+	FILE *bmpIn = FileOpen(pFilename, "rb");
+	BmpAssert(bmpIn, NULL, ErrorFileOpen);
+	tError result = BmpReadHeaders(bmpIn, fileSize, &bmp, false);
+	BmpAssert(result == ErrorNone, bmpIn, result);
+
+	// Flipping neither way leaves the file as it is.
+	BmpAssert(pHoriz || pVert, bmpIn, ErrorNone);
+
+	// The flipped image has the same headers, so they are copied as is.
+	char tempName[FILENAME_MAX];
+	FILE *bmpOut = FileOpenTemp(pFilename, tempName);
+	BmpAssert(bmpOut, bmpIn, ErrorFileOpen);
+	if (FileReadAt(bmpIn, header, sizeof(header), 0) != 0) result = ErrorFileRead;
+	else if (FileWrite(bmpOut, header, sizeof(header), 1) != 0) result = ErrorFileWrite;
+
+	int width = bmp.infoHeader.width, height = bmp.infoHeader.height;
+	size_t lineBytes = 3 * (size_t)width + BmpCalcPad(width);
+	byte *line = (byte *)malloc(lineBytes);
+	if (!line) result = ErrorFileRead;
+
+	ProgressBegin("flip", height, "rows");
+	for (int row = 0; row < height && result == ErrorNone; ++row) {
+		int srcRow = pVert ? height-1 - row : row;
+		if (FileReadAt(bmpIn, line, lineBytes, (off_t)(cSizeofBmpHeader + cSizeofBmpInfoHeader) +
+			(off_t)srcRow * lineBytes) != 0) {
+			result = ErrorFileRead;
+			break;
+		}
+		for (size_t i = 3 * (size_t)width; i < lineBytes; ++i) {
+			if (line[i] != 0) result = ErrorBmpCorrupt;
+		}
+		if (pHoriz) {
+			tPixel *pixel = (tPixel *)line;
+			for (int col = 0; col < width / 2; ++col) {
+				tPixel temp = pixel[col];
+				pixel[col] = pixel[width-1 - col];
+				pixel[width-1 - col] = temp;
+			}
+		}
+		if (result == ErrorNone && FileWrite(bmpOut, line, lineBytes, 1) != 0) result = ErrorFileWrite;
+		if (result == ErrorNone && !ProgressStep(1)) result = ErrorCancelled;
+	}
+
+	free(line);
+	FileClose(bmpIn);
+	if (result != ErrorNone) {
+		FileDiscard(bmpOut, tempName);
+	} else if (FileCommit(bmpOut, tempName, pFilename) != 0) {
+		result = ErrorFileWrite;
+	}
+	return result;
+}
+
+void BmpInit(tBmp *pBmp, int pWidth, int pHeight)
+{
+	memset(pBmp, 0, sizeof(tBmp));
+	pBmp->header.sigB = 'B';
+	pBmp->header.sigM = 'M';
+	pBmp->header.pixelOffset = cSizeofBmpHeader + cSizeofBmpInfoHeader;
+	pBmp->infoHeader.size = cSizeofBmpInfoHeader;
+	pBmp->infoHeader.width = pWidth;
+	pBmp->infoHeader.height = pHeight;
+	pBmp->infoHeader.colorPlanes = 1;
+	pBmp->infoHeader.bitsPerPixel = 24;
+	pBmp->header.fileSize = BmpSizeField(BmpCalcFileSize(pWidth, pHeight));
 }
 
 tPixel **BmpPixelAlloc(int pWidth, int pHeight)
 {
-	tPixel **pixel = (tPixel **)malloc(pHeight * sizeof(tPixel *));
+	void **block = (void **)calloc((size_t)pHeight + 1, sizeof(void *));
+	if (!block) return NULL;
+	tPixel **pixel = (tPixel **)(block + 1);
+
+	// With NUMA placement, the rows of each band are allocated in blocks of their own, which are first touched
+	// on the node of the band.
+	tBmpBands *bands = NumaNodes() > 1 ? (tBmpBands *)calloc(1, sizeof(tBmpBands)) : NULL;
+	if (bands) {
+		block[0] = bands;
+		tBmpAlloc alloc = { bands, pixel, pWidth };
+		ThreadFor(pHeight, 1, BmpPixelAllocRows, &alloc);
+	} else {
+		for (int row = 0; row < pHeight; ++row) {
+			pixel[row] = (tPixel *)malloc(pWidth * sizeof(tPixel));
+		}
+	}
+
+	// A large image may not fit in memory, in which case the rows which were allocated are freed.
 	for (int row = 0; row < pHeight; ++row) {
-		pixel[row] = (tPixel *)malloc(pWidth * sizeof(tPixel));
+		if (!pixel[row]) {
+			BmpPixelFree(pixel, pHeight);
+			return NULL;
+		}
 	}
 	return pixel;
 }
 
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: BmpPixelAllocRows()
+ *
+ * DESCRIPTION
+ * The body of the loop over the rows [pBegin, pEnd) allocated by BmpPixelAlloc() with NUMA placement. The rows
+ * are allocated in one block mapped straight from the kernel, rather than from malloc(), whose arenas may hand
+ * out pages another node has already touched, e.g., those of an image just freed. A byte of each page is
+ * then written so that the page is placed by the thread of the node, which runs this chunk. If the block
+ * cannot be mapped, the rows are left NULL.
+ *------------------------------------------------------------------------------------------------------------*/
+static void BmpPixelAllocRows(void *pContext, int pThread, int pBegin, int pEnd)
+{
+	tBmpAlloc *alloc = (tBmpAlloc *)pContext;
+	size_t rowBytes = alloc->width * sizeof(tPixel), len = (pEnd - pBegin) * rowBytes;
+	byte *addr = (byte *)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED) return;
+	alloc->bands->addr[pThread] = addr;
+	alloc->bands->len[pThread] = len;
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	for (size_t i = 0; i < len; i += page) addr[i] = 0;
+	for (int row = pBegin; row < pEnd; ++row) {
+		alloc->pixel[row] = (tPixel *)(addr + (row - pBegin) * rowBytes);
+	}
+}
+
 void BmpPixelFree(tPixel **pPixel, int pHeight)
 {
-	for (int row = 0; row < pHeight; ++row) {
-		free(pPixel[row]);
+	void **block = (void **)pPixel - 1;
+	tBmpBands *bands = (tBmpBands *)block[0];
+	if (bands) {
+		for (int i = 0; i < THREAD_MAX; ++i) {
+			if (bands->addr[i]) munmap(bands->addr[i], bands->len[i]);
+		}
+		free(bands);
+	} else {
+		for (int row = 0; row < pHeight; ++row) {
+			free(pPixel[row]);
+		}
 	}
-	free(pPixel);
+	free(block);
 }
 
-Error BmpRead(char *pFilename, tBmp *pBmp)
+tError BmpProbe(char *pFilename, tBmp *pBmp)
 {
-	byte buffer[cSizeofBmpInfoHeader];
+	// Validity Test 1: Verify the size of the file is greater than or equal to cBmpMinFileSize bytes. If not,
+	// it cannot be a valid BMP file.
+	off_t fileSize = FileSize(pFilename);
+	BmpAssert(fileSize >= (off_t)cBmpMinFileSize, NULL, ErrorBmpInv);
 
+	// Open the file for reading.
+	FILE *bmpIn = FileOpen(pFilename, "rb");
+	BmpAssert(bmpIn, NULL, ErrorFileOpen);
+
+	tError result = BmpReadHeaders(bmpIn, fileSize, pBmp, true);
+	FileClose(bmpIn);
+	pBmp->pixel = NULL;
+	return result;
+}
+
+tError BmpRead(char *pFilename, tBmp *pBmp, tHist *pHist)
+{
 	// Validity Test 1: Verify the size of the file is greater than or equal to cBmpMinFileSize bytes. If not,
 	// it cannot be a valid BMP file.
-	long fileSize = FileSize(pFilename);
-	BmpAssert(fileSize >= cBmpMinFileSize, NULL, ErrorBmpInv);
+	off_t fileSize = FileSize(pFilename);
+	BmpAssert(fileSize >= (off_t)cBmpMinFileSize, NULL, ErrorBmpInv);
 
 	// Open the file for reading.
 	FILE *bmpIn = FileOpen(pFilename, "rb");
 	BmpAssert(bmpIn, NULL, ErrorFileOpen);
 
+	tError result = BmpReadStream(bmpIn, fileSize, pBmp, pHist);
+	FileClose(bmpIn);
+	return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: BmpReadHeaders()
+ *
+ * DESCRIPTION
+ * Reads and validates the BMPHEADER and BMPINFOHEADER structures from pStream, which holds pFileSize bytes.
+ * The headers of an 8-bit gray image written by BmpWriteGray() are valid if pGray is true, and otherwise
+ * ErrorBmpGray is returned for them, as the pixel readers only read 24-bit images.
+ *------------------------------------------------------------------------------------------------------------*/
+static tError BmpReadHeaders(FILE *pStream, off_t pFileSize, tBmp *pBmp, bool pGray)
+{
+	byte buffer[cSizeofBmpInfoHeader];
+
 	// Read the BMPHEADER structure and initialize the tBmpHeader structure.
-	BmpAssert(FileRead(bmpIn, buffer, cSizeofBmpHeader, 1) == 0, bmpIn, ErrorFileRead);
+	if (FileRead(pStream, buffer, cSizeofBmpHeader, 1) != 0) return ErrorFileRead;
 	pBmp->header.sigB = buffer[0];
 	pBmp->header.sigM = buffer[1];
 	memcpy(&pBmp->header.fileSize, &buffer[2], sizeof(pBmp->header.fileSize));
 	memcpy(&pBmp->header.resv1, &buffer[6], sizeof(pBmp->header.resv1));
-	memcpy(&pBmp->header.resv1, &buffer[8], sizeof(pBmp->header.resv2));
+	memcpy(&pBmp->header.resv2, &buffer[8], sizeof(pBmp->header.resv2));
 	memcpy(&pBmp->header.pixelOffset, &buffer[10], sizeof(pBmp->header.pixelOffset));
 
-	// Validity Test 1: Validate the contents of the BMPHEADER.
-	BmpAssert(pBmp->header.sigB == 'B' && pBmp->header.sigM == 'M', bmpIn, ErrorBmpInv);
-	BmpAssert(pBmp->header.fileSize == fileSize, bmpIn, ErrorBmpInv);
-	BmpAssert(pBmp->header.resv1 == 0 && pBmp->header.resv2 == 0, bmpIn, ErrorBmpInv);
-	BmpAssert(pBmp->header.pixelOffset == 0x36, bmpIn, ErrorBmpInv);
+	// Validity Test 1: Validate the contents of the BMPHEADER. The file size field only holds the size of a
+	// file under 4 GB, so a larger file may have the size modulo 4 GB in it, and a file over 2 GB may have 0.
+	// The size is checked against the pixel array below anyway.
+	if (pBmp->header.sigB != 'B' || pBmp->header.sigM != 'M') return ErrorBmpInv;
+	if (pBmp->header.fileSize != (uint32_t)pFileSize && (pBmp->header.fileSize != 0 || pFileSize <= INT32_MAX)) {
+		return ErrorBmpInv;
+	}
+	if (pBmp->header.resv1 != 0 || pBmp->header.resv2 != 0) return ErrorBmpInv;
 
 	// Read the BMPINFOHEADER structure and initialize the tBmpInfoHeader structure.
-	BmpAssert(FileRead(bmpIn, buffer, cSizeofBmpInfoHeader, 1) == 0, bmpIn, ErrorFileRead);
+	if (FileRead(pStream, buffer, cSizeofBmpInfoHeader, 1) != 0) return ErrorFileRead;
 	memcpy(&pBmp->infoHeader.size, &buffer[0], sizeof(pBmp->infoHeader.size));
 	memcpy(&pBmp->infoHeader.width, &buffer[4], sizeof(pBmp->infoHeader.width));
 	memcpy(&pBmp->infoHeader.height, &buffer[8], sizeof(pBmp->infoHeader.height));
@@ -89,56 +335,219 @@ Error BmpRead(char *pFilename, tBmp *pBmp)
 	memcpy(&pBmp->infoHeader.zeros, &buffer[16], sizeof(pBmp->infoHeader.zeros));
 
 	// Validity Test 2: Validate the contents of the BMPINFOHEADER.
-	BmpAssert(pBmp->infoHeader.size == 0x28, bmpIn, ErrorBmpInv);
-	BmpAssert(pBmp->infoHeader.colorPlanes == 1, bmpIn, ErrorBmpInv);
-	BmpAssert(pBmp->infoHeader.bitsPerPixel == 24, bmpIn, ErrorBmpInv);
+	if (pBmp->infoHeader.size != 0x28) return ErrorBmpInv;
+	if (pBmp->infoHeader.colorPlanes != 1) return ErrorBmpInv;
+	if (pBmp->infoHeader.bitsPerPixel != 24 && pBmp->infoHeader.bitsPerPixel != 8) return ErrorBmpInv;
+	if (pBmp->infoHeader.width <= 0 || pBmp->infoHeader.height <= 0) return ErrorBmpInv;
+
+	// The pixel array follows the headers, and the palette of an 8-bit image.
+	bool gray = pBmp->infoHeader.bitsPerPixel == 8;
+	if (pBmp->header.pixelOffset != 0x36 + (gray ? (int32_t)cSizeofBmpPalette : 0)) return ErrorBmpInv;
 
 	// Corrupted Test 1: Given width and height, we can calculate pad and then determine the size of the file.
 	// If the size we calculate does not match the actual file size as stored on disk, then we assume the file
 	// is corrupted.
-	if (fileSize != BmpCalcFileSize(pBmp->infoHeader.width, pBmp->infoHeader.height)) {
-		ErrorExit(ErrorBmpCorrupt, "%s is corrupted", pFilename);
+	int width = pBmp->infoHeader.width, height = pBmp->infoHeader.height;
+	if ((uint64_t)pFileSize != (gray ? BmpCalcGrayFileSize(width, height) : BmpCalcFileSize(width, height))) {
+		return ErrorBmpCorrupt;
 	}
 
+	return gray && !pGray ? ErrorBmpGray : ErrorNone;
+}
+
+tError BmpReadStream(FILE *pStream, off_t pSize, tBmp *pBmp, tHist *pHist)
+{
+	BmpAssert(pSize >= (off_t)cBmpMinFileSize, NULL, ErrorBmpInv);
+
+	// Read and validate the BMPHEADER and BMPINFOHEADER structures.
+	tError result = BmpReadHeaders(pStream, pSize, pBmp, false);
+	if (result != ErrorNone) return result;
+
 	// The headers check out, so this is most likely a valid BMP file. Let's read the pixel array. First, we
 	// dynamically allocate a 2D array which is height x width with each element being a tPixel.
 	pBmp->pixel = BmpPixelAlloc(pBmp->infoHeader.width, pBmp->infoHeader.height);
+	if (!pBmp->pixel) return ErrorFileRead;
+
+	int width = pBmp->infoHeader.width, height = pBmp->infoHeader.height;
+	size_t pixelBytes = 3 * (size_t)width, lineBytes = pixelBytes + BmpCalcPad(width);
 
-	int pad = BmpCalcPad(pBmp->infoHeader.width);
+	// The bins used to compute the histogram while reading. They are large, so they are only allocated if a
+	// histogram was asked for.
+	tHistAcc *acc = NULL;
+	if (pHist) {
+		memset(pHist, 0, sizeof(tHist));
+		acc = (tHistAcc *)calloc(1, sizeof(tHistAcc));
+		if (!acc) result = ErrorFileRead;
+	}
 
-	for (int row = pBmp->infoHeader.height-1; row >= 0; --row) {
-		for (int col = 0; col < pBmp->infoHeader.width; ++col) {
-			BmpAssert(FileRead(bmpIn, &pBmp->pixel[row][col], sizeof(tPixel), 1) == 0, bmpIn, ErrorFileRead);
+	// The scanlines are read a buffer of them at a time and then copied into the rows, checking that their
+	// padding bytes are zero.
+	int lines = BmpIoLines(lineBytes, height);
+	byte *buffer = (byte *)malloc(lines * lineBytes);
+	if (!buffer) result = ErrorFileRead;
+	ProgressBegin("read", height, "rows");
+	for (int row = height-1; row >= 0 && result == ErrorNone; row -= lines) {
+		int count = row + 1 < lines ? row + 1 : lines;
+		if (FileRead(pStream, buffer, lineBytes, count) != 0) {
+			result = ErrorFileRead;
+			break;
+		}
+		for (int i = 0; i < count; ++i) {
+			byte *line = buffer + i * lineBytes;
+			memcpy(pBmp->pixel[row - i], line, pixelBytes);
+			for (size_t j = pixelBytes; j < lineBytes; ++j) {
+				if (line[j] != 0) result = ErrorBmpCorrupt;
+			}
+			if (acc) HistAccRow(acc, pHist, pBmp->pixel[row - i], width);
 		}
-		// Read the padding bytes and check they are zero.
-		byte pb[4] = { 0 };
-		BmpAssert(FileRead(bmpIn, pb, sizeof(byte), pad) == 0, bmpIn, ErrorFileRead);
-		BmpAssert(pb[0] == 0 && pb[1] == 0 && pb[2] == 0 && pb[3] == 0, bmpIn, ErrorBmpCorrupt);
+		if (result == ErrorNone && !ProgressStep(count)) result = ErrorCancelled;
 	}
+	free(buffer);
 
+	if (acc) {
+		HistAccFlush(acc, pHist);
+		free(acc);
+	}
+
+	// Do not leak the pixel array if the image could not be read.
+	if (result != ErrorNone) {
+		BmpPixelFree(pBmp->pixel, pBmp->infoHeader.height);
+		pBmp->pixel = NULL;
+	}
+	return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: BmpSizeField()
+ *
+ * DESCRIPTION
+ * Returns the value of the file size field of the BMPHEADER for a file of pFileSize bytes: the size, or 0 if
+ * it is 4 GB or more.
+ *------------------------------------------------------------------------------------------------------------*/
+static uint32_t BmpSizeField(uint64_t pFileSize)
+{
+	return pFileSize <= UINT32_MAX ? (uint32_t)pFileSize : 0;
+}
+
+tError BmpValidate(char *pFilename, bool pDeep)
+{
+	tBmp bmp;
+
+	// Without pDeep, validating the file is the same as probing the headers.
+	if (!pDeep) return BmpProbe(pFilename, &bmp);
+
+	off_t fileSize = FileSize(pFilename);
+	BmpAssert(fileSize >= (off_t)cBmpMinFileSize, NULL, ErrorBmpInv);
+	FILE *bmpIn = FileOpen(pFilename, "rb");
+	BmpAssert(bmpIn, NULL, ErrorFileOpen);
+	tError result = BmpReadHeaders(bmpIn, fileSize, &bmp, true);
+	BmpAssert(result == ErrorNone, bmpIn, result);
+
+	// Stream the pixel array one scanline at a time, checking that the padding bytes at the end of each
+	// scanline are zero. Only one scanline is ever held in memory. The scanlines of an 8-bit image have one
+	// byte per pixel and follow its palette, which is read first into the same buffer.
+	bool gray = bmp.infoHeader.bitsPerPixel == 8;
+	size_t pixelBytes = (gray ? 1 : 3) * (size_t)bmp.infoHeader.width;
+	size_t pad = gray ? (4 - pixelBytes % 4) % 4 : BmpCalcPad(bmp.infoHeader.width);
+	size_t lineBytes = pixelBytes + pad;
+	byte *line = (byte *)malloc(gray && lineBytes < cSizeofBmpPalette ? cSizeofBmpPalette : lineBytes);
+	BmpAssert(line, bmpIn, ErrorFileRead);
+	if (gray && FileRead(bmpIn, line, cSizeofBmpPalette, 1) != 0) result = ErrorFileRead;
+	for (int row = 0; row < bmp.infoHeader.height && result == ErrorNone; ++row) {
+		if (FileRead(bmpIn, line, lineBytes, 1) != 0) {
+			result = ErrorFileRead;
+		} else {
+			for (size_t i = pixelBytes; i < lineBytes; ++i) {
+				if (line[i] != 0) result = ErrorBmpCorrupt;
+			}
+		}
+	}
+	free(line);
 	FileClose(bmpIn);
-	return ErrorNone;
+	return result;
 }
 
 tError BmpWrite(char *pFilename, tBmp *pBmp)
 {
-	byte buffer[cSizeofBmpInfoHeader];
+	// The image is written to a temporary file which replaces pFilename once it is complete, so a failed or
+	// cancelled write does not leave part of an image behind.
+	char tempName[FILENAME_MAX];
+	FILE *bmpOut = FileOpenTemp(pFilename, tempName);
+	BmpAssert(bmpOut, NULL, ErrorFileOpen);
 
-	// Open the file for writing.
-	FILE *bmpOut = FileOpen(pFilename, "wb");
+	tError result = BmpWriteStream(bmpOut, pBmp);
+	if (result != ErrorNone) {
+		FileDiscard(bmpOut, tempName);
+	} else if (FileCommit(bmpOut, tempName, pFilename) != 0) {
+		result = ErrorFileWrite;
+	}
+	return result;
+}
+
+tError BmpWriteGray(char *pFilename, byte *pPlane, int pWidth, int pHeight)
+{
+	// As in BmpWrite(), the image is written to a temporary file first.
+	char tempName[FILENAME_MAX];
+	FILE *bmpOut = FileOpenTemp(pFilename, tempName);
 	BmpAssert(bmpOut, NULL, ErrorFileOpen);
 
-	// Calculate the file size which is written in the BMPHEADER structure.
-	pBmp->header.fileSize = BmpCalcFileSize(pBmp->infoHeader.width, pBmp->infoHeader.height);
+	// The headers are those of a 24-bit image but for the depth, the palette of 256 grays which follows them,
+	// and the size of the file.
+	tBmp bmp;
+	byte palette[4 * 256];
+	size_t lineBytes = ((size_t)pWidth + 3) & ~(size_t)3;
+	BmpInit(&bmp, pWidth, pHeight);
+	bmp.infoHeader.bitsPerPixel = 8;
+	bmp.header.pixelOffset = cSizeofBmpHeader + cSizeofBmpInfoHeader + sizeof(palette);
+	uint64_t fileSize = BmpCalcGrayFileSize(pWidth, pHeight);
+	bmp.header.fileSize = BmpSizeField(fileSize);
+	tError result = fileSize > UINT32_MAX && !sBmpAllowLarge ? ErrorBmpLarge : BmpWriteHeaderFields(bmpOut, &bmp);
+	for (int i = 0; i < 256; ++i) {
+		palette[4 * i] = palette[4 * i + 1] = palette[4 * i + 2] = (byte)i;
+		palette[4 * i + 3] = 0;
+	}
+	if (result == ErrorNone && FileWrite(bmpOut, palette, sizeof(palette), 1) != 0) result = ErrorFileWrite;
+
+	// As in BmpWriteStream(), the scanlines are copied bottom to top into a buffer which is written when full.
+	int lines = BmpIoLines(lineBytes, pHeight);
+	byte *buffer = (byte *)calloc(lines, lineBytes);
+	if (!buffer) result = ErrorFileWrite;
+	ProgressBegin("write", pHeight, "rows");
+	for (int row = pHeight-1; row >= 0 && result == ErrorNone; row -= lines) {
+		int count = row + 1 < lines ? row + 1 : lines;
+		for (int i = 0; i < count; ++i) {
+			memcpy(buffer + i * lineBytes, pPlane + (size_t)(row - i) * pWidth, pWidth);
+		}
+		if (FileWrite(bmpOut, buffer, lineBytes, count) != 0) result = ErrorFileWrite;
+		else if (!ProgressStep(count)) result = ErrorCancelled;
+	}
+	free(buffer);
+	if (result != ErrorNone) {
+		FileDiscard(bmpOut, tempName);
+	} else if (FileCommit(bmpOut, tempName, pFilename) != 0) {
+		result = ErrorFileWrite;
+	}
+	return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: BmpWriteHeaderFields()
+ *
+ * DESCRIPTION
+ * Writes the BMPHEADER and BMPINFOHEADER structures of pBmp to pStream as they are.
+ *------------------------------------------------------------------------------------------------------------*/
+static tError BmpWriteHeaderFields(FILE *pStream, tBmp *pBmp)
+{
+	byte buffer[cSizeofBmpInfoHeader];
 
 	// Write the BMPHEADER structure to the file.
 	buffer[0] = pBmp->header.sigB;
 	buffer[1] = pBmp->header.sigM;
 	memcpy(&buffer[2], &pBmp->header.fileSize, sizeof(pBmp->header.fileSize));
 	memcpy(&buffer[6], &pBmp->header.resv1, sizeof(pBmp->header.resv1));
-	memcpy(&buffer[8], &pBmp->header.resv1, sizeof(pBmp->header.resv2));
+	memcpy(&buffer[8], &pBmp->header.resv2, sizeof(pBmp->header.resv2));
 	memcpy(&buffer[10], &pBmp->header.pixelOffset, sizeof(pBmp->header.pixelOffset));
-	BmpAssert(FileWrite(bmpOut, buffer, cSizeofBmpHeader, 1) == 0, bmpOut, ErrorFileRead);
+	if (FileWrite(pStream, buffer, cSizeofBmpHeader, 1) != 0) return ErrorFileWrite;
 
 	// Write the BMPINFOHEADER structure to the file.
 	memcpy(&buffer[0], &pBmp->infoHeader.size, sizeof(pBmp->infoHeader.size));
@@ -147,19 +556,47 @@ tError BmpWrite(char *pFilename, tBmp *pBmp)
 	memcpy(&buffer[12], &pBmp->infoHeader.colorPlanes, sizeof(pBmp->infoHeader.colorPlanes));
 	memcpy(&buffer[14], &pBmp->infoHeader.bitsPerPixel, sizeof(pBmp->infoHeader.bitsPerPixel));
 	memcpy(&buffer[16], &pBmp->infoHeader.zeros, sizeof(pBmp->infoHeader.zeros));
-	BmpAssert(FileWrite(bmpOut, buffer, cSizeofBmpInfoHeader, 1) == 0, bmpOut, ErrorFileWrite);
+	if (FileWrite(pStream, buffer, cSizeofBmpInfoHeader, 1) != 0) return ErrorFileWrite;
 
-	int pad = BmpCalcPad(pBmp->infoHeader.width);
+	return ErrorNone;
+}
 
-	for (int row = pBmp->infoHeader.height-1; row >= 0; --row) {
-		for (int col = 0; col < pBmp->infoHeader.width; ++col) {
-			BmpAssert(FileWrite(bmpOut, &pBmp->pixel[row][col], sizeof(tPixel), 1) == 0, bmpOut, ErrorFileWrite);
-		}
-		// Write the padding bytes.
-		byte pb[4] = { 0 };
-		BmpAssert(FileWrite(bmpOut, pb, sizeof(byte), pad) == 0, bmpOut, ErrorFileWrite);
-	}
+tError BmpWriteHeaders(FILE *pStream, tBmp *pBmp)
+{
+	// Calculate the file size which is written in the BMPHEADER structure.
+	uint64_t fileSize = BmpCalcFileSize(pBmp->infoHeader.width, pBmp->infoHeader.height);
+	if (fileSize > UINT32_MAX && !sBmpAllowLarge) return ErrorBmpLarge;
+	pBmp->header.fileSize = BmpSizeField(fileSize);
+	return BmpWriteHeaderFields(pStream, pBmp);
+}
 
-	FileClose(bmpOut);
+tError BmpWriteRow(FILE *pStream, tPixel *pRow, int pWidth)
+{
+	byte pb[4] = { 0 };
+	if (FileWrite(pStream, pRow, sizeof(tPixel), pWidth) != 0) return ErrorFileWrite;
+	if (FileWrite(pStream, pb, sizeof(byte), BmpCalcPad(pWidth)) != 0) return ErrorFileWrite;
 	return ErrorNone;
 }
+
+tError BmpWriteStream(FILE *pStream, tBmp *pBmp)
+{
+	tError result = BmpWriteHeaders(pStream, pBmp);
+
+	// Scanlines are stored bottom to top. They are copied into a buffer, padding included, which is written
+	// when it is full.
+	int width = pBmp->infoHeader.width, height = pBmp->infoHeader.height;
+	size_t pixelBytes = 3 * (size_t)width, lineBytes = pixelBytes + BmpCalcPad(width);
+	int lines = BmpIoLines(lineBytes, height);
+	byte *buffer = (byte *)calloc(lines, lineBytes);
+	if (!buffer) result = ErrorFileWrite;
+	ProgressBegin("write", height, "rows");
+	for (int row = height-1; row >= 0 && result == ErrorNone; row -= lines) {
+		int count = row + 1 < lines ? row + 1 : lines;
+		for (int i = 0; i < count; ++i) memcpy(buffer + i * lineBytes, pBmp->pixel[row - i], pixelBytes);
+		if (FileWrite(pStream, buffer, lineBytes, count) != 0) result = ErrorFileWrite;
+		else if (!ProgressStep(count)) result = ErrorCancelled;
+	}
+	free(buffer);
+
+	return result;
+}
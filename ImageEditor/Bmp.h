@@ -3,11 +3,20 @@
  *
  * DESCRIPTION
  * Functions for reading and writing BMP images.
+ *
+ * The file size field of the BMPHEADER is 32 bits. Files over 2 GB are read if the field holds 0, as written by
+ * tools which give up on sizes that do not fit in a signed field, and files of 4 GB or more if it holds the
+ * size modulo 4 GB. Either way, the size of the pixel array is checked against the size of the file on disk.
+ * Files of 4 GB or more are only written if allowed by BmpAllowLarge(), with 0 in the field, because some
+ * readers reject them.
  **************************************************************************************************************/
 #ifndef BMP_H
 #define BMP_H
 
+#include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <sys/types.h>
 #include "Error.h"
 #include "Type.h"
 
@@ -15,7 +24,7 @@
 typedef struct {
 	byte		sigB;
 	byte 		sigM;
-	int32_t		fileSize;
+	uint32_t	fileSize;	// The size of the file, 0 or wrapped around if it is 4 GB or more.
 	int16_t		resv1;
 	int16_t		resv2;
 	int32_t		pixelOffset;
@@ -38,14 +47,60 @@ typedef struct {
 	tPixel			**pixel;
 } tBmp;
 
+// A histogram of an image. See Hist.h.
+typedef struct tHist tHist;
+
 extern const size_t cSizeofBmpHeader;
 extern const size_t cSizeofBmpInfoHeader;
 
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: BmpAllowLarge()
+ *
+ * DESCRIPTION
+ * Allows or forbids (the default) writing BMP files of 4 GB or more. While forbidden, the write functions
+ * return ErrorBmpLarge for such images without writing anything.
+ *------------------------------------------------------------------------------------------------------------*/
+void BmpAllowLarge(bool pAllow);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: BmpFileSize()
+ *
+ * DESCRIPTION
+ * Returns the size in bytes of the file BmpWrite() would write for the image pBmp, or BmpWriteGray() if its
+ * headers are those of an 8-bit image.
+ *------------------------------------------------------------------------------------------------------------*/
+off_t BmpFileSize(tBmp *pBmp);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: BmpFlipInPlace()
+ *
+ * DESCRIPTION
+ * Flips the BMP image in the file pFilename horizontally (pHoriz), vertically (pVert), or both (which is a
+ * 180 deg rotation) without reading the image into memory. Only one scanline is held in memory at a time: the
+ * scanlines are read with FileReadAt() in the order they appear in the flipped image, reversed within the
+ * row for a horizontal flip, and written to a temporary file which then replaces pFilename with an atomic
+ * rename. If the operation fails or the program is killed, pFilename is left unmodified. If pFilename is a
+ * symlink, the file it points to is flipped, and if it has other hard links, the temporary file is copied
+ * into it instead of renamed over it, so they see the flipped image (see FileCommit()).
+ *------------------------------------------------------------------------------------------------------------*/
+tError BmpFlipInPlace(char *pFilename, bool pHoriz, bool pVert);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: BmpInit()
+ *
+ * DESCRIPTION
+ * Initializes the headers of pBmp for a new 24-bit pWidth x pHeight image. No pixel array is allocated and
+ * pBmp->pixel is set to NULL.
+ *------------------------------------------------------------------------------------------------------------*/
+void BmpInit(tBmp *pBmp, int pWidth, int pHeight);
+
 /*--------------------------------------------------------------------------------------------------------------
  * FUNCTION: BmpPixelAlloc()
  *
  * DESCRIPTION
- * Allocates a 2D array of tPixel objects with pHeight rows and pWidth columns.
+ * Allocates a 2D array of tPixel objects with pHeight rows and pWidth columns. With NUMA placement (see
+ * Numa.h), the rows of each band of the array are allocated in a block of their own, placed on the node of
+ * the band. Returns NULL if the array could not be allocated.
  *------------------------------------------------------------------------------------------------------------*/
 tPixel **BmpPixelAlloc(int pWidth, int pHeight);
 
@@ -53,24 +108,99 @@ tPixel **BmpPixelAlloc(int pWidth, int pHeight);
  * FUNCTION: BmpPixelFree()
  *
  * DESCRIPTION
- * Deallocates a 2D array allocated by BmpPixelAlloc().
+ * Deallocates a 2D array allocated by BmpPixelAlloc(). Its rows must not be freed or replaced one by one.
  *------------------------------------------------------------------------------------------------------------*/
 void BmpPixelFree(tPixel **pPixel, int pHeight);
 
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: BmpProbe()
+ *
+ * DESCRIPTION
+ * Reads and validates only the BMPHEADER and BMPINFOHEADER structures of the file pFilename, including the
+ * check of the file size against the width and height. The pixel array is not read and pBmp->pixel is set to
+ * NULL. Use this when only the dimensions, depth, or validity of an image are needed. Besides 24-bit images,
+ * the 8-bit gray images written by BmpWriteGray() are valid, so a caller which reads the pixels itself must
+ * check the depth.
+ *------------------------------------------------------------------------------------------------------------*/
+tError BmpProbe(char *pFilename, tBmp *pBmp);
+
 /*--------------------------------------------------------------------------------------------------------------
  * FUNCTION: BmpRead()
  *
  * DESCRIPTION
- * Read a BMP image from the file pFilename and return the image info in the pBmp object.
+ * Read a BMP image from the file pFilename and return the image info in the pBmp object. If pHist is not NULL,
+ * the histogram of the image is computed while it is read, as each scanline is still in the cache. Returns
+ * ErrorCancelled if the deadline of the job passes while the image is read (see Progress.h), and ErrorBmpGray
+ * for an 8-bit gray image, as only 24-bit images are read.
  *------------------------------------------------------------------------------------------------------------*/
-tError BmpRead(char *pFilename, tBmp *pBmp);
+tError BmpRead(char *pFilename, tBmp *pBmp, tHist *pHist);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: BmpReadStream()
+ *
+ * DESCRIPTION
+ * Same as BmpRead(), but reads the image from the already open stream pStream which holds pSize bytes, e.g., a
+ * memory buffer opened with fmemopen(). If an error is returned, no pixel array is allocated.
+ *------------------------------------------------------------------------------------------------------------*/
+tError BmpReadStream(FILE *pStream, off_t pSize, tBmp *pBmp, tHist *pHist);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: BmpValidate()
+ *
+ * DESCRIPTION
+ * Validates the BMP image in the file pFilename without keeping it in memory. If pDeep is false, only the
+ * headers are checked (see BmpProbe()). If pDeep is true, the pixel array is also streamed one scanline at a
+ * time to verify that it can be read and that every padding byte is zero. As with BmpProbe(), 8-bit gray
+ * images are valid.
+ *------------------------------------------------------------------------------------------------------------*/
+tError BmpValidate(char *pFilename, bool pDeep);
 
 /*--------------------------------------------------------------------------------------------------------------
  * FUNCTION: BmpWrite()
  *
  * DESCRIPTION
- * Write the BMP image stored in the pBmp object to the file named pFilename.
+ * Write the BMP image stored in the pBmp object to the file named pFilename. The image is written to a
+ * temporary file which then replaces pFilename, so pFilename is left unmodified if the write fails or is
+ * cancelled (ErrorCancelled, see Progress.h).
  *------------------------------------------------------------------------------------------------------------*/
 tError BmpWrite(char *pFilename, tBmp *pBmp);
 
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: BmpWriteGray()
+ *
+ * DESCRIPTION
+ * Writes the pWidth x pHeight plane of bytes pPlane, top row first, to the file named pFilename as an 8-bit
+ * BMP image with a palette of 256 grays from black to white. As with BmpWrite(), pFilename is only replaced
+ * once the image is complete.
+ *------------------------------------------------------------------------------------------------------------*/
+tError BmpWriteGray(char *pFilename, byte *pPlane, int pWidth, int pHeight);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: BmpWriteHeaders()
+ *
+ * DESCRIPTION
+ * Writes the BMPHEADER and BMPINFOHEADER structures of pBmp to pStream, setting pBmp->header.fileSize from the
+ * width and height. The pixel array is not touched, so pBmp->pixel may be NULL. Together with BmpWriteRow(),
+ * this lets an image be written one scanline at a time. Returns ErrorBmpLarge, writing nothing, if the file
+ * would be 4 GB or more and that is not allowed (see BmpAllowLarge()).
+ *------------------------------------------------------------------------------------------------------------*/
+tError BmpWriteHeaders(FILE *pStream, tBmp *pBmp);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: BmpWriteRow()
+ *
+ * DESCRIPTION
+ * Writes one scanline of pWidth pixels, followed by its padding bytes, to pStream. Scanlines must be written
+ * after BmpWriteHeaders() and in the order they are stored in the file, i.e., bottom row first.
+ *------------------------------------------------------------------------------------------------------------*/
+tError BmpWriteRow(FILE *pStream, tPixel *pRow, int pWidth);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: BmpWriteStream()
+ *
+ * DESCRIPTION
+ * Same as BmpWrite(), but writes the image to the already open stream pStream.
+ *------------------------------------------------------------------------------------------------------------*/
+tError BmpWriteStream(FILE *pStream, tBmp *pBmp);
+
 #endif
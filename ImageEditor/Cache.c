@@ -0,0 +1,500 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * See comments in Cache.h.
+ **************************************************************************************************************/
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+#include "Cache.h"
+#include "File.h"
+#include "String.h"
+
+// Note: This constant is declared in Cache.h.
+const size_t cCacheSizeDefault = (size_t)1024 << 20;
+
+static const size_t   cCacheChunk  = 1 << 20;  // Files are hashed and copied in chunks of this many bytes.
+static const uint64_t cCachePrime1 = 0x9e3779b185ebca87ULL;
+static const uint64_t cCachePrime2 = 0xc2b2ae3d27d4eb4fULL;
+
+// The state of a hash computed over data passed in pieces. The data is consumed in 32-byte blocks, one
+// 8-byte word to each of four independent lanes so the multiplies can overlap.
+typedef struct {
+	uint64_t	lane[4];
+	uint64_t	size;
+	byte		tail[32];
+	size_t		tailLen;
+} tCacheHash;
+
+// A file in the cache directory, used when evicting.
+typedef struct {
+	char			name[CACHE_KEY_MAX + 8];
+	struct timespec	mtime;	// The time of the last use, to the ns, as many results may be stored in a second.
+	off_t			size;
+} tCacheFile;
+
+static void		CacheBump(tCache *pCache, int pHits, int pMisses, int pEvictions);
+static bool		CacheClone(FILE *pSrc, FILE *pDst);
+static int		CacheCompareAge(const void *pA, const void *pB);
+static void		CacheHashBlock(tCacheHash *pHash, byte *pBlock);
+static uint64_t	CacheHashEnd(tCacheHash *pHash);
+static void		CacheHashInit(tCacheHash *pHash);
+static void		CacheHashUpdate(tCacheHash *pHash, byte *pData, size_t pSize);
+static void		CacheMakeKey(char *pKey, tCacheHash *pHash, tOpQueue *pQueue);
+static void		CacheMemPut(tCache *pCache, char *pKey, void *pData, size_t pSize);
+static void		CachePath(tCache *pCache, char *pKey, char *pPath);
+static void		CacheTrim(tCache *pCache, char *pKey, long pAdded);
+static long		CacheUpdateStats(tCache *pCache, int pHits, int pMisses, int pEvictions, long pBytes,
+					bool pSetBytes);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: CacheBump()
+ *
+ * DESCRIPTION
+ * Adds to the hit, miss, and eviction counters in the stats file.
+ *------------------------------------------------------------------------------------------------------------*/
+static void CacheBump(tCache *pCache, int pHits, int pMisses, int pEvictions)
+{
+	CacheUpdateStats(pCache, pHits, pMisses, pEvictions, 0, false);
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: CacheClone()
+ *
+ * DESCRIPTION
+ * Makes pDst, which must be empty, a copy of pSrc. On Linux, we first try to share the file's blocks with a
+ * reflink, which is instant on file systems that support it (e.g., Btrfs, XFS).
+ *------------------------------------------------------------------------------------------------------------*/
+static bool CacheClone(FILE *pSrc, FILE *pDst)
+{
+#ifdef FICLONE
+	if (ioctl(fileno(pDst), FICLONE, fileno(pSrc)) == 0) return true;
+#endif
+	byte *chunk = (byte *)malloc(cCacheChunk);
+	if (!chunk) return false;
+	bool ok = true;
+	size_t n;
+	while (ok && (n = fread(chunk, 1, cCacheChunk, pSrc)) > 0) {
+		ok = FileWrite(pDst, chunk, n, 1) == 0;
+	}
+	ok = ok && !ferror(pSrc);
+	free(chunk);
+	return ok;
+}
+
+void CacheClose(tCache *pCache)
+{
+	while (pCache->oldest) {
+		tCacheEntry *entry = pCache->oldest;
+		pCache->oldest = entry->newer;
+		free(entry->data);
+		free(entry);
+	}
+	pCache->newest = NULL;
+	pCache->memBytes = 0;
+	pthread_mutex_destroy(&pCache->lock);
+}
+
+static int CacheCompareAge(const void *pA, const void *pB)
+{
+	const tCacheFile *a = (const tCacheFile *)pA, *b = (const tCacheFile *)pB;
+	if (a->mtime.tv_sec != b->mtime.tv_sec) return a->mtime.tv_sec < b->mtime.tv_sec ? -1 : 1;
+	if (a->mtime.tv_nsec != b->mtime.tv_nsec) return a->mtime.tv_nsec < b->mtime.tv_nsec ? -1 : 1;
+	return strcmp(a->name, b->name);
+}
+
+byte *CacheGetBytes(tCache *pCache, char *pKey, size_t *pSize)
+{
+	// Look in the in-memory tier first. A hit moves the entry to the front of the LRU list.
+	byte *data = NULL;
+	pthread_mutex_lock(&pCache->lock);
+	for (tCacheEntry *entry = pCache->newest; entry; entry = entry->older) {
+		if (!streq(entry->key, pKey)) continue;
+		data = (byte *)malloc(entry->size);
+		if (data) {
+			memcpy(data, entry->data, entry->size);
+			*pSize = entry->size;
+		}
+		if (entry != pCache->newest) {
+			if (entry->older) entry->older->newer = entry->newer;
+			else pCache->oldest = entry->newer;
+			entry->newer->older = entry->older;
+			entry->older = pCache->newest;
+			entry->newer = NULL;
+			pCache->newest->newer = entry;
+			pCache->newest = entry;
+		}
+		break;
+	}
+	pthread_mutex_unlock(&pCache->lock);
+	if (data) {
+		CacheBump(pCache, 1, 0, 0);
+		return data;
+	}
+
+	// Then in the cache directory.
+	char path[FILENAME_MAX];
+	CachePath(pCache, pKey, path);
+	long size = FileSize(path);
+	FILE *stream = size > 0 ? FileOpen(path, "rb") : NULL;
+	if (stream) {
+		data = (byte *)malloc(size);
+		if (data && FileRead(stream, data, size, 1) != 0) {
+			free(data);
+			data = NULL;
+		}
+		FileClose(stream);
+	}
+	if (!data) {
+		CacheBump(pCache, 0, 1, 0);
+		return NULL;
+	}
+	utimensat(AT_FDCWD, path, NULL, 0);
+	CacheMemPut(pCache, pKey, data, size);
+	CacheBump(pCache, 1, 0, 0);
+	*pSize = (size_t)size;
+	return data;
+}
+
+bool CacheGetFile(tCache *pCache, char *pKey, char *pFilename)
+{
+	char path[FILENAME_MAX], tempName[FILENAME_MAX];
+	CachePath(pCache, pKey, path);
+	FILE *src = FileOpen(path, "rb");
+	if (!src) {
+		CacheBump(pCache, 0, 1, 0);
+		return false;
+	}
+	FILE *dst = FileOpenTemp(pFilename, tempName);
+	bool ok = dst && CacheClone(src, dst);
+	FileClose(src);
+	if (dst && !ok) FileDiscard(dst, tempName);
+	if (ok) ok = FileCommit(dst, tempName, pFilename) == 0;
+
+	// Touching the result marks it as recently used.
+	if (ok) utimensat(AT_FDCWD, path, NULL, 0);
+	CacheBump(pCache, ok ? 1 : 0, ok ? 0 : 1, 0);
+	return ok;
+}
+
+static void CacheHashBlock(tCacheHash *pHash, byte *pBlock)
+{
+	for (int i = 0; i < 4; ++i) {
+		uint64_t word;
+		memcpy(&word, pBlock + 8 * i, sizeof(word));
+		uint64_t lane = pHash->lane[i] + word * cCachePrime2;
+		pHash->lane[i] = (lane << 31 | lane >> 33) * cCachePrime1;
+	}
+}
+
+static uint64_t CacheHashEnd(tCacheHash *pHash)
+{
+	uint64_t h = (pHash->lane[0] << 1 | pHash->lane[0] >> 63) + (pHash->lane[1] << 7 | pHash->lane[1] >> 57) +
+		(pHash->lane[2] << 12 | pHash->lane[2] >> 52) + (pHash->lane[3] << 18 | pHash->lane[3] >> 46);
+	h ^= pHash->size * cCachePrime1;
+	for (size_t i = 0; i < pHash->tailLen; ++i) {
+		h = (h ^ pHash->tail[i]) * cCachePrime1;
+	}
+	h ^= h >> 33; h *= cCachePrime2;
+	h ^= h >> 29; h *= cCachePrime1;
+	h ^= h >> 32;
+	return h;
+}
+
+static void CacheHashInit(tCacheHash *pHash)
+{
+	memset(pHash, 0, sizeof(tCacheHash));
+	pHash->lane[0] = cCachePrime1 + cCachePrime2;
+	pHash->lane[1] = cCachePrime2;
+	pHash->lane[2] = 0;
+	pHash->lane[3] = -cCachePrime1;
+}
+
+static void CacheHashUpdate(tCacheHash *pHash, byte *pData, size_t pSize)
+{
+	pHash->size += pSize;
+
+	// Complete the block left over from the previous call, then hash whole blocks straight from pData and
+	// keep what is left for the next call.
+	while (pHash->tailLen > 0 && pSize > 0) {
+		size_t n = 32 - pHash->tailLen < pSize ? 32 - pHash->tailLen : pSize;
+		memcpy(pHash->tail + pHash->tailLen, pData, n);
+		pHash->tailLen += n; pData += n; pSize -= n;
+		if (pHash->tailLen == 32) {
+			CacheHashBlock(pHash, pHash->tail);
+			pHash->tailLen = 0;
+		}
+	}
+	for (; pSize >= 32; pData += 32, pSize -= 32) {
+		CacheHashBlock(pHash, pData);
+	}
+	memcpy(pHash->tail + pHash->tailLen, pData, pSize);
+	pHash->tailLen += pSize;
+}
+
+void CacheKey(char *pKey, void *pData, size_t pSize, tOpQueue *pQueue)
+{
+	tCacheHash hash;
+	CacheHashInit(&hash);
+	CacheHashUpdate(&hash, (byte *)pData, pSize);
+	CacheMakeKey(pKey, &hash, pQueue);
+}
+
+tError CacheKeyFile(char *pKey, char *pFilename, tOpQueue *pQueue)
+{
+	FILE *stream = FileOpen(pFilename, "rb");
+	if (!stream) return ErrorFileOpen;
+	byte *chunk = (byte *)malloc(cCacheChunk);
+	tCacheHash hash;
+	CacheHashInit(&hash);
+	size_t n;
+	while (chunk && (n = fread(chunk, 1, cCacheChunk, stream)) > 0) {
+		CacheHashUpdate(&hash, chunk, n);
+	}
+	tError result = !chunk || ferror(stream) ? ErrorFileRead : ErrorNone;
+	free(chunk);
+	FileClose(stream);
+	if (result == ErrorNone) CacheMakeKey(pKey, &hash, pQueue);
+	return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: CacheMakeKey()
+ *
+ * DESCRIPTION
+ * The key is the hash of the image bytes, the number of image bytes, and the hash of the normalized plan, in
+ * hex.
+ *------------------------------------------------------------------------------------------------------------*/
+static void CacheMakeKey(char *pKey, tCacheHash *pHash, tOpQueue *pQueue)
+{
+	char plan[OP_PLAN_MAX];
+	OpQueuePlan(pQueue, plan);
+	tCacheHash planHash;
+	CacheHashInit(&planHash);
+	CacheHashUpdate(&planHash, (byte *)plan, strlen(plan));
+	snprintf(pKey, CACHE_KEY_MAX, "%016llx%016llx%016llx", (unsigned long long)CacheHashEnd(pHash),
+		(unsigned long long)pHash->size, (unsigned long long)CacheHashEnd(&planHash));
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: CacheMemPut()
+ *
+ * DESCRIPTION
+ * Adds a copy of a result to the front of the in-memory tier's LRU list, evicting from the back as needed.
+ * Results larger than the whole tier are not kept.
+ *------------------------------------------------------------------------------------------------------------*/
+static void CacheMemPut(tCache *pCache, char *pKey, void *pData, size_t pSize)
+{
+	if (pSize > pCache->memMaxBytes) return;
+	tCacheEntry *entry = (tCacheEntry *)malloc(sizeof(tCacheEntry));
+	byte *data = (byte *)malloc(pSize);
+	if (!entry || !data) {
+		free(entry);
+		free(data);
+		return;
+	}
+	memcpy(data, pData, pSize);
+	snprintf(entry->key, sizeof(entry->key), "%s", pKey);
+	entry->data = data;
+	entry->size = pSize;
+
+	pthread_mutex_lock(&pCache->lock);
+	while (pCache->oldest && pCache->memBytes + pSize > pCache->memMaxBytes) {
+		tCacheEntry *old = pCache->oldest;
+		pCache->oldest = old->newer;
+		if (pCache->oldest) pCache->oldest->older = NULL;
+		else pCache->newest = NULL;
+		pCache->memBytes -= old->size;
+		free(old->data);
+		free(old);
+	}
+	entry->newer = NULL;
+	entry->older = pCache->newest;
+	if (pCache->newest) pCache->newest->newer = entry;
+	else pCache->oldest = entry;
+	pCache->newest = entry;
+	pCache->memBytes += pSize;
+	pthread_mutex_unlock(&pCache->lock);
+}
+
+tError CacheOpen(tCache *pCache, char *pDir, size_t pMaxBytes, size_t pMemMaxBytes)
+{
+	memset(pCache, 0, sizeof(tCache));
+	if (mkdir(pDir, 0755) != 0 && errno != EEXIST) return ErrorFileOpen;
+	struct stat dirStat;
+	if (stat(pDir, &dirStat) != 0 || !S_ISDIR(dirStat.st_mode)) return ErrorFileOpen;
+	pCache->dir = pDir;
+	pCache->maxBytes = pMaxBytes;
+	pCache->memMaxBytes = pMemMaxBytes;
+	pthread_mutex_init(&pCache->lock, NULL);
+	return ErrorNone;
+}
+
+static void CachePath(tCache *pCache, char *pKey, char *pPath)
+{
+	snprintf(pPath, FILENAME_MAX, "%s/%s.bmp", pCache->dir, pKey);
+}
+
+void CachePutBytes(tCache *pCache, char *pKey, void *pData, size_t pSize)
+{
+	char path[FILENAME_MAX], tempName[FILENAME_MAX];
+	if (pCache->memMaxBytes > 0) CacheMemPut(pCache, pKey, pData, pSize);
+	CachePath(pCache, pKey, path);
+	off_t oldSize = FileSize(path);
+	FILE *stream = FileOpenTemp(path, tempName);
+	if (!stream) return;
+	if (FileWrite(stream, pData, pSize, 1) != 0) FileDiscard(stream, tempName);
+	else if (FileCommit(stream, tempName, path) == 0) {
+		CacheTrim(pCache, pKey, (long)pSize - (long)(oldSize > 0 ? oldSize : 0));
+	}
+}
+
+void CachePutFile(tCache *pCache, char *pKey, char *pFilename)
+{
+	char path[FILENAME_MAX], tempName[FILENAME_MAX];
+	CachePath(pCache, pKey, path);
+	off_t oldSize = FileSize(path);
+	FILE *src = FileOpen(pFilename, "rb");
+	if (!src) return;
+	FILE *dst = FileOpenTemp(path, tempName);
+	bool ok = dst && CacheClone(src, dst);
+	FileClose(src);
+	if (dst && !ok) FileDiscard(dst, tempName);
+	if (ok && FileCommit(dst, tempName, path) == 0) {
+		CacheTrim(pCache, pKey, (long)FileSize(path) - (long)(oldSize > 0 ? oldSize : 0));
+	}
+}
+
+void CacheReadStats(tCache *pCache, tCacheStats *pStats)
+{
+	char path[FILENAME_MAX];
+	memset(pStats, 0, sizeof(tCacheStats));
+	snprintf(path, sizeof(path), "%s/stats", pCache->dir);
+	FILE *stream = FileOpen(path, "rt");
+	if (stream) {
+		if (fscanf(stream, "hits %ld misses %ld evictions %ld", &pStats->hits, &pStats->misses,
+			&pStats->evictions) != 3) {
+			pStats->hits = pStats->misses = pStats->evictions = 0;
+		}
+		FileClose(stream);
+	}
+	DIR *dir = opendir(pCache->dir);
+	if (!dir) return;
+	for (struct dirent *ent = readdir(dir); ent; ent = readdir(dir)) {
+		size_t len = strlen(ent->d_name);
+		if (len < 4 || !streq(ent->d_name + len - 4, ".bmp")) continue;
+		snprintf(path, sizeof(path), "%s/%s", pCache->dir, ent->d_name);
+		long size = FileSize(path);
+		if (size < 0) continue;
+		++pStats->entries;
+		pStats->bytes += size;
+	}
+	closedir(dir);
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: CacheTrim()
+ *
+ * DESCRIPTION
+ * Called after the result pKey of pAdded more bytes than the one it replaced was stored. If the results in the
+ * cache directory then take more than maxBytes, deletes the least recently used ones (the ones with the oldest
+ * modification times) until they fit, but never pKey itself. The size of the results is tracked in the stats
+ * file, so the directory is only listed when it has to be trimmed, or when the size is not known yet. The
+ * listing also corrects the tracked size for changes made outside the cache, e.g., deleted results.
+ *------------------------------------------------------------------------------------------------------------*/
+static void CacheTrim(tCache *pCache, char *pKey, long pAdded)
+{
+	long tracked = CacheUpdateStats(pCache, 0, 0, 0, pAdded, false);
+	if (tracked >= 0 && (unsigned long long)tracked <= pCache->maxBytes) return;
+
+	DIR *dir = opendir(pCache->dir);
+	if (!dir) return;
+	tCacheFile *files = NULL;
+	size_t count = 0, cap = 0;
+	unsigned long long total = 0;
+	char path[FILENAME_MAX], keep[CACHE_KEY_MAX + 8];
+	snprintf(keep, sizeof(keep), "%s.bmp", pKey);
+	for (struct dirent *ent = readdir(dir); ent; ent = readdir(dir)) {
+		size_t len = strlen(ent->d_name);
+		if (len < 4 || len >= sizeof(files->name) || !streq(ent->d_name + len - 4, ".bmp")) continue;
+		snprintf(path, sizeof(path), "%s/%s", pCache->dir, ent->d_name);
+		struct stat fileStat;
+		if (stat(path, &fileStat) != 0) continue;
+		total += fileStat.st_size;
+		if (streq(ent->d_name, keep)) continue;
+		if (count == cap) {
+			cap = cap ? 2 * cap : 64;
+			tCacheFile *grown = (tCacheFile *)realloc(files, cap * sizeof(tCacheFile));
+			if (!grown) break;
+			files = grown;
+		}
+		strcpy(files[count].name, ent->d_name);
+		files[count].mtime = fileStat.st_mtim;
+		files[count].size = fileStat.st_size;
+		++count;
+	}
+	closedir(dir);
+
+	int evictions = 0;
+	if (total > pCache->maxBytes) {
+		qsort(files, count, sizeof(tCacheFile), CacheCompareAge);
+		for (size_t i = 0; i < count && total > pCache->maxBytes; ++i) {
+			snprintf(path, sizeof(path), "%s/%s", pCache->dir, files[i].name);
+			if (unlink(path) == 0) {
+				total -= files[i].size;
+				++evictions;
+			}
+		}
+	}
+	free(files);
+	CacheUpdateStats(pCache, 0, 0, evictions, (long)total, true);
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: CacheUpdateStats()
+ *
+ * DESCRIPTION
+ * Adds to the counters in the stats file, and adds pBytes to the size of the results in the cache directory
+ * kept there, or sets it to pBytes if pSetBytes is true. The file is locked so several processes can share the
+ * cache. Returns the new size, or -1 if it is not known, i.e., the directory has not been listed yet.
+ *------------------------------------------------------------------------------------------------------------*/
+static long CacheUpdateStats(tCache *pCache, int pHits, int pMisses, int pEvictions, long pBytes,
+	bool pSetBytes)
+{
+	char path[FILENAME_MAX];
+	snprintf(path, sizeof(path), "%s/stats", pCache->dir);
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) return -1;
+	struct flock lock;
+	memset(&lock, 0, sizeof(lock));
+	lock.l_type = F_WRLCK;
+	lock.l_whence = SEEK_SET;
+	long bytes = -1;
+	if (fcntl(fd, F_SETLKW, &lock) == 0) {
+		char text[256] = { 0 };
+		long hits = 0, misses = 0, evictions = 0;
+		if (pread(fd, text, sizeof(text) - 1, 0) > 0) {
+			sscanf(text, "hits %ld misses %ld evictions %ld bytes %ld", &hits, &misses, &evictions, &bytes);
+		}
+		if (pSetBytes) bytes = pBytes;
+		else if (bytes >= 0) bytes = bytes + pBytes > 0 ? bytes + pBytes : 0;
+		int len = snprintf(text, sizeof(text), "hits %ld\nmisses %ld\nevictions %ld\nbytes %ld\n", hits + pHits,
+			misses + pMisses, evictions + pEvictions, bytes);
+		if (pwrite(fd, text, len, 0) == len) ftruncate(fd, len);
+		lock.l_type = F_UNLCK;
+		fcntl(fd, F_SETLK, &lock);
+	}
+	close(fd);
+	return bytes;
+}
@@ -0,0 +1,137 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * A cache of the results of edit requests. A result is keyed by a fast 64-bit hash and the size of the input
+ * image bytes plus a hash of the normalized operation plan (see OpQueuePlan()), so repeating a request with
+ * the same image and an equivalent list of operations is served from the cache without reading, processing,
+ * or writing the image. Results are stored as files in a cache directory, with an optional in-memory tier
+ * for the server. The least recently used results are evicted when the directory grows past its size limit.
+ * Hit, miss, and eviction counters, and the size of the results, are kept in the file 'stats' in the cache
+ * directory.
+ **************************************************************************************************************/
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "Error.h"
+#include "Op.h"
+#include "Type.h"
+
+// The length of a cache key, including the null terminator.
+#define CACHE_KEY_MAX 49
+
+extern const size_t cCacheSizeDefault;
+
+// A result held in the in-memory tier.
+typedef struct tCacheEntry {
+	byte				*data;
+	char				key[CACHE_KEY_MAX];
+	struct tCacheEntry	*newer;
+	struct tCacheEntry	*older;
+	size_t				size;
+} tCacheEntry;
+
+// An open cache. All functions may be called from several threads at once.
+typedef struct {
+	char			*dir;			// The cache directory.
+	pthread_mutex_t	lock;			// Protects the in-memory tier.
+	size_t			maxBytes;		// The size limit of the cache directory.
+	size_t			memBytes;		// The bytes held in the in-memory tier.
+	size_t			memMaxBytes;	// The size limit of the in-memory tier, 0 for no in-memory tier.
+	tCacheEntry		*newest;		// The most recently used entry in the in-memory tier.
+	tCacheEntry		*oldest;		// The least recently used entry in the in-memory tier.
+} tCache;
+
+// The counters kept in the cache directory.
+typedef struct {
+	long	entries;
+	long	evictions;
+	long	hits;
+	long	misses;
+	long	bytes;
+} tCacheStats;
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: CacheClose()
+ *
+ * DESCRIPTION
+ * Frees the in-memory tier. The cache directory is left as it is.
+ *------------------------------------------------------------------------------------------------------------*/
+void CacheClose(tCache *pCache);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: CacheGetBytes()
+ *
+ * DESCRIPTION
+ * Looks up pKey, first in the in-memory tier and then in the cache directory. On a hit, returns a malloc()ed
+ * copy of the result which the caller must free(), with its size in pSize. Returns NULL on a miss.
+ *------------------------------------------------------------------------------------------------------------*/
+byte *CacheGetBytes(tCache *pCache, char *pKey, size_t *pSize);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: CacheGetFile()
+ *
+ * DESCRIPTION
+ * Looks up pKey in the cache directory. On a hit, the result is cloned (a reflink, where the file system
+ * supports it, otherwise a copy) to a temporary file which then replaces pFilename, and true is returned.
+ * Returns false on a miss.
+ *------------------------------------------------------------------------------------------------------------*/
+bool CacheGetFile(tCache *pCache, char *pKey, char *pFilename);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: CacheKey()
+ *
+ * DESCRIPTION
+ * Makes the cache key of the request to perform the operations in pQueue on the image whose bytes are pData.
+ * pKey must be at least CACHE_KEY_MAX chars.
+ *------------------------------------------------------------------------------------------------------------*/
+void CacheKey(char *pKey, void *pData, size_t pSize, tOpQueue *pQueue);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: CacheKeyFile()
+ *
+ * DESCRIPTION
+ * Same as CacheKey(), but the image bytes are streamed from the file pFilename.
+ *------------------------------------------------------------------------------------------------------------*/
+tError CacheKeyFile(char *pKey, char *pFilename, tOpQueue *pQueue);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: CacheOpen()
+ *
+ * DESCRIPTION
+ * Opens the cache in directory pDir, creating the directory if needed. The directory is limited to pMaxBytes
+ * bytes of results and the in-memory tier to pMemMaxBytes bytes (0 disables the in-memory tier). Returns
+ * ErrorFileOpen if the directory cannot be created.
+ *------------------------------------------------------------------------------------------------------------*/
+tError CacheOpen(tCache *pCache, char *pDir, size_t pMaxBytes, size_t pMemMaxBytes);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: CachePutBytes()
+ *
+ * DESCRIPTION
+ * Stores the result pData under pKey in the cache directory and, if enabled, the in-memory tier, evicting
+ * the least recently used results as needed.
+ *------------------------------------------------------------------------------------------------------------*/
+void CachePutBytes(tCache *pCache, char *pKey, void *pData, size_t pSize);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: CachePutFile()
+ *
+ * DESCRIPTION
+ * Stores the result in the file pFilename under pKey in the cache directory, evicting the least recently
+ * used results as needed.
+ *------------------------------------------------------------------------------------------------------------*/
+void CachePutFile(tCache *pCache, char *pKey, char *pFilename);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: CacheReadStats()
+ *
+ * DESCRIPTION
+ * Reads the counters of the cache directory and counts the results stored in it.
+ *------------------------------------------------------------------------------------------------------------*/
+void CacheReadStats(tCache *pCache, tCacheStats *pStats);
+
+#endif
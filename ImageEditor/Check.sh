@@ -0,0 +1,354 @@
+#!/bin/bash
+#***************************************************************************************************************
+# FILE: Check.sh
+#
+# DESCRIPTION
+# Checks the handling of BMP files over 4 GB, run by "make check". The images are 40002 x 40000 sparse files,
+# one whose header holds the file size mod 2^32 and one whose header holds 0, so they take little disk space
+# until the in-place rotation and the --large-bmp write fill them in. About 10 GB must be free in $TMPDIR. It
+# also checks that an in-place rotation through a symlink or a hard link rotates the file they refer to and
+# keeps the link, and checks the filters on small random images.
+#
+# Usage: Check.sh binary
+#***************************************************************************************************************
+
+BINARY=$(realpath "${1:-./bimpie}")
+WIDTH=40002
+HEIGHT=40000
+LINE=$(( (WIDTH * 3 + 3) / 4 * 4 ))
+SIZE=$(( 54 + LINE * HEIGHT ))
+
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+failed=0
+
+# Writes the 32-bit value $1 in little-endian byte order.
+le32() {
+	printf "$(printf '\\%03o\\%03o\\%03o\\%03o' $(($1 & 255)) $(($1 >> 8 & 255)) $(($1 >> 16 & 255)) \
+		$(($1 >> 24 & 255)))"
+}
+
+# Writes the headers of a 24-bit $1 x $2 image with the size field $3.
+bmp_headers() {
+	printf 'BM'; le32 $3; le32 0; le32 54; le32 40; le32 $1; le32 $2; printf '\001\000\030\000'
+	head -c 24 /dev/zero
+}
+
+# Makes the sparse image $1 with the size field $2. Its upper left pixel is blue 1, green 2, red 3 and all the
+# other pixels are black.
+make_bmp() {
+	bmp_headers $WIDTH $HEIGHT $2 > "$1"
+	printf '\001\002\003' | dd of="$1" bs=1 seek=$(( 54 + LINE * (HEIGHT - 1) )) conv=notrunc status=none
+	truncate -s $SIZE "$1"
+}
+
+# Makes the $2 x $3 image $1 of random pixels from the seed $4. The channels take $5 evenly spaced values
+# (default 4), so that with few of them the image has flat areas as well as edges.
+make_small() {
+	local line=$(( ($2 * 3 + 3) / 4 * 4 ))
+	{ bmp_headers $2 $3 $(( 54 + line * $3 ))
+		LC_ALL=C awk -v w=$2 -v h=$3 -v line=$line -v seed=$4 -v levels=${5:-4} 'BEGIN { srand(seed)
+			for (y = 0; y < h; ++y) for (i = 0; i < line; ++i)
+				printf "%c", i < 3 * w ? int(rand() * levels) * 255 / (levels - 1) : 0 }'
+	} > "$1"
+}
+
+# Lists the bytes of the pixel array of the image $1, one per line.
+pixels() {
+	od -An -v -tu1 -j54 "$1" | tr -s ' ' '\n' | sed '/^$/d'
+}
+
+# Lists the bytes of the pixel array of the $2 x $3 image $1 filtered by the median of radius $4, computed
+# directly from its definition: the middle of the sorted values of each channel in the window, whose
+# pixels outside the image are those of the nearest edge.
+median_ref() {
+	pixels "$1" | awk -v w=$2 -v h=$3 -v r=$4 -v line=$(( ($2 * 3 + 3) / 4 * 4 )) '
+		{ p[NR - 1] = $1 }
+		END {
+			n = (2 * r + 1) * (2 * r + 1)
+			for (y = 0; y < h; ++y) for (i = 0; i < line; ++i) {
+				if (i >= 3 * w) { print 0; continue }
+				x = int(i / 3); c = i % 3
+				for (k = 0; k < n; ++k) {
+					yy = y + int(k / (2 * r + 1)) - r; xx = x + k % (2 * r + 1) - r
+					yy = yy < 0 ? 0 : yy >= h ? h - 1 : yy; xx = xx < 0 ? 0 : xx >= w ? w - 1 : xx
+					v = p[yy * line + 3 * xx + c]
+					for (j = k; j > 0 && s[j - 1] > v; --j) s[j] = s[j - 1]
+					s[j] = v
+				}
+				print s[(n - 1) / 2]
+			}
+		}'
+}
+
+# Lists the bytes of the planes of the $2 x $3 image $1 converted to the color space $4 other than hsv, top
+# row first, computed from the 16-bit fixed point weights of each plane as a plain weighted sum.
+color_ref() {
+	pixels "$1" | awk -v w=$2 -v h=$3 -v line=$(( ($2 * 3 + 3) / 4 * 4 )) -v space=$4 '
+		BEGIN {
+			weights["gray"] = "7471 38470 19595 0"
+			weights["gray709"] = "4732 46871 13933 0"
+			weights["ycbcr"] = "7471 38470 19595 0 32768 -21709 -11059 128 -5329 -27439 32768 128"
+			weights["blue"] = "65536 0 0 0"
+			weights["green"] = "0 65536 0 0"
+			weights["red"] = "0 0 65536 0"
+			planes = split(weights[space], wt) / 4
+		}
+		{ p[NR - 1] = $1 }
+		END {
+			for (k = 0; k < planes; ++k) for (y = h - 1; y >= 0; --y) for (x = 0; x < w; ++x) {
+				i = y * line + 3 * x
+				v = int((wt[4 * k + 1] * p[i] + wt[4 * k + 2] * p[i + 1] + wt[4 * k + 3] * p[i + 2] + \
+					wt[4 * k + 4] * 65536 + 32768) / 65536)
+				print (v < 0 ? 0 : v > 255 ? 255 : v)
+			}
+		}'
+}
+
+# Lists the bytes of the pixel array of the $2 x $3 image $1 scaled by $4 across and $5 down, powers of two so
+# that the sampled points are exact in 16.16 fixed point, with --interp $6 (bilinear or bicubic) on a black
+# background. Each output pixel is the sum of the taps around its point, with the weights of --affine.
+warp_ref() {
+	pixels "$1" | awk -v w=$2 -v h=$3 -v sx=$4 -v sy=$5 -v taps=$([ $6 = bicubic ] && echo 4 || echo 2) '
+		function round(x) { return x < 0 ? -int(-x + 0.5) : int(x + 0.5) }
+		function floor16(x) { return x < 0 ? -int((-x + 65535) / 65536) : int(x / 65536) }
+		function pixel(x, y, c) {
+			return x < 0 || y < 0 || x >= w || y >= h ? 0 : p[(h - 1 - y) * line + 3 * x + c]
+		}
+		BEGIN {
+			line = int((w * 3 + 3) / 4) * 4
+			for (phase = 0; phase < 256; ++phase) {
+				t = phase / 256
+				if (taps == 2) {
+					f[0] = 1 - t; f[1] = t
+				} else {
+					f[0] = ((-0.5 * t + 1) * t - 0.5) * t; f[1] = (1.5 * t - 2.5) * t * t + 1
+					f[2] = ((-1.5 * t + 2) * t + 0.5) * t; f[3] = (0.5 * t - 0.5) * t * t
+				}
+				sum = 0; largest = 0
+				for (k = 0; k < taps; ++k) {
+					wt[phase, k] = round(f[k] * 256); sum += wt[phase, k]
+					if (f[k] > f[largest]) largest = k
+				}
+				wt[phase, largest] += 256 - sum
+			}
+		}
+		{ p[NR - 1] = $1 }
+		END {
+			W = w * sx; H = h * sy; outLine = int((W * 3 + 3) / 4) * 4
+			for (Y = H - 1; Y >= 0; --Y) for (i = 0; i < outLine; ++i) {
+				if (i >= 3 * W) { print 0; continue }
+				X = int(i / 3); c = i % 3
+				u = ((X + 0.5) / sx - 0.5) * 65536; v = ((Y + 0.5) / sy - 0.5) * 65536
+				xi = floor16(u); yi = floor16(v)
+				px = int((u - xi * 65536) / 256); py = int((v - yi * 65536) / 256)
+				x0 = xi - (taps == 4); y0 = yi - (taps == 4); sum = 0
+				for (ky = 0; ky < taps; ++ky) {
+					rowSum = 0
+					for (kx = 0; kx < taps; ++kx) rowSum += wt[px, kx] * pixel(x0 + kx, y0 + ky, c)
+					sum += wt[py, ky] * rowSum
+				}
+				value = int((sum + 32768) / 65536)
+				print (sum < 0 ? 0 : value > 255 ? 255 : value)
+			}
+		}'
+}
+
+# Makes the $2 x $3 32-bit image $1 of random colors and alphas from the seed $4.
+make_alpha() {
+	{ printf 'BM'; le32 $(( 54 + $2 * $3 * 4 )); le32 0; le32 54; le32 40; le32 $2; le32 $3
+		printf '\001\000\040\000'; head -c 24 /dev/zero
+		LC_ALL=C awk -v n=$(( $2 * $3 * 4 )) -v seed=$4 'BEGIN { srand(seed)
+			for (i = 0; i < n; ++i) printf "%c", int(rand() * 256) }'
+	} > "$1"
+}
+
+# Lists the bytes of the pixel array of the $2 x $3 image $1 with the $5 x $6 32-bit image $4 blended at ($7,
+# $8) with the opacity $9 in [0, 255]: the premultiplied overlay scaled by the opacity, plus the image scaled
+# by what the overlay's alpha times the opacity leaves of it, each product rounded to 8 bits.
+overlay_ref() {
+	awk -v w=$2 -v h=$3 -v ow=$5 -v oh=$6 -v ox=$7 -v oy=$8 -v opacity=$9 '
+		function div255(v) { v += 128; return int((v + int(v / 256)) / 256) }
+		NR == FNR { p[NR - 1] = $1; next }
+		{ q[FNR - 1] = $1 }
+		END {
+			line = int((w * 3 + 3) / 4) * 4
+			for (i = 0; i < h * line; ++i) {
+				x = int(i % line / 3) - ox; y = h - 1 - int(i / line) - oy; c = i % line % 3; v = p[i]
+				if (i % line < 3 * w && x >= 0 && y >= 0 && x < ow && y < oh) {
+					j = ((oh - 1 - y) * ow + x) * 4
+					alpha = div255(q[j + 3] * opacity)
+					if (alpha) v = div255(div255(q[j + c] * q[j + 3]) * opacity) + div255(v * (255 - alpha))
+				}
+				print v
+			}
+		}' <(pixels "$1") <(pixels "$4")
+}
+
+# Runs the test named $1, i.e., the command $3..., which is expected to exit with status 0 if $2 is "pass"
+# or some other status if $2 is "fail".
+run() {
+	local name=$1 expect=$2
+	shift 2
+	"$@" > "$DIR/out" 2>&1
+	local status=$?
+	if [ $expect = pass -a $status -ne 0 ] || [ $expect = fail -a $status -eq 0 ]; then
+		echo "FAIL: $name (exit status $status)"
+		cat "$DIR/out"
+		failed=1
+	else
+		echo "ok:   $name"
+	fi
+}
+
+# Checks that the pixel at column $2, row $3 of the image $1, read with --tiled --crop, is blue 1, green 2,
+# red 3.
+run_pixel() {
+	rm -f "$DIR/px.bmp"
+	"$BINARY" --tiled --crop $2,$3,1,1 "$1" -o "$DIR/px.bmp" > "$DIR/out" 2>&1
+	local status=$? pixel=$(od -An -tu1 -j54 -N3 "$DIR/px.bmp" 2>/dev/null | tr -s ' ')
+	if [ $status -ne 0 ] || [ "$pixel" != " 1 2 3" ]; then
+		echo "FAIL: $4 (exit status $status, pixel$pixel)"
+		cat "$DIR/out"
+		failed=1
+	else
+		echo "ok:   $4"
+	fi
+}
+
+# An opening is never brighter than the image and a closing never darker, whichever the lengths of the
+# element, including even ones, whose dilation must use the reflected element.
+make_small "$DIR/morph.bmp" 37 23 1
+for size in 2,1 1,2 4,3 3,4 6,6 5,5; do
+	"$BINARY" --open $size "$DIR/morph.bmp" -o "$DIR/open.bmp" > /dev/null 2>&1 &&
+		"$BINARY" --close $size "$DIR/morph.bmp" -o "$DIR/close.bmp" > /dev/null 2>&1 &&
+		paste <(pixels "$DIR/open.bmp") <(pixels "$DIR/morph.bmp") <(pixels "$DIR/close.bmp") |
+		awk '$1 > $2 || $2 > $3 { exit 1 }'
+	if [ $? -ne 0 ]; then
+		echo "FAIL: --open $size <= image <= --close $size"
+		failed=1
+	else
+		echo "ok:   --open $size <= image <= --close $size"
+	fi
+done
+
+# A cache of 1 MB holds two of the 360 KB results. Those stored last must be the ones kept, even when all
+# of them are stored within the same second.
+make_small "$DIR/cached.bmp" 400 300 2
+for x in 1 2 3 4 5 6 6 5; do
+	"$BINARY" --cache "$DIR/cache" --cache-size 1 --crop $x,0,399,300 "$DIR/cached.bmp" -o "$DIR/crop.bmp" \
+		> /dev/null 2>&1
+done
+run "--cache keeps the newest results" pass grep -q " 2 hits, 6 misses, 4 evictions, 2 results" \
+	<("$BINARY" --cache "$DIR/cache" --cache-stats)
+
+# The median of each radius matches its definition, both with the sorting networks of the small radii and
+# with the histograms of the larger ones, across the runs and strips they split the rows into.
+make_small "$DIR/median.bmp" 150 12 4 256
+for radius in 1 2 4; do
+	"$BINARY" --median $radius "$DIR/median.bmp" -o "$DIR/median-$radius.bmp" > /dev/null 2>&1
+	run "--median $radius matches the reference" pass cmp <(pixels "$DIR/median-$radius.bmp") \
+		<(median_ref "$DIR/median.bmp" 150 12 $radius)
+done
+
+# Each plane of --convert matches its weighted sum, over 16-pixel blocks of the split and mix and their tail.
+make_small "$DIR/color.bmp" 150 12 5 256
+for space in gray gray709 ycbcr blue green red; do
+	"$BINARY" --convert $space --planar "$DIR/color.bmp" -o "$DIR/color.raw" > /dev/null 2>&1
+	run "--convert $space matches the reference" pass cmp <(od -An -v -tu1 "$DIR/color.raw" | tr -s ' ' '\n' |
+		sed '/^$/d') <(color_ref "$DIR/color.bmp" 150 12 $space)
+done
+
+# Scaling by 2 across and 4 down with --affine matches the sums of the taps, both for the taps inside the
+# image, which are summed with SSE2, and for those on its edges.
+make_small "$DIR/warp.bmp" 37 23 6 256
+for interp in bilinear bicubic; do
+	"$BINARY" --interp $interp --affine 2,0,0,0,4,0 "$DIR/warp.bmp" -o "$DIR/warped.bmp" > /dev/null 2>&1
+	run "--affine --interp $interp matches the reference" pass cmp <(pixels "$DIR/warped.bmp") \
+		<(warp_ref "$DIR/warp.bmp" 37 23 2 4 $interp)
+done
+
+# Blending a 32-bit overlay with alpha matches the reference, with the overlay clipped by each edge of the
+# image or inside it, over the 4-pixel blocks of the SSSE3 blend and the pixels left at the end of each row.
+make_small "$DIR/base.bmp" 37 23 7 256
+make_alpha "$DIR/alpha.bmp" 30 10 8
+for at in 11,-4 -2,17 3,6 20,5; do
+	"$BINARY" --overlay "$DIR/alpha.bmp@$at:0.6" "$DIR/base.bmp" -o "$DIR/blended.bmp" > /dev/null 2>&1
+	run "--overlay at $at matches the reference" pass cmp <(pixels "$DIR/blended.bmp") \
+		<(overlay_ref "$DIR/base.bmp" 37 23 "$DIR/alpha.bmp" 30 10 ${at%,*} ${at#*,} 153)
+done
+
+# --tiled writes the same file as reading the whole image, the image size and resolution fields of the header
+# included, as --cache does not tell the two apart.
+make_small "$DIR/res.bmp" 37 23 9
+{ le32 2852; le32 2835; le32 3780; } | dd of="$DIR/res.bmp" bs=1 seek=34 conv=notrunc status=none
+for ops in "--crop 3,2,20,10" "--rotr 1" "--fliph --flipv"; do
+	"$BINARY" $ops "$DIR/res.bmp" -o "$DIR/whole.bmp" > /dev/null 2>&1
+	"$BINARY" --tiled $ops "$DIR/res.bmp" -o "$DIR/tiled.bmp" > /dev/null 2>&1
+	run "--tiled $ops matches the whole image" pass cmp "$DIR/tiled.bmp" "$DIR/whole.bmp"
+done
+
+# The header-only modes refuse operations and other modes rather than ignoring them.
+for args in "--rotr 1 --info" "--info --validate" "--median 2 --deep-validate" "--compare $DIR/res.bmp --info"; do
+	run "${args//$DIR\//} is rejected" fail "$BINARY" $args "$DIR/res.bmp"
+done
+run "--validate --deep-validate" pass "$BINARY" --validate --deep-validate "$DIR/res.bmp"
+
+# Placing the bands of the images on simulated NUMA nodes must not change the result of a threaded operation.
+make_small "$DIR/numa.bmp" 211 157 3
+"$BINARY" --numa off --median 3 "$DIR/numa.bmp" -o "$DIR/numa-off.bmp" > /dev/null 2>&1
+for nodes in 2 3; do
+	"$BINARY" --numa $nodes --median 3 "$DIR/numa.bmp" -o "$DIR/numa-on.bmp" > /dev/null 2>&1 &&
+		cmp -s "$DIR/numa-on.bmp" "$DIR/numa-off.bmp"
+	if [ $? -ne 0 ]; then
+		echo "FAIL: --numa $nodes --median 3 matches --numa off"
+		failed=1
+	else
+		echo "ok:   --numa $nodes --median 3 matches --numa off"
+	fi
+done
+
+make_bmp "$DIR/wrap.bmp" $(( SIZE & 0xffffffff ))
+make_bmp "$DIR/zero.bmp" 0
+
+for image in wrap zero; do
+	run "--info, size field $image" pass "$BINARY" --info "$DIR/$image.bmp"
+	run "--deep-validate, size field $image" pass "$BINARY" --deep-validate "$DIR/$image.bmp"
+	run_pixel "$DIR/$image.bmp" 0 0 "--tiled --crop, size field $image"
+done
+
+"$BINARY" --tiled --crop 0,0,2,2 "$DIR/wrap.bmp" -o "$DIR/small.bmp" > /dev/null 2>&1
+ln -s small.bmp "$DIR/symlink.bmp"
+ln "$DIR/small.bmp" "$DIR/hardlink.bmp"
+run "in-place --rotr 2 through a symlink" pass "$BINARY" --rotr 2 "$DIR/symlink.bmp"
+if [ ! -L "$DIR/symlink.bmp" ]; then
+	echo "FAIL: in-place --rotr 2 through a symlink replaced the symlink"
+	failed=1
+fi
+run_pixel "$DIR/small.bmp" 1 1 "--tiled --crop after --rotr 2 through a symlink"
+run "in-place --rotr 2 through a hard link" pass "$BINARY" --rotr 2 "$DIR/hardlink.bmp"
+if [ "$(stat -c %i "$DIR/small.bmp")" != "$(stat -c %i "$DIR/hardlink.bmp")" ]; then
+	echo "FAIL: in-place --rotr 2 through a hard link split the hard link"
+	failed=1
+fi
+run_pixel "$DIR/small.bmp" 0 0 "--tiled --crop after --rotr 2 through a hard link"
+
+run "in-place --rotr 2" pass "$BINARY" --rotr 2 "$DIR/wrap.bmp"
+run_pixel "$DIR/wrap.bmp" $(( WIDTH - 1 )) $(( HEIGHT - 1 )) "--tiled --crop after --rotr 2"
+
+run "write over 4 GB without --large-bmp" fail "$BINARY" --tiled --crop 0,0,$WIDTH,$HEIGHT "$DIR/zero.bmp" \
+	-o "$DIR/big.bmp"
+if [ -e "$DIR/big.bmp" ]; then
+	echo "FAIL: write over 4 GB without --large-bmp left a file"
+	failed=1
+fi
+run "write over 4 GB with --large-bmp" pass "$BINARY" --large-bmp --tiled --crop 0,0,$WIDTH,$HEIGHT \
+	"$DIR/zero.bmp" -o "$DIR/big.bmp"
+if [ "$(stat -c %s "$DIR/big.bmp" 2>/dev/null)" != $SIZE ]; then
+	echo "FAIL: write over 4 GB with --large-bmp wrote the wrong size"
+	failed=1
+fi
+run "--deep-validate of the file written" pass "$BINARY" --deep-validate "$DIR/big.bmp"
+run_pixel "$DIR/big.bmp" 0 0 "--tiled --crop of the file written"
+
+exit $failed
@@ -0,0 +1,344 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * See comments in Color.h.
+ **************************************************************************************************************/
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Color.h"
+#include "File.h"
+#include "Progress.h"
+#include "String.h"
+#include "Thread.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#endif
+
+// The conversion is split between threads in chunks of at least this many rows.
+static const int cColorMinRowsPerThread = 16;
+
+// The weights of blue, green, and red in luma, in 16-bit fixed point. Each set adds up to 65536.
+static const int32_t cColorLuma601[3] = { 7471, 38470, 19595 };
+static const int32_t cColorLuma709[3] = { 4732, 46871, 13933 };
+
+// The weights of blue, green, and red in Cb and in Cr, in 16-bit fixed point. Each set adds up to 0.
+static const int32_t cColorCb[3] = { 32768, -21709, -11059 };
+static const int32_t cColorCr[3] = { -5329, -27439, 32768 };
+
+// A third of the hue circle, 256 / 3, in 16-bit fixed point.
+static const int32_t cColorThird = 5592405;
+
+#ifdef __SSE2__
+// The pshufb masks which gather the blue, green, and red bytes of 16 pixels from each of the three 16-byte
+// blocks they are stored in. -1 leaves the byte 0, so the three results are combined with or.
+static const int8_t cColorSplitMask[3][3][16] = {
+	{ {  0,  3,  6,  9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	  { -1, -1, -1, -1, -1, -1,  2,  5,  8, 11, 14, -1, -1, -1, -1, -1 },
+	  { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  1,  4,  7, 10, 13 } },
+	{ {  1,  4,  7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	  { -1, -1, -1, -1, -1,  0,  3,  6,  9, 12, 15, -1, -1, -1, -1, -1 },
+	  { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  2,  5,  8, 11, 14 } },
+	{ {  2,  5,  8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	  { -1, -1, -1, -1, -1,  1,  4,  7, 10, 13, -1, -1, -1, -1, -1, -1 },
+	  { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  0,  3,  6,  9, 12, 15 } }
+};
+#endif
+
+// The names of the color spaces, indexed by tColorSpace.
+static const char *cColorName[] = { "gray", "gray709", "ycbcr", "hsv", "blue", "green", "red" };
+
+// A conversion being performed.
+typedef struct {
+	tBmp		*bmp;			// The image.
+	int32_t		hueDiv[256];	// 65536 * 256 / (6 * d): scales a difference of d to a sixth of the hue circle.
+	tHistLut	*lut;			// The LUT the pixels are mapped through first, or NULL.
+	byte		*planes;		// The planes being written.
+	size_t		planeBytes;		// The size of a plane.
+	int32_t		satDiv[256];	// 65536 * 255 / v: scales a chroma to the saturation for the value v.
+	byte		*scratch;		// One blue, green, and red row per thread.
+	tColorSpace	space;			// The color space.
+} tColor;
+
+static void	ColorMix(const byte *restrict pB, const byte *restrict pG, const byte *restrict pR, int pCount,
+				const int32_t *pWeight, int32_t pOffset, byte *restrict pOut);
+#ifdef __SSE2__
+static int	ColorMixSse2(const byte *restrict pB, const byte *restrict pG, const byte *restrict pR, int pCount,
+				const int32_t *pWeight, int32_t pOffset, byte *restrict pOut);
+#endif
+static void	ColorRows(void *pContext, int pThread, int pBegin, int pEnd);
+static void	ColorSplit(tPixel *pRow, int pCount, tHistLut *pLut, byte *restrict pB, byte *restrict pG,
+				byte *restrict pR);
+#ifdef __SSE2__
+static int	ColorSplitSsse3(const byte *pPixel, int pCount, byte *restrict pB, byte *restrict pG,
+				byte *restrict pR) __attribute__((target("ssse3")));
+#endif
+static void	ColorToHsv(const byte *restrict pB, const byte *restrict pG, const byte *restrict pR, int pCount,
+				tColor *pColor, byte *restrict pH, byte *restrict pS, byte *restrict pV);
+
+tError ColorConvert(tBmp *pBmp, tColorSpace pSpace, tHistLut *pLut, byte *pPlanes)
+{
+	int width = pBmp->infoHeader.width, height = pBmp->infoHeader.height;
+	tColor color;
+	color.bmp = pBmp;
+	color.lut = pLut;
+	color.planes = pPlanes;
+	color.planeBytes = (size_t)width * height;
+	color.space = pSpace;
+	color.hueDiv[0] = color.satDiv[0] = 0;
+	for (int d = 1; d < 256; ++d) {
+		color.hueDiv[d] = (int32_t)lround(65536.0 * 256 / (6.0 * d));
+		color.satDiv[d] = (int32_t)lround(65536.0 * 255 / d);
+	}
+	color.scratch = (byte *)malloc(ThreadCount() * 3 * (size_t)width);
+	if (!color.scratch) return ErrorColor;
+	ThreadFor(height, cColorMinRowsPerThread, ColorRows, &color);
+	free(color.scratch);
+	return ErrorNone;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ColorMix()
+ *
+ * DESCRIPTION
+ * Stores in pOut the weighted sum of pCount pixels of the blue, green, and red planes pB, pG, and pR, with the
+ * 16-bit fixed point weights pWeight[0..2], plus pOffset, rounded and clamped to 0..255.
+ *------------------------------------------------------------------------------------------------------------*/
+static void ColorMix(const byte *restrict pB, const byte *restrict pG, const byte *restrict pR, int pCount,
+	const int32_t *pWeight, int32_t pOffset, byte *restrict pOut)
+{
+	int32_t wb = pWeight[0], wg = pWeight[1], wr = pWeight[2], offset = (pOffset << 16) + 32768;
+	int x = 0;
+#ifdef __SSE2__
+	x = ColorMixSse2(pB, pG, pR, pCount, pWeight, pOffset, pOut);
+#endif
+	for (; x < pCount; ++x) {
+		int32_t v = (wb * pB[x] + wg * pG[x] + wr * pR[x] + offset) >> 16;
+		pOut[x] = (byte)(v < 0 ? 0 : v > 255 ? 255 : v);
+	}
+}
+
+#ifdef __SSE2__
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ColorMixSse2()
+ *
+ * DESCRIPTION
+ * Does the work of ColorMix() for the pixels of whole blocks of 16, and returns the number of pixels done.
+ * pmaddwd multiplies pairs of 16-bit values, which not every weight fits in, so each weight is split into two
+ * halves which do and each pixel is multiplied by both. The sums are exactly those of ColorMix().
+ *------------------------------------------------------------------------------------------------------------*/
+static int ColorMixSse2(const byte *restrict pB, const byte *restrict pG, const byte *restrict pR, int pCount,
+	const int32_t *pWeight, int32_t pOffset, byte *restrict pOut)
+{
+	// The blue and green pixels are paired up, and the red ones with 0.
+	int32_t half[3], rest[3];
+	for (int ch = 0; ch < 3; ++ch) {
+		half[ch] = pWeight[ch] / 2;
+		rest[ch] = pWeight[ch] - half[ch];
+	}
+	__m128i bgHalf = _mm_set1_epi32((int32_t)((uint32_t)half[1] << 16 | (uint16_t)half[0]));
+	__m128i bgRest = _mm_set1_epi32((int32_t)((uint32_t)rest[1] << 16 | (uint16_t)rest[0]));
+	__m128i rHalf = _mm_set1_epi32(half[2] & 0xffff), rRest = _mm_set1_epi32(rest[2] & 0xffff);
+	__m128i offset = _mm_set1_epi32((pOffset << 16) + 32768), zero = _mm_setzero_si128();
+
+	int x = 0;
+	for (; x + 16 <= pCount; x += 16) {
+		__m128i b = _mm_loadu_si128((const __m128i *)(pB + x));
+		__m128i g = _mm_loadu_si128((const __m128i *)(pG + x));
+		__m128i r = _mm_loadu_si128((const __m128i *)(pR + x));
+		__m128i out[2];
+		for (int i = 0; i < 2; ++i) {
+			__m128i b16 = i ? _mm_unpackhi_epi8(b, zero) : _mm_unpacklo_epi8(b, zero);
+			__m128i g16 = i ? _mm_unpackhi_epi8(g, zero) : _mm_unpacklo_epi8(g, zero);
+			__m128i r16 = i ? _mm_unpackhi_epi8(r, zero) : _mm_unpacklo_epi8(r, zero);
+			__m128i sum[2];
+			for (int j = 0; j < 2; ++j) {
+				__m128i bg = j ? _mm_unpackhi_epi16(b16, g16) : _mm_unpacklo_epi16(b16, g16);
+				__m128i r0 = j ? _mm_unpackhi_epi16(r16, zero) : _mm_unpacklo_epi16(r16, zero);
+				__m128i v = _mm_add_epi32(_mm_madd_epi16(bg, bgHalf), _mm_madd_epi16(bg, bgRest));
+				v = _mm_add_epi32(v, _mm_add_epi32(_mm_madd_epi16(r0, rHalf), _mm_madd_epi16(r0, rRest)));
+				sum[j] = _mm_srai_epi32(_mm_add_epi32(v, offset), 16);
+			}
+			out[i] = _mm_packs_epi32(sum[0], sum[1]);
+		}
+		_mm_storeu_si128((__m128i *)(pOut + x), _mm_packus_epi16(out[0], out[1]));
+	}
+	return x;
+}
+#endif
+
+int ColorPlanes(tColorSpace pSpace)
+{
+	return pSpace == ColorYCbCr || pSpace == ColorHsv ? 3 : 1;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ColorRows()
+ *
+ * DESCRIPTION
+ * The body of the loop over the rows [pBegin, pEnd) of the image. Each row is split into the thread's blue,
+ * green, and red rows and converted from them into the planes while it is in the cache.
+ *------------------------------------------------------------------------------------------------------------*/
+static void ColorRows(void *pContext, int pThread, int pBegin, int pEnd)
+{
+	tColor *color = (tColor *)pContext;
+	int width = color->bmp->infoHeader.width;
+	byte *b = color->scratch + 3 * (size_t)pThread * width, *g = b + width, *r = g + width;
+	for (int y = pBegin; y < pEnd; ++y) {
+		byte *out = color->planes + (size_t)y * width, *out2 = out + color->planeBytes;
+		byte *out3 = out2 + color->planeBytes;
+		ColorSplit(color->bmp->pixel[y], width, color->lut, b, g, r);
+		switch (color->space) {
+			case ColorGray601:
+				ColorMix(b, g, r, width, cColorLuma601, 0, out);
+				break;
+			case ColorGray709:
+				ColorMix(b, g, r, width, cColorLuma709, 0, out);
+				break;
+			case ColorYCbCr:
+				ColorMix(b, g, r, width, cColorLuma601, 0, out);
+				ColorMix(b, g, r, width, cColorCb, 128, out2);
+				ColorMix(b, g, r, width, cColorCr, 128, out3);
+				break;
+			case ColorHsv:
+				ColorToHsv(b, g, r, width, color, out, out2, out3);
+				break;
+			case ColorBlue:
+				memcpy(out, b, width);
+				break;
+			case ColorGreen:
+				memcpy(out, g, width);
+				break;
+			case ColorRed:
+				memcpy(out, r, width);
+				break;
+		}
+	}
+}
+
+bool ColorScan(char *pName, tColorSpace *pSpace)
+{
+	for (int i = 0; i < (int)(sizeof(cColorName) / sizeof(cColorName[0])); ++i) {
+		if (streq(pName, cColorName[i])) {
+			*pSpace = (tColorSpace)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ColorSplit()
+ *
+ * DESCRIPTION
+ * Splits the pCount pixels of pRow into the blue, green, and red rows pB, pG, and pR, mapping them through
+ * pLut if it is not NULL. Without a LUT, the loop is a plain 3-way deinterleave of the bytes.
+ *------------------------------------------------------------------------------------------------------------*/
+static void ColorSplit(tPixel *pRow, int pCount, tHistLut *pLut, byte *restrict pB, byte *restrict pG,
+	byte *restrict pR)
+{
+	const byte *pixel = (const byte *)pRow;
+	if (pLut) {
+		for (int x = 0; x < pCount; ++x) {
+			pB[x] = pLut->map[0][pixel[3 * x]];
+			pG[x] = pLut->map[1][pixel[3 * x + 1]];
+			pR[x] = pLut->map[2][pixel[3 * x + 2]];
+		}
+	} else {
+		int x = 0;
+#ifdef __SSE2__
+		if (__builtin_cpu_supports("ssse3")) x = ColorSplitSsse3(pixel, pCount, pB, pG, pR);
+#endif
+		for (; x < pCount; ++x) {
+			pB[x] = pixel[3 * x];
+			pG[x] = pixel[3 * x + 1];
+			pR[x] = pixel[3 * x + 2];
+		}
+	}
+}
+
+#ifdef __SSE2__
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ColorSplitSsse3()
+ *
+ * DESCRIPTION
+ * Does the work of ColorSplit() without a LUT for the pixels pPixel of whole blocks of 16, and returns the
+ * number of pixels done. Each plane's 16 bytes are gathered from the three 16-byte blocks with pshufb.
+ *------------------------------------------------------------------------------------------------------------*/
+static int ColorSplitSsse3(const byte *pPixel, int pCount, byte *restrict pB, byte *restrict pG,
+	byte *restrict pR)
+{
+	byte *plane[3] = { pB, pG, pR };
+	__m128i mask[3][3];
+	for (int ch = 0; ch < 3; ++ch) {
+		for (int k = 0; k < 3; ++k) mask[ch][k] = _mm_loadu_si128((const __m128i *)cColorSplitMask[ch][k]);
+	}
+
+	int x = 0;
+	for (; x + 16 <= pCount; x += 16) {
+		const byte *pixel = pPixel + 3 * x;
+		__m128i block0 = _mm_loadu_si128((const __m128i *)pixel);
+		__m128i block1 = _mm_loadu_si128((const __m128i *)(pixel + 16));
+		__m128i block2 = _mm_loadu_si128((const __m128i *)(pixel + 32));
+		for (int ch = 0; ch < 3; ++ch) {
+			__m128i v = _mm_or_si128(_mm_shuffle_epi8(block0, mask[ch][0]), _mm_shuffle_epi8(block1, mask[ch][1]));
+			v = _mm_or_si128(v, _mm_shuffle_epi8(block2, mask[ch][2]));
+			_mm_storeu_si128((__m128i *)(plane[ch] + x), v);
+		}
+	}
+	return x;
+}
+#endif
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ColorToHsv()
+ *
+ * DESCRIPTION
+ * Converts pCount pixels from the blue, green, and red planes pB, pG, and pR to the hue, saturation, and value
+ * planes pH, pS, and pV. The divisions are multiplications by the reciprocals in pColor, so saturations and
+ * hues may be off by one from the exact rounded values.
+ *------------------------------------------------------------------------------------------------------------*/
+static void ColorToHsv(const byte *restrict pB, const byte *restrict pG, const byte *restrict pR, int pCount,
+	tColor *pColor, byte *restrict pH, byte *restrict pS, byte *restrict pV)
+{
+	for (int x = 0; x < pCount; ++x) {
+		int32_t b = pB[x], g = pG[x], r = pR[x];
+		int32_t max = r > g ? r : g, min = r < g ? r : g;
+		max = b > max ? b : max;
+		min = b < min ? b : min;
+		int32_t d = max - min;
+
+		// The hue is measured from the color of the largest channel, at 0, 1/3, or 2/3 of the circle, towards
+		// the larger of the other two. The bias keeps the shifted value positive; the byte wraps negative hues
+		// around the circle.
+		int32_t base = max == r ? 0 : max == g ? cColorThird : 2 * cColorThird;
+		int32_t num = max == r ? g - b : max == g ? b - r : r - g;
+		int32_t hue = ((base + num * pColor->hueDiv[d] + (64 << 16) + 32768) >> 16) - 64;
+		pH[x] = (byte)(hue & 255);
+		pS[x] = (byte)((d * pColor->satDiv[max] + 32768) >> 16);
+		pV[x] = (byte)max;
+	}
+}
+
+tError ColorWritePlanar(char *pFilename, byte *pPlanes, int pCount, int pWidth, int pHeight)
+{
+	char tempName[FILENAME_MAX];
+	FILE *out = FileOpenTemp(pFilename, tempName);
+	if (!out) return ErrorFileOpen;
+	tError result = ErrorNone;
+	size_t planeBytes = (size_t)pWidth * pHeight;
+	ProgressBegin("write", pCount, "planes");
+	for (int i = 0; i < pCount && result == ErrorNone; ++i) {
+		if (FileWrite(out, pPlanes + i * planeBytes, 1, planeBytes) != 0) result = ErrorFileWrite;
+		else if (!ProgressStep(1)) result = ErrorCancelled;
+	}
+	if (result != ErrorNone) {
+		FileDiscard(out, tempName);
+	} else if (FileCommit(out, tempName, pFilename) != 0) {
+		result = ErrorFileWrite;
+	}
+	return result;
+}
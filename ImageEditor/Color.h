@@ -0,0 +1,77 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * Conversion of an image to other color spaces, e.g., the gray or YCbCr planes wanted by OCR and machine
+ * learning tools. The result is one or three 8-bit planes, each a width x height array of bytes with the top
+ * row first.
+ *
+ * Each row is first split into blue, green, and red planes, mapping the values through a LUT on the way if the
+ * conversion is fused with a preceding --autolevels or --equalize, and the kernels then work on the planes.
+ * The kernels use 16-bit fixed point coefficients and no lookups. On x86 the split (when there is no LUT)
+ * and the weighted sums are done 16 pixels at a time with SSSE3 and SSE2 instructions, and elsewhere, or on
+ * processors without SSSE3, by plain loops which give the same results.
+ **************************************************************************************************************/
+#ifndef COLOR_H
+#define COLOR_H
+
+#include <stdbool.h>
+#include "Bmp.h"
+#include "Error.h"
+#include "Hist.h"
+
+// The color spaces and planes an image can be converted to.
+typedef enum {
+	// Luma with the ITU-R BT.601 weights, 0.299 R + 0.587 G + 0.114 B.
+	ColorGray601 = 0,
+	// Luma with the ITU-R BT.709 weights, 0.2126 R + 0.7152 G + 0.0722 B.
+	ColorGray709 = 1,
+	// Full range Y, Cb, Cr planes as in JPEG (BT.601 weights, chroma centered on 128).
+	ColorYCbCr   = 2,
+	// Hue, saturation, and value planes. The hue circle is scaled to 0..255, red being 0, green 85, blue 171.
+	ColorHsv     = 3,
+	// A single channel of the image.
+	ColorBlue    = 4,
+	ColorGreen   = 5,
+	ColorRed     = 6
+} tColorSpace;
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ColorConvert()
+ *
+ * DESCRIPTION
+ * Converts the image pBmp to the color space pSpace, in parallel, and stores the ColorPlanes(pSpace) planes
+ * one after the other in pPlanes, which must hold ColorPlanes(pSpace) * width * height bytes. If pLut is not
+ * NULL, every pixel is mapped through it first, in the same pass. pBmp is not modified. Returns ErrorColor
+ * if memory for the conversion could not be allocated.
+ *------------------------------------------------------------------------------------------------------------*/
+tError ColorConvert(tBmp *pBmp, tColorSpace pSpace, tHistLut *pLut, byte *pPlanes);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ColorPlanes()
+ *
+ * DESCRIPTION
+ * Returns the number of planes of the color space pSpace, 1 or 3.
+ *------------------------------------------------------------------------------------------------------------*/
+int ColorPlanes(tColorSpace pSpace);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ColorScan()
+ *
+ * DESCRIPTION
+ * Converts the name of a color space, e.g., "gray" or "ycbcr", to pSpace. Returns false if pName is not the
+ * name of a color space.
+ *------------------------------------------------------------------------------------------------------------*/
+bool ColorScan(char *pName, tColorSpace *pSpace);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ColorWritePlanar()
+ *
+ * DESCRIPTION
+ * Writes the pCount planes of pWidth x pHeight bytes in pPlanes to the file pFilename as raw bytes, one plane
+ * after the other and the top row of each first, without a header or padding. As with BmpWrite(), pFilename
+ * is only replaced once all the planes are written.
+ *------------------------------------------------------------------------------------------------------------*/
+tError ColorWritePlanar(char *pFilename, byte *pPlanes, int pCount, int pWidth, int pHeight);
+
+#endif
@@ -0,0 +1,244 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * See comments in Compare.h.
+ **************************************************************************************************************/
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Bmp.h"
+#include "Compare.h"
+#include "File.h"
+#include "Hist.h"
+#include "Thread.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// The number of scanlines read from each file at a time. Must be a multiple of cCompareBlock.
+static const int cCompareBandRows = 128;
+
+// The width and height of the blocks over which SSIM is computed.
+static const int cCompareBlock = 8;
+
+// The minimum number of blocks compared by each thread.
+static const int cCompareMinBlocksPerThread = 64;
+
+// The SSIM stabilizing constants (0.01 * 255)^2 and (0.03 * 255)^2.
+static const double cCompareC1 = 6.5025;
+static const double cCompareC2 = 58.5225;
+
+// The sums of one thread.
+typedef struct {
+	long		differ;
+	uint64_t	sse;
+	double		ssim;
+	int			x0, y0, x1, y1;
+} tCompareSums;
+
+// A comparison in progress, shared by the threads.
+typedef struct {
+	byte			*band[2];	// The current band of each image, as stored in the file: bottom scanline first.
+	int				blocksX;
+	size_t			lineBytes;
+	int				rows;		// The number of scanlines in the current band.
+	tCompareSums	sums[THREAD_MAX];
+	int				width;
+	int				y0;			// The row of the image of the top scanline of the band.
+} tCompareJob;
+
+static void		CompareBlocks(void *pJob, int pThread, int pBegin, int pEnd);
+static unsigned	CompareRow(tPixel *pRow1, tPixel *pRow2, int pCount, uint64_t *pSse);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: CompareBlocks()
+ *
+ * DESCRIPTION
+ * The body of the parallel loop over the blocks of a band. Blocks are numbered row by row.
+ *------------------------------------------------------------------------------------------------------------*/
+static void CompareBlocks(void *pJob, int pThread, int pBegin, int pEnd)
+{
+	tCompareJob *job = (tCompareJob *)pJob;
+	tCompareSums *sums = &job->sums[pThread];
+
+	for (int block = pBegin; block < pEnd; ++block) {
+		int bx = block % job->blocksX * cCompareBlock, by = block / job->blocksX * cCompareBlock;
+		int w = job->width - bx < cCompareBlock ? job->width - bx : cCompareBlock;
+		int h = job->rows - by < cCompareBlock ? job->rows - by : cCompareBlock;
+		int64_t s1 = 0, s2 = 0, s11 = 0, s22 = 0, s12 = 0;
+
+		for (int y = by; y < by + h; ++y) {
+			size_t offset = (size_t)(job->rows-1 - y) * job->lineBytes;
+			tPixel *row1 = (tPixel *)(job->band[0] + offset) + bx;
+			tPixel *row2 = (tPixel *)(job->band[1] + offset) + bx;
+			unsigned differ = CompareRow(row1, row2, w, &sums->sse);
+			for (int x = 0; differ; ++x, differ >>= 1) {
+				if (!(differ & 1)) continue;
+				++sums->differ;
+				if (bx + x < sums->x0) sums->x0 = bx + x;
+				if (bx + x > sums->x1) sums->x1 = bx + x;
+				if (job->y0 + y < sums->y0) sums->y0 = job->y0 + y;
+				if (job->y0 + y > sums->y1) sums->y1 = job->y0 + y;
+			}
+			for (int x = 0; x < w; ++x) {
+				int l1 = HistPixelLuma(&row1[x]), l2 = HistPixelLuma(&row2[x]);
+				s1 += l1;
+				s2 += l2;
+				s11 += l1 * l1;
+				s22 += l2 * l2;
+				s12 += l1 * l2;
+			}
+		}
+
+		double n = (double)(w * h);
+		double mu1 = s1 / n, mu2 = s2 / n;
+		double var1 = s11 / n - mu1 * mu1, var2 = s22 / n - mu2 * mu2, cov = s12 / n - mu1 * mu2;
+		sums->ssim += (2 * mu1 * mu2 + cCompareC1) * (2 * cov + cCompareC2) /
+			((mu1 * mu1 + mu2 * mu2 + cCompareC1) * (var1 + var2 + cCompareC2));
+	}
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: CompareRow()
+ *
+ * DESCRIPTION
+ * Adds the sum of the squared differences of the pCount <= cCompareBlock pixels of pRow1 and pRow2 to pSse and
+ * returns a mask with bit x set if pixel x differs. With SSE2, the 24 bytes of a whole block row are compared,
+ * and their squared differences summed, at once.
+ *------------------------------------------------------------------------------------------------------------*/
+static unsigned CompareRow(tPixel *pRow1, tPixel *pRow2, int pCount, uint64_t *pSse)
+{
+	unsigned differ = 0;
+#ifdef __SSE2__
+	if (pCount == 8) {
+		const byte *bytes1 = (const byte *)pRow1, *bytes2 = (const byte *)pRow2;
+		__m128i a = _mm_loadu_si128((const __m128i *)bytes1), b = _mm_loadu_si128((const __m128i *)bytes2);
+		__m128i a2 = _mm_loadl_epi64((const __m128i *)(bytes1 + 16));
+		__m128i b2 = _mm_loadl_epi64((const __m128i *)(bytes2 + 16));
+		unsigned same = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) |
+			(unsigned)(_mm_movemask_epi8(_mm_cmpeq_epi8(a2, b2)) & 0xff) << 16;
+		if (same == 0xffffff) return 0;
+
+		// The absolute differences, widened to 16 bits, are squared and added in pairs by pmaddwd.
+		__m128i zero = _mm_setzero_si128();
+		__m128i d = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+		__m128i d2 = _mm_or_si128(_mm_subs_epu8(a2, b2), _mm_subs_epu8(b2, a2));
+		__m128i lo = _mm_unpacklo_epi8(d, zero), hi = _mm_unpackhi_epi8(d, zero);
+		__m128i lo2 = _mm_unpacklo_epi8(d2, zero);
+		__m128i sum = _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi));
+		sum = _mm_add_epi32(sum, _mm_madd_epi16(lo2, lo2));
+		sum = _mm_add_epi32(sum, _mm_srli_si128(sum, 8));
+		sum = _mm_add_epi32(sum, _mm_srli_si128(sum, 4));
+		*pSse += (uint32_t)_mm_cvtsi128_si32(sum);
+		for (int x = 0; x < 8; ++x) {
+			if ((same >> 3 * x & 7) != 7) differ |= 1u << x;
+		}
+		return differ;
+	}
+#endif
+	for (int x = 0; x < pCount; ++x) {
+		int db = pRow1[x].blue - pRow2[x].blue;
+		int dg = pRow1[x].green - pRow2[x].green;
+		int dr = pRow1[x].red - pRow2[x].red;
+		if (db | dg | dr) {
+			*pSse += (uint64_t)(db * db + dg * dg + dr * dr);
+			differ |= 1u << x;
+		}
+	}
+	return differ;
+}
+
+tError CompareFiles(char *pFilename1, char *pFilename2, tCompare *pResult)
+{
+	memset(pResult, 0, sizeof(tCompare));
+	tBmp bmp[2];
+	char *filename[2] = { pFilename1, pFilename2 };
+	for (int i = 0; i < 2; ++i) {
+		tError result = BmpProbe(filename[i], &bmp[i]);
+		pResult->failed = i;
+		if (result != ErrorNone) return result;
+		if (bmp[i].infoHeader.bitsPerPixel != 24) return ErrorBmpGray;
+		pResult->width[i] = bmp[i].infoHeader.width;
+		pResult->height[i] = bmp[i].infoHeader.height;
+	}
+	if (pResult->width[0] != pResult->width[1] || pResult->height[0] != pResult->height[1]) {
+		pResult->sizeDiffers = true;
+		return ErrorNone;
+	}
+
+	tCompareJob *job = (tCompareJob *)calloc(1, sizeof(tCompareJob));
+	if (!job) return ErrorFileRead;
+	int width = pResult->width[0], height = pResult->height[0];
+	job->width = width;
+	job->blocksX = (width + cCompareBlock - 1) / cCompareBlock;
+	job->lineBytes = (size_t)((BmpFileSize(&bmp[0]) - bmp[0].header.pixelOffset) / height);
+	for (int t = 0; t < THREAD_MAX; ++t) {
+		job->sums[t].x0 = job->sums[t].y0 = INT_MAX;
+		job->sums[t].x1 = job->sums[t].y1 = -1;
+	}
+
+	FILE *stream[2] = { NULL, NULL };
+	tError result = ErrorNone;
+	for (int i = 0; i < 2 && result == ErrorNone; ++i) {
+		job->band[i] = (byte *)malloc((size_t)cCompareBandRows * job->lineBytes);
+		stream[i] = FileOpen(filename[i], "rb");
+		if (!job->band[i]) result = ErrorFileRead;
+		if (!stream[i]) result = ErrorFileOpen;
+		pResult->failed = i;
+	}
+
+	// Bands are compared top to bottom. The scanlines of a band are contiguous in the file, bottom first.
+	long blocks = 0;
+	double ssimSame = 0.0;
+	for (int y0 = 0; y0 < height && result == ErrorNone; y0 += cCompareBandRows) {
+		int rows = height - y0 < cCompareBandRows ? height - y0 : cCompareBandRows;
+		size_t bytes = (size_t)rows * job->lineBytes;
+		off_t offset = bmp[0].header.pixelOffset + (off_t)(height - y0 - rows) * job->lineBytes;
+		for (int i = 0; i < 2 && result == ErrorNone; ++i) {
+			if (FileReadAt(stream[i], job->band[i], bytes, offset) != 0) result = ErrorFileRead;
+			pResult->failed = i;
+		}
+		if (result != ErrorNone) break;
+
+		int bandBlocks = job->blocksX * ((rows + cCompareBlock - 1) / cCompareBlock);
+		blocks += bandBlocks;
+		if (memcmp(job->band[0], job->band[1], bytes) == 0) {
+			// The SSIM of identical blocks is exactly 1.
+			ssimSame += bandBlocks;
+			continue;
+		}
+		job->rows = rows;
+		job->y0 = y0;
+		ThreadFor(bandBlocks, cCompareMinBlocksPerThread, CompareBlocks, job);
+	}
+
+	if (result == ErrorNone) {
+		uint64_t sse = 0;
+		double ssim = ssimSame;
+		pResult->x0 = pResult->y0 = INT_MAX;
+		pResult->x1 = pResult->y1 = -1;
+		for (int t = 0; t < THREAD_MAX; ++t) {
+			tCompareSums *sums = &job->sums[t];
+			pResult->differ += sums->differ;
+			sse += sums->sse;
+			ssim += sums->ssim;
+			if (sums->x0 < pResult->x0) pResult->x0 = sums->x0;
+			if (sums->y0 < pResult->y0) pResult->y0 = sums->y0;
+			if (sums->x1 > pResult->x1) pResult->x1 = sums->x1;
+			if (sums->y1 > pResult->y1) pResult->y1 = sums->y1;
+		}
+		double mse = (double)sse / ((double)width * height * 3);
+		pResult->psnr = sse ? 10.0 * log10(255.0 * 255.0 / mse) : INFINITY;
+		pResult->ssim = ssim / blocks;
+	}
+
+	for (int i = 0; i < 2; ++i) {
+		if (stream[i]) FileClose(stream[i]);
+		free(job->band[i]);
+	}
+	free(job);
+	return result;
+}
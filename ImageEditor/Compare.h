@@ -0,0 +1,39 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * Compares two BMP images, e.g., a processed image and its golden image. Both files are streamed a band of
+ * scanlines at a time, so memory use does not depend on the size of the images. A band which is identical in
+ * both files is detected with one memcmp() and skipped. Otherwise, the band is divided into 8 x 8 blocks which
+ * are compared in parallel to find the differing pixels, the sum of squared differences for PSNR, and the
+ * SSIM (structural similarity) of the luma of each block.
+ **************************************************************************************************************/
+#ifndef COMPARE_H
+#define COMPARE_H
+
+#include <stdbool.h>
+#include "Error.h"
+
+// The result of a comparison.
+typedef struct {
+	long	differ;			// The number of pixels which differ.
+	int		failed;			// The image (0 or 1) which could not be read, if an error was returned.
+	int		height[2];		// The heights of the two images.
+	double	psnr;			// The peak signal to noise ratio in dB, over all channels. INFINITY if identical.
+	bool	sizeDiffers;	// True if the dimensions differ, in which case the pixels were not compared.
+	double	ssim;			// The mean SSIM of the 8 x 8 blocks of the luma of the images, 1.0 if identical.
+	int		width[2];		// The widths of the two images.
+	int		x0, y0, x1, y1;	// The bounding box of the differing pixels (inclusive), if differ > 0.
+} tCompare;
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: CompareFiles()
+ *
+ * DESCRIPTION
+ * Compares the pixels of the BMP images pFilename1 and pFilename2 and stores the result in pResult. Returns an
+ * error if either file is not a valid 24-bit BMP image or cannot be read, setting pResult->failed to which
+ * one.
+ *------------------------------------------------------------------------------------------------------------*/
+tError CompareFiles(char *pFilename1, char *pFilename2, tCompare *pResult);
+
+#endif
@@ -20,7 +20,21 @@ typedef enum {
 	ErrorBmpCorrupt		=  -8,
 	ErrorFileOpen		=  -9,
 	ErrorFileRead		= -10,
-	ErrorFileWrite		= -11
+	ErrorFileWrite		= -11,
+	ErrorServer			= -12,
+	ErrorServerProto	= -13,
+	ErrorOpCrop			= -14,
+	ErrorOpWarp			= -15,
+	ErrorOpOverlay		= -16,
+	ErrorTune			= -17,
+	ErrorOpMorph		= -18,
+	ErrorOpRank			= -19,
+	ErrorIntegral		= -20,
+	ErrorColor			= -21,
+	ErrorCancelled		= -22,
+	ErrorBmpLarge		= -23,
+	ErrorOpMemory		= -24,
+	ErrorBmpGray		= -25
 } tError;
 
 
@@ -4,15 +4,88 @@
  * DESCRIPTION
  * Functions for performing file I/O.
  **************************************************************************************************************/
+#define _XOPEN_SOURCE 700	// For realpath().
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include "File.h"
 #include "String.h"
 
+// The size of the blocks in which a temporary file is copied into a file with other hard links, in bytes.
+static const size_t cFileCopyBytes = 1 << 20;
+
+// The file mode creation mask of the process, read by FileInit().
+static mode_t sFileUmask = 077;
+
+static int	FileCopyInto(FILE *pStream, char *pFilename);
+static void	FileTarget(char *pFilename, char *pTarget);
+
 void FileClose(FILE *pStream)
 {
 	if (pStream != stdin && pStream != stdout) fclose(pStream);
 }
 
+int FileCommit(FILE *pStream, char *pTempName, char *pFilename)
+{
+	char target[PATH_MAX];
+	FileTarget(pFilename, target);
+
+	// Renaming over a file with other hard links would split it from them, so it is rewritten in place instead.
+	struct stat fileStat;
+	bool inPlace = stat(target, &fileStat) == 0 && S_ISREG(fileStat.st_mode) && fileStat.st_nlink > 1;
+	int failed = fflush(pStream) || (inPlace ? FileCopyInto(pStream, target) : fsync(fileno(pStream)));
+	failed = fclose(pStream) || failed;
+	if (!failed && !inPlace) failed = rename(pTempName, target);
+	if (failed || inPlace) remove(pTempName);
+	return failed ? -1 : 0;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: FileCopyInto()
+ *
+ * DESCRIPTION
+ * Overwrites the file pFilename with the contents of the file stream pStream, which must be flushed, and
+ * syncs it to disk. Returns 0 on success or -1 on failure.
+ *------------------------------------------------------------------------------------------------------------*/
+static int FileCopyInto(FILE *pStream, char *pFilename)
+{
+	char *block = (char *)malloc(cFileCopyBytes);
+	int fd = open(pFilename, O_WRONLY);
+	int failed = !block || fd < 0;
+	off_t offset = 0;
+	while (!failed) {
+		ssize_t n = pread(fileno(pStream), block, cFileCopyBytes, offset);
+		if (n <= 0) {
+			failed = n < 0;
+			break;
+		}
+		for (ssize_t done = 0, m; done < n && !failed; done += m) {
+			m = pwrite(fd, block + done, n - done, offset + done);
+			failed = m <= 0;
+		}
+		offset += n;
+	}
+	failed = failed || ftruncate(fd, offset) || fsync(fd);
+	if (fd >= 0) failed = close(fd) || failed;
+	free(block);
+	return failed ? -1 : 0;
+}
+
+void FileDiscard(FILE *pStream, char *pTempName)
+{
+	fclose(pStream);
+	remove(pTempName);
+}
+
+void FileInit()
+{
+	sFileUmask = umask(0);
+	umask(sFileUmask);
+}
+
 FILE *FileOpen(char *pFilename, char *pMode)
 {
 	if (!pFilename) return NULL;
@@ -22,17 +95,58 @@ FILE *FileOpen(char *pFilename, char *pMode)
 	else return NULL;
 }
 
+FILE *FileOpenTemp(char *pFilename, char *pTempName)
+{
+	char target[PATH_MAX];
+	FileTarget(pFilename, target);
+	if (snprintf(pTempName, FILENAME_MAX, "%s.XXXXXX", target) >= FILENAME_MAX) return NULL;
+	int fd = mkstemp(pTempName);
+	if (fd < 0) return NULL;
+	struct stat fileStat;
+	if (stat(target, &fileStat) == 0) fchmod(fd, fileStat.st_mode & 07777);
+	else fchmod(fd, 0666 & ~sFileUmask);
+	FILE *stream = fdopen(fd, "wb");
+	if (!stream) {
+		close(fd);
+		remove(pTempName);
+	}
+	return stream;
+}
+
 int FileRead(FILE *pStream, void *pBlock, size_t pSize, size_t pCount)
 {
 	if (fread(pBlock, pSize, pCount, pStream) == pCount) return 0;
 	else return -1;
 }
 
-long FileSize(char *pFilename)
+int FileReadAt(FILE *pStream, void *pBlock, size_t pSize, off_t pOffset)
+{
+	char *block = (char *)pBlock;
+	while (pSize > 0) {
+		ssize_t n = pread(fileno(pStream), block, pSize, pOffset);
+		if (n <= 0) return -1;
+		block += n; pSize -= n; pOffset += n;
+	}
+	return 0;
+}
+
+off_t FileSize(char *pFilename)
 {
 	struct stat fileStat;
 	if (stat(pFilename, &fileStat)) return -1;
-	else return (long)fileStat.st_size;
+	else return fileStat.st_size;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: FileTarget()
+ *
+ * DESCRIPTION
+ * Stores in pTarget, which must be at least PATH_MAX chars, the name of the file which writing pFilename
+ * replaces: the file a symlink points to, or pFilename itself if it does not exist yet.
+ *------------------------------------------------------------------------------------------------------------*/
+static void FileTarget(char *pFilename, char *pTarget)
+{
+	if (!realpath(pFilename, pTarget)) snprintf(pTarget, PATH_MAX, "%s", pFilename);
 }
 
 int FileWrite(FILE *pStream, void *pBlock, size_t pSize, size_t pCount)
@@ -8,6 +8,7 @@
 #define FILE_H
 
 #include <stdio.h>
+#include <sys/types.h>
 
 /*--------------------------------------------------------------------------------------------------------------
  * FUNCTION: FileClose()
@@ -17,6 +18,36 @@
  *------------------------------------------------------------------------------------------------------------*/
 void FileClose(FILE *);
 
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: FileCommit()
+ *
+ * DESCRIPTION
+ * Finishes writing a temporary file opened by FileOpenTemp(). The data is flushed and synced to disk, the
+ * stream is closed, and the temporary file pTempName is atomically renamed to pFilename, or to the file it
+ * points to if it is a symlink. On failure the temporary file is removed and pFilename is left untouched. If
+ * the file has other hard links, which a rename would split from it, the temporary file is instead copied into
+ * it and removed; this is not atomic, so a failure while copying may leave the file partly written. Returns 0
+ * on success or -1 on failure.
+ *------------------------------------------------------------------------------------------------------------*/
+int FileCommit(FILE *pStream, char *pTempName, char *pFilename);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: FileDiscard()
+ *
+ * DESCRIPTION
+ * Closes and removes a temporary file opened by FileOpenTemp() without touching the file it was to replace.
+ *------------------------------------------------------------------------------------------------------------*/
+void FileDiscard(FILE *pStream, char *pTempName);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: FileInit()
+ *
+ * DESCRIPTION
+ * Reads the file mode creation mask of the process, which FileOpenTemp() applies to new files. It must be
+ * called before any threads are started, because umask() can only read the mask by changing it.
+ *------------------------------------------------------------------------------------------------------------*/
+void FileInit();
+
 /*--------------------------------------------------------------------------------------------------------------
  * FUNCTION: FileOpen()
  *
@@ -27,6 +58,19 @@ void FileClose(FILE *);
  *------------------------------------------------------------------------------------------------------------*/
 FILE *FileOpen(char *pFilename, char *pMode);
 
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: FileOpenTemp()
+ *
+ * DESCRIPTION
+ * Creates and opens a uniquely named temporary file for writing in the same directory as pFilename, or as the
+ * file it points to if it is a symlink, so that it can later replace that file with an atomic rename (see
+ * FileCommit()). If the file exists, the temporary file is given the same permissions, and otherwise those a
+ * new file would get from the umask read by FileInit(). The name of the
+ * temporary file is stored in pTempName, which must be at least FILENAME_MAX chars. Returns NULL if the file
+ * could not be created.
+ *------------------------------------------------------------------------------------------------------------*/
+FILE *FileOpenTemp(char *pFilename, char *pTempName);
+
 /*--------------------------------------------------------------------------------------------------------------
  * FUNCTION: FileRead()
  *
@@ -35,13 +79,22 @@ FILE *FileOpen(char *pFilename, char *pMode);
  *------------------------------------------------------------------------------------------------------------*/
 int FileRead(FILE *pStream, void *pBlock, size_t pSize, size_t pCount);
 
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: FileReadAt()
+ *
+ * DESCRIPTION
+ * Reads pSize bytes from the file stream pStream starting at byte pOffset, without using or moving the file
+ * position of the stream. Returns 0 on success or -1 on failure.
+ *------------------------------------------------------------------------------------------------------------*/
+int FileReadAt(FILE *pStream, void *pBlock, size_t pSize, off_t pOffset);
+
 /*--------------------------------------------------------------------------------------------------------------
  * FUNCTION: FileSize()
  *
  * DESCRIPTION
- * Determines the size of a file.
+ * Determines the size of a file. Returns -1 if the file does not exist.
  *------------------------------------------------------------------------------------------------------------*/
-long FileSize(char *pFilename);
+off_t FileSize(char *pFilename);
 
 /*--------------------------------------------------------------------------------------------------------------
  * FUNCTION: FileWrite()
@@ -0,0 +1,170 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * See comments in Hist.h.
+ **************************************************************************************************************/
+#include <pthread.h>
+#include <string.h>
+#include "Hist.h"
+#include "Thread.h"
+
+// The counts in a tHistAcc are flushed after this many pixels, long before a 32-bit count could overflow.
+static const uint32_t cHistAccMaxPixels = 1u << 30;
+
+// Rows are divided among threads in chunks of at least this many pixels.
+static const int cHistMinPixelsPerThread = 1 << 16;
+
+// A HistApply() or HistCompute() pass over the rows of an image, shared by the threads.
+typedef struct {
+	tBmp			*bmp;
+	pthread_mutex_t	lock;		// Protects result.
+	tHistLut		*lut;		// The LUT to map each row through, or NULL.
+	tHist			*result;	// The histogram the threads add their counts to, or NULL.
+} tHistJob;
+
+static void		HistIdentity(tHistLut *pLut);
+static void		HistRows(void *pJob, int pThread, int pBegin, int pEnd);
+static void		HistRun(tBmp *pBmp, tHistLut *pLut, tHist *pResult);
+
+void HistAccFlush(tHistAcc *pAcc, tHist *pHist)
+{
+	for (int c = 0; c < HIST_CHANNELS; ++c) {
+		for (int v = 0; v < 256; ++v) {
+			for (int copy = 0; copy < HIST_COPIES; ++copy) pHist->bin[c][v] += pAcc->bin[c][copy][v];
+		}
+	}
+	memset(pAcc, 0, sizeof(tHistAcc));
+}
+
+void HistAccRow(tHistAcc *pAcc, tHist *pHist, tPixel *pRow, int pWidth)
+{
+	if (pAcc->pixels > cHistAccMaxPixels - (uint32_t)pWidth) HistAccFlush(pAcc, pHist);
+	pAcc->pixels += (uint32_t)pWidth;
+
+	// Consecutive pixels are counted in different copies of the bins, so a run of equal pixels increments
+	// HIST_COPIES independent counters in turn rather than waiting on the previous increment of one.
+	for (int x = 0; x < pWidth; ++x) {
+		int copy = x & (HIST_COPIES - 1);
+		tPixel *pixel = &pRow[x];
+		++pAcc->bin[HistBlue][copy][pixel->blue];
+		++pAcc->bin[HistGreen][copy][pixel->green];
+		++pAcc->bin[HistRed][copy][pixel->red];
+		++pAcc->bin[HistLuma][copy][HistPixelLuma(pixel)];
+	}
+}
+
+void HistApply(tBmp *pBmp, tHistLut *pLut, tHist *pResult)
+{
+	HistRun(pBmp, pLut, pResult);
+}
+
+void HistCompute(tBmp *pBmp, tHist *pHist)
+{
+	HistRun(pBmp, NULL, pHist);
+}
+
+void HistEqualize(tHist *pHist, tHistLut *pLut)
+{
+	// The cumulative count of the darkest luma value present is mapped to 0, and the total to 255.
+	uint64_t cdf[256], sum = 0, first = 0;
+	for (int v = 0; v < 256; ++v) {
+		sum += pHist->bin[HistLuma][v];
+		cdf[v] = sum;
+		if (first == 0) first = sum;
+	}
+	if (sum == first) {
+		// Only one luma value is present, so there is nothing to spread.
+		HistIdentity(pLut);
+		return;
+	}
+	for (int v = 0; v < 256; ++v) {
+		double value = cdf[v] < first ? 0.0 : (double)(cdf[v] - first) * 255.0 / (double)(sum - first);
+		byte mapped = (byte)(value + 0.5);
+		pLut->map[HistBlue][v] = pLut->map[HistGreen][v] = pLut->map[HistRed][v] = mapped;
+	}
+}
+
+static void HistIdentity(tHistLut *pLut)
+{
+	for (int v = 0; v < 256; ++v) pLut->map[HistBlue][v] = pLut->map[HistGreen][v] = pLut->map[HistRed][v] = v;
+}
+
+void HistLevels(tHist *pHist, double pClip, tHistLut *pLut)
+{
+	uint64_t total = 0;
+	for (int v = 0; v < 256; ++v) total += pHist->bin[HistBlue][v];
+	uint64_t clip = (uint64_t)(pClip * (double)total);
+
+	for (int c = HistBlue; c <= HistRed; ++c) {
+		// Find the darkest and brightest values once the clipped pixels are ignored.
+		uint64_t sum = 0;
+		int lo = 0, hi = 255;
+		while (lo < 255 && (sum += pHist->bin[c][lo]) <= clip) ++lo;
+		sum = 0;
+		while (hi > 0 && (sum += pHist->bin[c][hi]) <= clip) --hi;
+
+		for (int v = 0; v < 256; ++v) {
+			if (hi <= lo) pLut->map[c][v] = v;
+			else if (v <= lo) pLut->map[c][v] = 0;
+			else if (v >= hi) pLut->map[c][v] = 255;
+			else pLut->map[c][v] = (byte)(((v - lo) * 255 + (hi - lo) / 2) / (hi - lo));
+		}
+	}
+}
+
+byte HistPixelLuma(tPixel *pPixel)
+{
+	return (byte)((77 * pPixel->red + 150 * pPixel->green + 29 * pPixel->blue + 128) >> 8);
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: HistRows()
+ *
+ * DESCRIPTION
+ * The body of the parallel loop over the rows of the image. Each thread maps its rows through the LUT and
+ * counts them in bins of its own, then adds its counts to the result once at the end.
+ *------------------------------------------------------------------------------------------------------------*/
+static void HistRows(void *pJob, int pThread, int pBegin, int pEnd)
+{
+	tHistJob *job = (tHistJob *)pJob;
+	int width = job->bmp->infoHeader.width;
+	tHistAcc acc;
+	tHist hist;
+	memset(&acc, 0, sizeof(acc));
+	memset(&hist, 0, sizeof(hist));
+
+	for (int row = pBegin; row < pEnd; ++row) {
+		tPixel *pixel = job->bmp->pixel[row];
+		if (job->lut) {
+			byte (*map)[256] = job->lut->map;
+			for (int x = 0; x < width; ++x) {
+				pixel[x].blue = map[HistBlue][pixel[x].blue];
+				pixel[x].green = map[HistGreen][pixel[x].green];
+				pixel[x].red = map[HistRed][pixel[x].red];
+			}
+		}
+		if (job->result) HistAccRow(&acc, &hist, pixel, width);
+	}
+	if (!job->result) return;
+
+	HistAccFlush(&acc, &hist);
+	pthread_mutex_lock(&job->lock);
+	for (int c = 0; c < HIST_CHANNELS; ++c) {
+		for (int v = 0; v < 256; ++v) job->result->bin[c][v] += hist.bin[c][v];
+	}
+	pthread_mutex_unlock(&job->lock);
+}
+
+static void HistRun(tBmp *pBmp, tHistLut *pLut, tHist *pResult)
+{
+	tHistJob job;
+	job.bmp = pBmp;
+	job.lut = pLut;
+	job.result = pResult;
+	if (pResult) memset(pResult, 0, sizeof(tHist));
+	pthread_mutex_init(&job.lock, NULL);
+	int minRows = cHistMinPixelsPerThread / pBmp->infoHeader.width;
+	ThreadFor(pBmp->infoHeader.height, minRows, HistRows, &job);
+	pthread_mutex_destroy(&job.lock);
+}
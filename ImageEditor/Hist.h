@@ -0,0 +1,112 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * Histograms of the blue, green, red, and luma values of an image, and the operations built on them: auto
+ * levels and histogram equalization. Both turn the histogram into a lookup table (LUT) which maps each
+ * channel value of a pixel to its new value.
+ *
+ * Counting pixels is dominated by the store-to-load dependency between consecutive increments of the same bin,
+ * which is the common case in images with large flat areas. To break the dependency, each thread counts into
+ * its own (privatized) bins, with HIST_COPIES copies of the bins for each channel, and consecutive pixels are
+ * counted in different copies. The copies and threads are summed at the end.
+ **************************************************************************************************************/
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdint.h>
+#include "Bmp.h"
+
+// The number of channels in a histogram. See tHistChannel.
+#define HIST_CHANNELS 4
+
+// The number of copies of the bins used while counting. Must be a power of two.
+#define HIST_COPIES 4
+
+// The channels of a histogram. Luma is 0.299 R + 0.587 G + 0.114 B (ITU-R BT.601).
+typedef enum {
+	HistBlue  = 0,
+	HistGreen = 1,
+	HistRed   = 2,
+	HistLuma  = 3
+} tHistChannel;
+
+// Note: The tHist typedef is in Bmp.h so that BmpRead() can compute a histogram while reading.
+struct tHist {
+	uint64_t	bin[HIST_CHANNELS][256];
+};
+
+// The privatized bins of one thread. The 32-bit counts are flushed into a tHist before they can overflow.
+typedef struct {
+	uint32_t	bin[HIST_CHANNELS][HIST_COPIES][256];
+	uint32_t	pixels;
+} tHistAcc;
+
+// A lookup table mapping the value of each of the blue, green, and red channels of a pixel to a new value.
+typedef struct {
+	byte	map[3][256];
+} tHistLut;
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: HistAccFlush()
+ *
+ * DESCRIPTION
+ * Adds the counts in pAcc to pHist and clears pAcc.
+ *------------------------------------------------------------------------------------------------------------*/
+void HistAccFlush(tHistAcc *pAcc, tHist *pHist);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: HistAccRow()
+ *
+ * DESCRIPTION
+ * Counts the pWidth pixels of pRow in pAcc, first flushing pAcc into pHist if the counts could overflow.
+ * pAcc must have been cleared with HistAccFlush() or memset() before the first row.
+ *------------------------------------------------------------------------------------------------------------*/
+void HistAccRow(tHistAcc *pAcc, tHist *pHist, tPixel *pRow, int pWidth);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: HistApply()
+ *
+ * DESCRIPTION
+ * Maps every pixel of pBmp through pLut, in parallel. If pResult is not NULL, the histogram of the modified
+ * image is computed in the same pass, while each row is still in the cache.
+ *------------------------------------------------------------------------------------------------------------*/
+void HistApply(tBmp *pBmp, tHistLut *pLut, tHist *pResult);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: HistCompute()
+ *
+ * DESCRIPTION
+ * Computes the histogram of pBmp, in parallel.
+ *------------------------------------------------------------------------------------------------------------*/
+void HistCompute(tBmp *pBmp, tHist *pHist);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: HistEqualize()
+ *
+ * DESCRIPTION
+ * Makes the LUT which equalizes the histogram pHist: the cumulative distribution of luma values is mapped onto
+ * 0..255 so that the values are spread evenly. The same mapping is used for the three channels, so gray
+ * pixels stay gray.
+ *------------------------------------------------------------------------------------------------------------*/
+void HistEqualize(tHist *pHist, tHistLut *pLut);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: HistLevels()
+ *
+ * DESCRIPTION
+ * Makes the auto levels LUT for the histogram pHist. Each channel is stretched so that its darkest and
+ * brightest values, ignoring the darkest and brightest pClip fraction of the pixels, become 0 and 255. As
+ * each channel is stretched on its own, a color cast is removed too.
+ *------------------------------------------------------------------------------------------------------------*/
+void HistLevels(tHist *pHist, double pClip, tHistLut *pLut);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: HistPixelLuma()
+ *
+ * DESCRIPTION
+ * Returns the luma value of a pixel, as counted in the HistLuma channel.
+ *------------------------------------------------------------------------------------------------------------*/
+byte HistPixelLuma(tPixel *pPixel);
+
+#endif
@@ -2,51 +2,98 @@
  * Nicholas Mel
  *
  * DESCRIPTION
- * Functions for performing the image processing operations: flip horizontally, flip vertically, and rotate
- * right.
+ * Functions for performing the image processing operations: crop, flip horizontally, flip vertically, and
+ * rotate right.
  **************************************************************************************************************/
-#include "Bmp.h"
+#include <string.h>
+#include "Image.h"
+#include "Progress.h"
+#include "Tune.h"
+
+tError ImageCrop(tBmp *pBmp, int pX, int pY, int pWidth, int pHeight)
+{
+	if (pX < 0 || pY < 0 || pX >= pBmp->infoHeader.width || pY >= pBmp->infoHeader.height) return ErrorOpCrop;
+	if (pWidth <= 0 || pHeight <= 0) return ErrorOpCrop;
+	if (pWidth > pBmp->infoHeader.width - pX) pWidth = pBmp->infoHeader.width - pX;
+	if (pHeight > pBmp->infoHeader.height - pY) pHeight = pBmp->infoHeader.height - pY;
+	tPixel **newPixel = BmpPixelAlloc(pWidth, pHeight);
+	if (!newPixel) return ErrorOpMemory;
+	ProgressBegin("crop", pHeight, "rows");
+	for (int row = 0; row < pHeight; ++row) {
+		memcpy(newPixel[row], &pBmp->pixel[pY + row][pX], pWidth * sizeof(tPixel));
+		if (!ProgressStep(1)) break;
+	}
+	BmpPixelFree(pBmp->pixel, pBmp->infoHeader.height);
+	pBmp->infoHeader.width = pWidth;
+	pBmp->infoHeader.height = pHeight;
+	pBmp->pixel = newPixel;
+	return ErrorNone;
+}
 
 void ImageFlipHoriz(tBmp *pBmp)
 {
+	ProgressBegin("fliph", pBmp->infoHeader.height, "rows");
 	for (int row = 0; row < pBmp->infoHeader.height; ++row) {
 		for (int col = 0; col < pBmp->infoHeader.width / 2; ++col) {
 			tPixel temp = pBmp->pixel[row][col];
 			pBmp->pixel[row][col] = pBmp->pixel[row][pBmp->infoHeader.width-1 - col];
 			pBmp->pixel[row][pBmp->infoHeader.width-1 - col] = temp;
 		}
+		if (!ProgressStep(1)) break;
 	}
 }
 
-void ImageRotRight(tBmp *pBmp)
+tError ImageRotRight(tBmp *pBmp)
 {
 	int newHeight = pBmp->infoHeader.width, newWidth = pBmp->infoHeader.height;
 	tPixel **newPixel = BmpPixelAlloc(newWidth, newHeight);
-	for (int row = 0; row < newHeight; ++row) {
-		for (int col = 0; col < newWidth; ++col) {
-			newPixel[row][col] = pBmp->pixel[pBmp->infoHeader.height-1 - col][row];
+	if (!newPixel) return ErrorOpMemory;
+
+	// A row of the new image is a column of the old one, so the pixels are copied one block at a time: the old
+	// rows a block reads from stay in the cache until the block is done with them.
+	int block = TuneGet()->rotBlock;
+	ProgressBegin("rotr", newHeight, "rows");
+	for (int row0 = 0; row0 < newHeight; row0 += block) {
+		int row1 = row0 + block < newHeight ? row0 + block : newHeight;
+		for (int col0 = 0; col0 < newWidth; col0 += block) {
+			int col1 = col0 + block < newWidth ? col0 + block : newWidth;
+			for (int row = row0; row < row1; ++row) {
+				for (int col = col0; col < col1; ++col) {
+					newPixel[row][col] = pBmp->pixel[pBmp->infoHeader.height-1 - col][row];
+				}
+			}
 		}
+		if (!ProgressStep(row1 - row0)) break;
 	}
 	BmpPixelFree(pBmp->pixel, pBmp->infoHeader.height);
 	pBmp->infoHeader.width = newWidth;
 	pBmp->infoHeader.height = newHeight;
 	pBmp->pixel = newPixel;
+	return ErrorNone;
 }
 
-void ImageRotRightMult(tBmp *pBmp, int nTimes)
+tError ImageRotRightMult(tBmp *pBmp, int nTimes)
 {
-	while (nTimes--) {
-		ImageRotRight(pBmp);
+	// Only an odd number of turns needs a new pixel array. Two turns are a flip both ways, done in place, so that
+	// the image is unchanged if the array cannot be allocated.
+	tError result = ErrorNone;
+	if (nTimes % 2) result = ImageRotRight(pBmp);
+	if (result == ErrorNone && nTimes % 4 >= 2 && !ProgressCancelled()) {
+		ImageFlipHoriz(pBmp);
+		ImageFlipVert(pBmp);
 	}
+	return result;
 }
 
 void ImageFlipVert(tBmp *pBmp)
 {
+	ProgressBegin("flipv", pBmp->infoHeader.width, "columns");
 	for (int col = 0; col < pBmp->infoHeader.width; ++col) {
 		for (int row = 0; row < pBmp->infoHeader.height / 2; ++row) {
 			tPixel temp = pBmp->pixel[row][col];
 			pBmp->pixel[row][col] = pBmp->pixel[pBmp->infoHeader.height-1 - row][col];
 			pBmp->pixel[pBmp->infoHeader.height-1 - row][col] = temp;
 		}
+		if (!ProgressStep(1)) break;
 	}
 }
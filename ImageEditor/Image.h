@@ -2,14 +2,26 @@
  * Nicholas Mel
  *
  * DESCRIPTION
- * Functions for performing the image processing operations: flip horizontally, flip vertically, and rotate
- * right.
+ * Functions for performing the image processing operations: crop, flip horizontally, flip vertically, and
+ * rotate right. Each function reports its progress, and stops early, leaving the image in an unspecified state,
+ * if the job is cancelled (see Progress.h).
  **************************************************************************************************************/
 #ifndef IMAGE_H
 #define IMAGE_H
 
+#include <stdbool.h>
 #include "Bmp.h"
 
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ImageCrop()
+ *
+ * DESCRIPTION
+ * Crops the image pBmp to the pWidth x pHeight rectangle whose upper left corner is at column pX, row pY. The
+ * rectangle is clipped to the image. Returns ErrorOpCrop if it does not overlap the image at all, or
+ * ErrorOpMemory if there is not enough memory for the cropped image, leaving the image unchanged.
+ *------------------------------------------------------------------------------------------------------------*/
+tError ImageCrop(tBmp *pBmp, int pX, int pY, int pWidth, int pHeight);
+
 /*--------------------------------------------------------------------------------------------------------------
  * FUNCTION: ImageFlipHoriz()
  *
@@ -22,17 +34,19 @@ void ImageFlipHoriz(tBmp *pBmp);
  * FUNCTION: ImageRotRight()
  *
  * DESCRIPTION
- * Rotates the image pBmp right one time.
+ * Rotates the image pBmp right one time. Returns ErrorOpMemory, leaving the image unchanged, if there is not
+ * enough memory for the rotated image.
  *------------------------------------------------------------------------------------------------------------*/
-void ImageRotRight(tBmp *pBmp);
+tError ImageRotRight(tBmp *pBmp);
 
 /*--------------------------------------------------------------------------------------------------------------
  * FUNCTION: ImageRotRightMult()
  *
  * DESCRIPTION
- * Rotates the image pBmp right multiple (pTimes) times.
+ * Rotates the image pBmp right multiple (pTimes) times. Returns ErrorOpMemory, leaving the image unchanged, if
+ * there is not enough memory for the rotated image.
  *------------------------------------------------------------------------------------------------------------*/
-void ImageRotRightMult(tBmp *pBmp, int pTimes);
+tError ImageRotRightMult(tBmp *pBmp, int pTimes);
 
 /*--------------------------------------------------------------------------------------------------------------
  * FUNCTION: ImageFlipVert()
@@ -0,0 +1,147 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * See comments in Integral.h.
+ **************************************************************************************************************/
+#include <stdlib.h>
+#include "Integral.h"
+#include "Thread.h"
+
+// The width in table columns of the strips accumulated down the image. Each step then adds runs of 3 KB of
+// the two tables.
+static const int cIntegralStrip = 128;
+
+// The row step is split between threads in chunks of at least this many rows.
+static const int cIntegralMinRowsPerThread = 16;
+
+// An integral image being built.
+typedef struct {
+	tBmp		*bmp;		// The image.
+	tIntegral	*integral;	// The tables.
+} tIntegralBuild;
+
+static void	IntegralAddRow(uint64_t *restrict pRow, const uint64_t *restrict pAbove, size_t pCount);
+static void	IntegralCols(void *pContext, int pThread, int pBegin, int pEnd);
+static void	IntegralRows(void *pContext, int pThread, int pBegin, int pEnd);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: IntegralAddRow()
+ *
+ * DESCRIPTION
+ * Adds the pCount entries of pAbove to those of pRow. The rows never overlap, which lets the compiler use
+ * vector additions.
+ *------------------------------------------------------------------------------------------------------------*/
+static void IntegralAddRow(uint64_t *restrict pRow, const uint64_t *restrict pAbove, size_t pCount)
+{
+	for (size_t i = 0; i < pCount; ++i) pRow[i] += pAbove[i];
+}
+
+tError IntegralBuild(tBmp *pBmp, tIntegral *pIntegral)
+{
+	pIntegral->width = pBmp->infoHeader.width;
+	pIntegral->height = pBmp->infoHeader.height;
+	size_t entries = ((size_t)pIntegral->width + 1) * ((size_t)pIntegral->height + 1) * 3;
+	pIntegral->sum = (uint64_t *)malloc(entries * sizeof(uint64_t));
+	pIntegral->sumSq = pIntegral->sum ? (uint64_t *)malloc(entries * sizeof(uint64_t)) : NULL;
+	if (!pIntegral->sumSq) {
+		free(pIntegral->sum);
+		pIntegral->sum = NULL;
+		return ErrorIntegral;
+	}
+
+	tIntegralBuild build;
+	build.bmp = pBmp;
+	build.integral = pIntegral;
+	ThreadFor(pIntegral->height, cIntegralMinRowsPerThread, IntegralRows, &build);
+	ThreadFor((pIntegral->width + cIntegralStrip) / cIntegralStrip, 1, IntegralCols, &build);
+	return ErrorNone;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: IntegralCols()
+ *
+ * DESCRIPTION
+ * The body of the loop over the strips of table columns [pBegin, pEnd) of the column step. Every table row of
+ * the strip, which holds the sums along its image row, has the sums of the rows above it added to it.
+ *------------------------------------------------------------------------------------------------------------*/
+static void IntegralCols(void *pContext, int pThread, int pBegin, int pEnd)
+{
+	tIntegral *integral = ((tIntegralBuild *)pContext)->integral;
+	size_t rowEntries = 3 * ((size_t)integral->width + 1);
+	for (int strip = pBegin; strip < pEnd; ++strip) {
+		size_t first = 3 * (size_t)strip * cIntegralStrip;
+		size_t count = rowEntries - first < 3 * (size_t)cIntegralStrip ? rowEntries - first : 3 * cIntegralStrip;
+		for (int y = 2; y <= integral->height; ++y) {
+			size_t row = y * rowEntries + first, above = row - rowEntries;
+			IntegralAddRow(integral->sum + row, integral->sum + above, count);
+			IntegralAddRow(integral->sumSq + row, integral->sumSq + above, count);
+		}
+	}
+}
+
+void IntegralFree(tIntegral *pIntegral)
+{
+	free(pIntegral->sum);
+	free(pIntegral->sumSq);
+	pIntegral->sum = pIntegral->sumSq = NULL;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: IntegralRows()
+ *
+ * DESCRIPTION
+ * The body of the loop over the image rows [pBegin, pEnd) of the row step. Image row y is summed along the row
+ * into table row y + 1. Table row 0 is cleared by the thread which sums image row 0.
+ *------------------------------------------------------------------------------------------------------------*/
+static void IntegralRows(void *pContext, int pThread, int pBegin, int pEnd)
+{
+	tIntegralBuild *build = (tIntegralBuild *)pContext;
+	tIntegral *integral = build->integral;
+	size_t rowEntries = 3 * ((size_t)integral->width + 1);
+	if (pBegin == 0) {
+		for (size_t i = 0; i < rowEntries; ++i) integral->sum[i] = integral->sumSq[i] = 0;
+	}
+	for (int y = pBegin; y < pEnd; ++y) {
+		byte *pixel = (byte *)build->bmp->pixel[y];
+		uint64_t *sum = integral->sum + (y + 1) * rowEntries, *sumSq = integral->sumSq + (y + 1) * rowEntries;
+		uint64_t s[3] = {0, 0, 0}, q[3] = {0, 0, 0};
+		for (int c = 0; c < 3; ++c) sum[c] = sumSq[c] = 0;
+		for (int x = 0; x < integral->width; ++x) {
+			for (int c = 0; c < 3; ++c) {
+				uint32_t v = pixel[3 * x + c];
+				s[c] += v;
+				q[c] += v * v;
+				sum[3 * (x + 1) + c] = s[c];
+				sumSq[3 * (x + 1) + c] = q[c];
+			}
+		}
+	}
+}
+
+bool IntegralStats(const tIntegral *pIntegral, int pX, int pY, int pWidth, int pHeight, tRegionStats *pStats)
+{
+	long long x0 = pX < 0 ? 0 : pX, y0 = pY < 0 ? 0 : pY;
+	long long x1 = (long long)pX + pWidth, y1 = (long long)pY + pHeight;
+	if (x1 > pIntegral->width) x1 = pIntegral->width;
+	if (y1 > pIntegral->height) y1 = pIntegral->height;
+	if (x1 <= x0 || y1 <= y0) return false;
+
+	// The sum over [x0, x1) x [y0, y1) is T(x1, y1) - T(x0, y1) - T(x1, y0) + T(x0, y0). The unsigned arithmetic
+	// wraps around in between but the result is exact.
+	size_t rowEntries = 3 * ((size_t)pIntegral->width + 1);
+	size_t a = y0 * rowEntries + 3 * x0, b = y0 * rowEntries + 3 * x1;
+	size_t c = y1 * rowEntries + 3 * x0, d = y1 * rowEntries + 3 * x1;
+	double n = (double)((x1 - x0) * (y1 - y0));
+	pStats->count = (long)((x1 - x0) * (y1 - y0));
+	for (int ch = 0; ch < 3; ++ch) {
+		uint64_t sum = pIntegral->sum[d + ch] - pIntegral->sum[c + ch] - pIntegral->sum[b + ch]
+			+ pIntegral->sum[a + ch];
+		uint64_t sumSq = pIntegral->sumSq[d + ch] - pIntegral->sumSq[c + ch] - pIntegral->sumSq[b + ch]
+			+ pIntegral->sumSq[a + ch];
+		double mean = (double)sum / n, variance = (double)sumSq / n - mean * mean;
+		pStats->mean[ch] = mean;
+		pStats->variance[ch] = variance > 0 ? variance : 0;
+	}
+	return true;
+}
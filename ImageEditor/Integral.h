@@ -0,0 +1,65 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * Integral images (summed-area tables) for statistics of rectangular regions, e.g., the margins of a scanned
+ * page or the tiles of an image. Entry (x, y) of the table is the sum of the pixels above and to the left of
+ * pixel (x, y), so the sum over any rectangle is found from the entries at its four corners, and the mean and
+ * variance of a region take the same time whatever its size.
+ *
+ * The table is built in parallel in two steps: each row of pixels is read once and summed along the row, then
+ * the row sums are accumulated down strips of columns, which reads each row of the table as a contiguous run.
+ **************************************************************************************************************/
+#ifndef INTEGRAL_H
+#define INTEGRAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "Bmp.h"
+#include "Error.h"
+
+// The integral image of the blue, green, and red channels of an image. Entry (x, y) of a table, for
+// 0 <= x <= width and 0 <= y <= height, is at [(y * (width + 1) + x) * 3 + channel] and is the sum over the
+// pixels [0, x) x [0, y), where row 0 is the top row of the image. Row 0 and column 0 of a table are zero.
+typedef struct {
+	int			height;	// The height of the image.
+	uint64_t	*sum;	// The table of the pixel values.
+	uint64_t	*sumSq;	// The table of the squares of the pixel values.
+	int			width;	// The width of the image.
+} tIntegral;
+
+// The statistics of a region of an image, by channel in tPixel order (blue, green, red).
+typedef struct {
+	long	count;			// The number of pixels in the region.
+	double	mean[3];		// The mean of each channel.
+	double	variance[3];	// The (population) variance of each channel.
+} tRegionStats;
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: IntegralBuild()
+ *
+ * DESCRIPTION
+ * Builds the integral image of pBmp into pIntegral, which is freed with IntegralFree(). pBmp is not modified
+ * and is not needed afterwards. Returns ErrorIntegral if memory for the tables could not be allocated.
+ *------------------------------------------------------------------------------------------------------------*/
+tError IntegralBuild(tBmp *pBmp, tIntegral *pIntegral);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: IntegralFree()
+ *
+ * DESCRIPTION
+ * Frees the tables of pIntegral.
+ *------------------------------------------------------------------------------------------------------------*/
+void IntegralFree(tIntegral *pIntegral);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: IntegralStats()
+ *
+ * DESCRIPTION
+ * Computes the statistics of the pWidth x pHeight region at (pX, pY) (from the top left corner) of the image
+ * of pIntegral into pStats. The region is clipped to the image. Returns false if nothing is left of it, in
+ * which case pStats is not modified.
+ *------------------------------------------------------------------------------------------------------------*/
+bool IntegralStats(const tIntegral *pIntegral, int pX, int pY, int pWidth, int pHeight, tRegionStats *pStats);
+
+#endif
@@ -7,52 +7,191 @@
 //#include "K1as.hpp"
 
 
+#include <limits.h>   // For INT_MIN, INT_MAX
+#include <math.h>     // For isfinite()
 #include <stdbool.h>  // For bool data type
 #include <stdio.h>    // For printf()
 #include <stdlib.h>   // For exit(), strtod()
+#include <unistd.h>   // For sysconf()
 #include "Arg.h"
 #include "Bmp.h"
-#include "Image.h"
+#include "Cache.h"
+#include "Color.h"
+#include "Compare.h"
 #include "Error.h"
+#include "File.h"
+#include "Hist.h"
+#include "Integral.h"
+#include "Morph.h"
+#include "Numa.h"
+#include "Op.h"
+#include "Progress.h"
+#include "Pyramid.h"
+#include "Rank.h"
+#include "Server.h"
+#include "Tile.h"
+#include "Tune.h"
+#include "Warp.h"
 #include "String.h"
 
-// Enumerated type for the operations to be performed in the operation queue.
-typedef enum {
-	OperationFlipH = 1,
-	OperationFlipV = 2,
-	OperationRotR  = 3
-} tOperation;
-
-// The operation queue. Stores values indicating the operations to be performed in the order they were en-
-// countered on the command line.
-typedef struct {
-	int 		index;
-	tOperation	queue[3];
-} tOpQueue;
-
 // Stores command line argument info.
 typedef struct {
 	int			argc;		// argc from main()
 	char		**argv;		// argv from main()
+	char		*background;	// The color r,g,b following --background
+	char		*cache;		// The directory following --cache
+	int			cacheMem;	// The argument n (MB) following --cache-mem
+	int			cacheSize;	// The argument n (MB) following --cache-size
+	bool		cacheStats;	// --cache-stats
+	char		*client;	// The socket path following --client
+	char		*compare;	// The file name following --compare
+	char		*convert;	// The color space following --convert
+	int			deadline;	// The argument n (ms) following --deadline
+	bool		deepValidate;	// --deep-validate
 	bool		fliph;		// --fliph was specified
 	bool		flipv;		// --flipv
 	bool		h;			// -h, --help
 	char		*inFile;	// The file name of the input BMP image
+	bool		info;		// --info
+	bool		inlineImg;	// --inline
+	char		*interp;	// The sampling method following --interp
+	bool		largeBmp;	// --large-bmp
+	char		*numa;		// The mode following --numa
 	bool		o;			// -o file, --output file
 	tOpQueue	opQueue;	// Order in which the operations are to be performed.
 	char		*outFile;	// The output file name following -o or --output
+	int			pending;	// The argument n following --pending
+	bool		planar;		// --planar
+	bool		progress;	// --progress
+	char		*pyramid;	// The output directory following --pyramid
+	char		*pyramidLayout;	// The layout following --pyramid-layout
+	char		*regionStats;	// The file name following --region-stats
 	int			rotArg;		// The argument n following --rotr
 	bool		rotr;		// --rotr n
+	char		*serve;		// The socket path following --serve
+	int			tileCache;	// The argument n (MB) following --tile-cache
+	bool		tiled;		// --tiled
+	bool		tune;		// --tune
+	bool		validate;	// --validate
+	int			workers;	// The argument n following --workers
 } tCmdLine;
 
 const char *cAuthor  = "Nicholas Mel";
 const char *cBinary  = "bimpie";
 
+static void	CacheStats(tCmdLine *);
+static void	CheckBmpResult(tError pResult, char *pFilename);
 static bool	CheckDupOpt(bool pOptFlag, char *pOptStr);
+static void	Client(tCmdLine *);
+static void	Compare(tCmdLine *);
+static void	Convert(tCmdLine *);
+static tOp	*Enqueue(tCmdLine *, tOperation pOp);
 static void	Help();
+static void	Info(tCmdLine *);
+static void	InitNuma(tCmdLine *);
+static void	LoadTune(tCmdLine *);
+static void	OpenCache(tCmdLine *, tCache *pCache);
+static void	Pyramid(tCmdLine *);
+static void	RegionStats(tCmdLine *);
 static void	Run(tCmdLine *);
+static bool	RunInPlace(tCmdLine *);
+static void	RunOps(tCmdLine *);
+static void	RunTiled(tCmdLine *);
 static void	ScanCmdLine(tCmdLine *);
+static void	ScanDoubleList(char *pOpt, char *pArg, double *pValues, int pCount);
+static int	ScanIntArg(char *pOpt, char *pArg, int pMin);
+static void	ScanIntList(char *pOpt, char *pArg, int *pValues, int pCount);
+static void	ScanMorphArg(char *pOpt, char *pArg, tOp *pOp, tMorphOp pMorphOp);
+static void	ScanOverlayArg(char *pOpt, char *pArg, tOp *pOp);
+static void	ScanRankArg(char *pOpt, char *pArg, tOp *pOp, bool pPercentile);
 static int	ScanRotArg(char *pOpt, char *pArg);
+static void	ScanWarpArgs(tCmdLine *);
+static void	Serve(tCmdLine *);
+static void	Tune(tCmdLine *);
+static void	Validate(tCmdLine *);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: CacheStats()
+ *
+ * DESCRIPTION
+ * Displays the counters and the size of the --cache directory.
+ *------------------------------------------------------------------------------------------------------------*/
+static void CacheStats(tCmdLine *pCmdLine)
+{
+	tCache cache;
+	tCacheStats stats;
+	OpenCache(pCmdLine, &cache);
+	CacheReadStats(&cache, &stats);
+	printf("%s: %ld hits, %ld misses, %ld evictions, %ld results, %ld bytes\n", pCmdLine->cache, stats.hits,
+		stats.misses, stats.evictions, stats.entries, stats.bytes);
+	CacheClose(&cache);
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: CheckBmpResult()
+ *
+ * DESCRIPTION
+ * Checks the value returned by one of the BmpXXX() reading functions. If it indicates an error, display an
+ * appropriate message about pFilename and exit.
+ *------------------------------------------------------------------------------------------------------------*/
+static void CheckBmpResult(tError pResult, char *pFilename)
+{
+	switch (pResult) {
+		case ErrorBmpInv:
+			ErrorExit(pResult, "%s is not a BMP file", pFilename);
+			break;
+		case ErrorBmpCorrupt:
+			ErrorExit(pResult, "%s is corrupted", pFilename);
+			break;
+		case ErrorBmpGray:
+			ErrorExit(pResult, "%s is an 8-bit gray BMP file, which only --info and --validate read", pFilename);
+			break;
+		case ErrorBmpLarge:
+			ErrorExit(pResult, "%s would be a BMP file of 4 GB or more, which needs --large-bmp", pFilename);
+			break;
+		case ErrorCancelled:
+			ErrorExit(pResult, "deadline exceeded processing %s, no output written", pFilename);
+			break;
+		case ErrorColor:
+			ErrorExit(pResult, "out of memory converting %s", pFilename);
+			break;
+		case ErrorFileOpen:
+			ErrorExit(pResult, "could not open %s", pFilename);
+			break;
+		case ErrorFileRead:
+			ErrorExit(pResult, "reading from %s failed", pFilename);
+			break;
+		case ErrorFileWrite:
+			ErrorExit(pResult, "writing to %s failed", pFilename);
+			break;
+		case ErrorIntegral:
+			ErrorExit(pResult, "out of memory building the summed-area table of %s", pFilename);
+			break;
+		case ErrorOpCrop:
+			ErrorExit(pResult, "crop rectangle does not overlap %s", pFilename);
+			break;
+		case ErrorOpMemory:
+			ErrorExit(pResult, "out of memory processing %s", pFilename);
+			break;
+		case ErrorOpMorph:
+			ErrorExit(pResult, "out of memory filtering %s", pFilename);
+			break;
+		case ErrorOpOverlay:
+			ErrorExit(pResult, "could not read the overlay image for %s", pFilename);
+			break;
+		case ErrorOpRank:
+			ErrorExit(pResult, "out of memory filtering %s", pFilename);
+			break;
+		case ErrorOpWarp:
+			ErrorExit(pResult, "the transform of %s is not invertible or its result is too large", pFilename);
+			break;
+		case ErrorServerProto:
+			ErrorExit(pResult, "invalid request or response for %s", pFilename);
+			break;
+		default:
+			break;
+	}
+}
 
 /*--------------------------------------------------------------------------------------------------------------
  * FUNCTION: CheckDupOpt()
@@ -67,6 +206,102 @@ static bool CheckDupOpt(bool pOptFlag, char *pOptStr)
 	return true;
 }
 
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: Client()
+ *
+ * DESCRIPTION
+ * Sends the operations to the server listening on the --client socket and displays the server's timings.
+ *------------------------------------------------------------------------------------------------------------*/
+static void Client(tCmdLine *pCmdLine)
+{
+	tServerTiming timing;
+	char *outFile = pCmdLine->o ? pCmdLine->outFile : pCmdLine->inFile;
+	tError result = ServerSend(pCmdLine->client, &pCmdLine->opQueue, pCmdLine->inFile, outFile,
+		pCmdLine->inlineImg, &timing);
+	if (result == ErrorServer) ErrorExit(result, "could not connect to %s", pCmdLine->client);
+	CheckBmpResult(result, pCmdLine->inFile);
+	printf("%s: queue %u us, read %u us, ops %u us, write %u us\n", pCmdLine->inFile, (unsigned)timing.queueUs,
+		(unsigned)timing.readUs, (unsigned)timing.opUs, (unsigned)timing.writeUs);
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: Compare()
+ *
+ * DESCRIPTION
+ * Compares the input image to the --compare image and displays the result. Exits with exit code 1 if the
+ * images differ, like cmp.
+ *------------------------------------------------------------------------------------------------------------*/
+static void Compare(tCmdLine *pCmdLine)
+{
+	tCompare result;
+	if (pCmdLine->opQueue.index > 0) ErrorExit(ErrorArg, "--compare does not perform operations");
+	tError error = CompareFiles(pCmdLine->inFile, pCmdLine->compare, &result);
+	CheckBmpResult(error, result.failed ? pCmdLine->compare : pCmdLine->inFile);
+
+	if (result.sizeDiffers) {
+		printf("%s: differs from %s: %d x %d vs %d x %d\n", pCmdLine->inFile, pCmdLine->compare, result.width[0],
+			result.height[0], result.width[1], result.height[1]);
+		exit(1);
+	}
+	if (result.differ == 0) {
+		printf("%s: identical to %s\n", pCmdLine->inFile, pCmdLine->compare);
+		return;
+	}
+	printf("%s: differs from %s: %ld pixels in (%d, %d)-(%d, %d), PSNR %.2f dB, SSIM %.6f\n", pCmdLine->inFile,
+		pCmdLine->compare, result.differ, result.x0, result.y0, result.x1, result.y1, result.psnr, result.ssim);
+	exit(1);
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: Convert()
+ *
+ * DESCRIPTION
+ * Performs the operations on the input image and writes it converted to the --convert color space: as an 8-bit
+ * gray BMP image if the color space has one plane, and as raw planes if it has three or --planar was given.
+ *------------------------------------------------------------------------------------------------------------*/
+static void Convert(tCmdLine *pCmdLine)
+{
+	tColorSpace space;
+	if (!ColorScan(pCmdLine->convert, &space)) {
+		ErrorExit(ErrorArg, "--convert: invalid argument %s", pCmdLine->convert);
+	}
+
+	// A trailing --autolevels or --equalize is not applied to the image but fused into the conversion, which
+	// saves a pass over the pixels.
+	tBmp bmp;
+	tHist hist;
+	tHistLut lut;
+	bool lutLeft;
+	tHist *readHist = OpQueueWantsHist(&pCmdLine->opQueue) ? &hist : NULL;
+	CheckBmpResult(BmpRead(pCmdLine->inFile, &bmp, readHist), pCmdLine->inFile);
+	CheckBmpResult(OpQueueRunLut(&pCmdLine->opQueue, &bmp, readHist, &lut, &lutLeft), pCmdLine->inFile);
+
+	int width = bmp.infoHeader.width, height = bmp.infoHeader.height, planes = ColorPlanes(space);
+	byte *plane = (byte *)malloc((size_t)planes * width * height);
+	CheckBmpResult(plane ? ColorConvert(&bmp, space, lutLeft ? &lut : NULL, plane) : ErrorColor, pCmdLine->inFile);
+	BmpPixelFree(bmp.pixel, height);
+
+	tError result;
+	if (pCmdLine->planar || planes > 1) result = ColorWritePlanar(pCmdLine->outFile, plane, planes, width, height);
+	else result = BmpWriteGray(pCmdLine->outFile, plane, width, height);
+	CheckBmpResult(result, pCmdLine->outFile);
+	free(plane);
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: Enqueue()
+ *
+ * DESCRIPTION
+ * Appends an operation to the operation queue and returns it so its arguments can be filled in, erroring out
+ * if there are too many operations.
+ *------------------------------------------------------------------------------------------------------------*/
+static tOp *Enqueue(tCmdLine *pCmdLine, tOperation pOp)
+{
+	tOp *op = OpQueueAdd(&pCmdLine->opQueue, pOp);
+	if (!op) ErrorExit(ErrorArg, "too many operations");
+	return op;
+}
+
 /*--------------------------------------------------------------------------------------------------------------
  * FUNCTION: Help()
  *
@@ -78,15 +313,89 @@ static void Help()
 	printf("Usage: %s [options] bmpfile\n", cBinary);
 	printf("Perform image processing operations on a BMP image.\n\n");
 	printf("Options:\n\n");
+	printf("    --affine a,b,c,d,e,f     Map (x, y) to (ax+by+c, dx+ey+f) on a canvas sized to fit.\n");
+	printf("    --autolevels             Stretch each color channel to the full range (0.1%% clipped).\n");
+	printf("    --background r,g,b       The color of the canvas around --affine and --rotate (default 0,0,0).\n");
+	printf("    --cache dir              Serve repeated requests from a cache of results in directory 'dir'.\n");
+	printf("    --cache-mem n            With --serve, also cache up to n MB of results in memory.\n");
+	printf("    --cache-size n           Limit the --cache directory to n MB (default 1024).\n");
+	printf("    --cache-stats            Display the --cache hit, miss, and eviction counters and exit.\n");
+	printf("    --client sock            Send the operations to the server listening on the socket 'sock'.\n");
+	printf("    --close w,h              Dilate then erode with a w x h rectangle (fills small holes).\n");
+	printf("    --compare file           Compare the image to 'file'. Exit code 1 if they differ.\n");
+	printf("    --convert space          Write the image as gray, gray709, ycbcr, hsv, red, green, or blue.\n");
+	printf("    --crop x,y,w,h           Crop the image to the w x h rectangle whose upper left is (x, y).\n");
+	printf("    --deadline ms            Give up, leaving the output file as it was, after ms milliseconds.\n");
+	printf("    --deep-validate          Like --validate, but also check the padding of every scanline.\n");
+	printf("    --dilate w,h             Replace each pixel with the max of the w x h rectangle around it.\n");
+	printf("    --equalize               Equalize the histogram of the image's brightness.\n");
+	printf("    --erode w,h              Replace each pixel with the min of the w x h rectangle around it.\n");
 	printf("    --fliph                  Flips the image horizontally.\n");
 	printf("    --flipv                  Flips the image vertically.\n");
 	printf("    -h, --help               Display a help message and exit.\n");
+	printf("    --info                   Display the dimensions and depth of the image and exit.\n");
+	printf("    --inline                 With --client, send and receive the image bytes instead of paths.\n");
+	printf("    --interp method          --affine and --rotate sampling: nearest, bilinear (default), bicubic.\n");
+	printf("    --large-bmp              Allow writing BMP files of 4 GB or more (file size 0 in the header).\n");
+	printf("    --median r               Set each pixel to the median of the square of radius r around it.\n");
+	printf("    --numa mode              NUMA placement: auto (default), off, or n to simulate n nodes.\n");
+	printf("    --open w,h               Erode then dilate with a w x h rectangle (removes small specks).\n");
 	printf("    -o file, --output file   Write the modified image to 'file' in .bmp format.\n");
+	printf("    --overlay f@x,y[:a]      Blend BMP image f at (x, y) with opacity a in [0, 1] (default 1).\n");
+	printf("    --pending n              With --serve, accept at most n requests waiting for a worker.\n");
+	printf("    --percentile r,p         Like --median but with the p percentile (0 min, 50 median, 100 max).\n");
+	printf("    --planar                 With --convert, write raw planes instead of an 8-bit gray BMP image.\n");
+	printf("    --progress               Display the progress of reading, processing, and writing on stderr.\n");
+	printf("    --pyramid dir            Write the image as a pyramid of 256 x 256 tiles for zoomable viewers.\n");
+	printf("    --pyramid-layout l       The --pyramid layout: dzi (default) or xyz.\n");
+	printf("    --region-stats file      Display the mean and variance of each rectangle x,y,w,h in file.\n");
+	printf("    --rotate deg             Rotate the image deg degs right (clockwise) on a canvas sized to fit.\n");
 	printf("    --rotr n                 Rotate the image 90 degs right (clockwise) n mod 4 times.\n");
+	printf("    --serve sock             Serve requests sent with --client on the Unix domain socket 'sock'.\n");
+	printf("    --tile-cache n           With --tiled, cache at most n MB of source tiles (default 64).\n");
+	printf("    --tiled                  Read only the tiles needed by --crop, --fliph, --flipv, --rotr.\n");
+	printf("    --tune                   Benchmark this machine and save the tuning profile later runs load.\n");
+	printf("    --validate               Check the headers and file size of the image and exit.\n");
+	printf("    --workers n              With --serve, process at most n requests at once.\n");
 	printf("By default, the modified image is written to 'bmpfile'.\n");
 	exit(0);
 }
 
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: Info()
+ *
+ * DESCRIPTION
+ * Reads only the headers of the BMP image and displays the image info. The pixel array is not read.
+ *------------------------------------------------------------------------------------------------------------*/
+static void Info(tCmdLine *pCmdLine)
+{
+	if (pCmdLine->opQueue.index > 0) ErrorExit(ErrorArg, "--info does not perform operations");
+	tBmp bmp;
+	CheckBmpResult(BmpProbe(pCmdLine->inFile, &bmp), pCmdLine->inFile);
+	printf("%s: %d x %d, %d bits per pixel, %lld bytes, pixel array at offset %d\n", pCmdLine->inFile,
+		(int)bmp.infoHeader.width, (int)bmp.infoHeader.height, (int)bmp.infoHeader.bitsPerPixel,
+		(long long)BmpFileSize(&bmp), (int)bmp.header.pixelOffset);
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: InitNuma()
+ *
+ * DESCRIPTION
+ * Sets up NUMA placement as selected by --numa: auto (the default) to use the nodes of the host, off, or the
+ * number of nodes to simulate.
+ *------------------------------------------------------------------------------------------------------------*/
+static void InitNuma(tCmdLine *pCmdLine)
+{
+	int nodes = NUMA_AUTO;
+	if (pCmdLine->numa && streq(pCmdLine->numa, "off")) {
+		nodes = NUMA_OFF;
+	} else if (pCmdLine->numa && !streq(pCmdLine->numa, "auto")) {
+		nodes = ScanIntArg("--numa", pCmdLine->numa, 1);
+		if (nodes > NUMA_NODES_MAX) ErrorExit(ErrorArg, "--numa: invalid argument %s", pCmdLine->numa);
+	}
+	NumaInit(nodes);
+}
+
 /*--------------------------------------------------------------------------------------------------------------
  * FUNCTION: main()
  *
@@ -99,11 +408,131 @@ int main(int pArgc, char *pArgv[])
 	memset(&cmdLine, 0, sizeof(tCmdLine));
 	cmdLine.argc = pArgc;
 	cmdLine.argv = pArgv;
+	FileInit();
 	ScanCmdLine(&cmdLine);
-	Run(&cmdLine);
+	LoadTune(&cmdLine);
+	InitNuma(&cmdLine);
+	if (cmdLine.deadline || cmdLine.progress) ProgressInit(cmdLine.deadline, cmdLine.progress);
+	BmpAllowLarge(cmdLine.largeBmp);
+	if (cmdLine.tune) {
+		Tune(&cmdLine);
+	} else if (cmdLine.cacheStats) {
+		CacheStats(&cmdLine);
+	} else if (cmdLine.serve) {
+		Serve(&cmdLine);
+	} else if (cmdLine.client) {
+		Client(&cmdLine);
+	} else if (cmdLine.compare) {
+		Compare(&cmdLine);
+	} else if (cmdLine.convert) {
+		Convert(&cmdLine);
+	} else if (cmdLine.pyramid) {
+		Pyramid(&cmdLine);
+	} else if (cmdLine.regionStats) {
+		RegionStats(&cmdLine);
+	} else if (cmdLine.info) {
+		Info(&cmdLine);
+	} else if (cmdLine.validate || cmdLine.deepValidate) {
+		Validate(&cmdLine);
+	} else {
+		Run(&cmdLine);
+	}
 	return 0;
 }
 
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: LoadTune()
+ *
+ * DESCRIPTION
+ * Loads this machine's tuning profile, if there is one (see TunePath()). Without a valid profile, the default
+ * parameters are used.
+ *------------------------------------------------------------------------------------------------------------*/
+static void LoadTune(tCmdLine *pCmdLine)
+{
+	char path[PATH_MAX];
+	if (pCmdLine->tune || !TunePath(path)) return;
+	if (TuneLoad(path) == ErrorTune) printf("%s: ignoring invalid tuning profile %s\n", cBinary, path);
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: OpenCache()
+ *
+ * DESCRIPTION
+ * Opens the --cache directory with the limits given by --cache-size and --cache-mem.
+ *------------------------------------------------------------------------------------------------------------*/
+static void OpenCache(tCmdLine *pCmdLine, tCache *pCache)
+{
+	size_t maxBytes = pCmdLine->cacheSize ? (size_t)pCmdLine->cacheSize << 20 : cCacheSizeDefault;
+	size_t memMaxBytes = (size_t)pCmdLine->cacheMem << 20;
+	if (CacheOpen(pCache, pCmdLine->cache, maxBytes, memMaxBytes) != ErrorNone) {
+		ErrorExit(ErrorFileOpen, "could not open cache directory %s", pCmdLine->cache);
+	}
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: Pyramid()
+ *
+ * DESCRIPTION
+ * Exports the image as a pyramid of tiles in the --pyramid directory.
+ *------------------------------------------------------------------------------------------------------------*/
+static void Pyramid(tCmdLine *pCmdLine)
+{
+	tPyramidLayout layout = PyramidDzi;
+	if (pCmdLine->opQueue.index > 0) ErrorExit(ErrorArg, "--pyramid does not perform operations");
+	if (pCmdLine->pyramidLayout && streq(pCmdLine->pyramidLayout, "xyz")) {
+		layout = PyramidXyz;
+	} else if (pCmdLine->pyramidLayout && !streq(pCmdLine->pyramidLayout, "dzi")) {
+		ErrorExit(ErrorArg, "--pyramid-layout: invalid argument %s", pCmdLine->pyramidLayout);
+	}
+	tError result = PyramidWrite(pCmdLine->inFile, pCmdLine->pyramid, layout, cPyramidTileDefault);
+	bool outFailed = result == ErrorFileWrite || result == ErrorFileOpen;
+	CheckBmpResult(result, outFailed ? pCmdLine->pyramid : pCmdLine->inFile);
+	printf("%s: pyramid written to %s\n", pCmdLine->inFile, pCmdLine->pyramid);
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: RegionStats()
+ *
+ * DESCRIPTION
+ * Performs the operations on the input image, builds its integral image, and displays the statistics of each
+ * rectangle listed in the --region-stats file, one x,y,w,h per line. Blank lines and lines starting with '#'
+ * are skipped. The image is not written.
+ *------------------------------------------------------------------------------------------------------------*/
+static void RegionStats(tCmdLine *pCmdLine)
+{
+	tBmp bmp;
+	tIntegral integral;
+	CheckBmpResult(BmpRead(pCmdLine->inFile, &bmp, NULL), pCmdLine->inFile);
+	CheckBmpResult(OpQueueRun(&pCmdLine->opQueue, &bmp, NULL), pCmdLine->inFile);
+	CheckBmpResult(IntegralBuild(&bmp, &integral), pCmdLine->inFile);
+	BmpPixelFree(bmp.pixel, bmp.infoHeader.height);
+
+	char *listFile = pCmdLine->regionStats;
+	FILE *list = FileOpen(listFile, "rt");
+	if (!list) ErrorExit(ErrorFileOpen, "could not open %s", listFile);
+	char line[256];
+	for (int lineNum = 1; fgets(line, sizeof(line), list); ++lineNum) {
+		char *str = line + strspn(line, " \t\r\n"), extra;
+		if (*str == '\0' || *str == '#') continue;
+		int x, y, w, h;
+		if (sscanf(str, "%d,%d,%d,%d %c", &x, &y, &w, &h, &extra) != 4 || w < 1 || h < 1) {
+			ErrorExit(ErrorArg, "%s: line %d: invalid rectangle", listFile, lineNum);
+		}
+
+		// The statistics are displayed in r, g, b order.
+		tRegionStats stats;
+		if (!IntegralStats(&integral, x, y, w, h, &stats)) {
+			printf("%d,%d,%d,%d: outside the image\n", x, y, w, h);
+		} else {
+			printf("%d,%d,%d,%d: %ld pixels, mean %.3f %.3f %.3f, variance %.3f %.3f %.3f\n", x, y, w, h,
+				stats.count, stats.mean[2], stats.mean[1], stats.mean[0], stats.variance[2], stats.variance[1],
+				stats.variance[0]);
+		}
+	}
+	fclose(list);
+	IntegralFree(&integral);
+}
+
 /*--------------------------------------------------------------------------------------------------------------
  * FUNCTION: Run()
  *
@@ -112,51 +541,108 @@ int main(int pArgc, char *pArgv[])
  *------------------------------------------------------------------------------------------------------------*/
 static void Run(tCmdLine *pCmdLine)
 {
+	tCache cache;
+	char key[CACHE_KEY_MAX];
+	char *outFile = pCmdLine->o ? pCmdLine->outFile : pCmdLine->inFile;
+
+	// With --cache, a request which was seen before is served by cloning the cached result, skipping reading,
+	// processing, and writing the image.
+	if (pCmdLine->cache) {
+		OpenCache(pCmdLine, &cache);
+		CheckBmpResult(CacheKeyFile(key, pCmdLine->inFile, &pCmdLine->opQueue), pCmdLine->inFile);
+		if (CacheGetFile(&cache, key, outFile)) {
+			CacheClose(&cache);
+			return;
+		}
+	}
+
+	RunOps(pCmdLine);
+
+	if (pCmdLine->cache) {
+		CachePutFile(&cache, key, outFile);
+		CacheClose(&cache);
+	}
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: RunOps()
+ *
+ * DESCRIPTION
+ * Performs the operations on the input image and writes the modified image, choosing the cheapest way to do
+ * so: in place, tile by tile, or by reading the whole image into memory.
+ *------------------------------------------------------------------------------------------------------------*/
+static void RunOps(tCmdLine *pCmdLine)
+{
+	// When the image is written back to the input file and the operations do not change the dimensions, the
+	// file can be transformed without reading the image into memory.
+	if (!pCmdLine->o && RunInPlace(pCmdLine)) return;
+
+	if (pCmdLine->tiled) {
+		RunTiled(pCmdLine);
+		return;
+	}
+
+	// If --autolevels or --equalize will use the histogram of the image, it is computed while the image is
+	// read rather than in another pass over the pixels.
 	tBmp bmp;
-	tError result = BmpRead(pCmdLine->inFile, &bmp);
+	tHist hist;
+	tHist *readHist = OpQueueWantsHist(&pCmdLine->opQueue) ? &hist : NULL;
+	tError result = BmpRead(pCmdLine->inFile, &bmp, readHist);
 
 	// BmpRead() returns ErrorNone if the image was read correctly.
-	switch (result) {
-		case ErrorBmpInv:
-			ErrorExit(result, "%s is not a BMP file", pCmdLine->inFile);
-			break;
-		case ErrorBmpCorrupt:
-			ErrorExit(result, "%s is corrupted", pCmdLine->inFile);
-			break;
-		case ErrorFileOpen:
-			ErrorExit(result, "could not open %s", pCmdLine->inFile);
-			break;
-		case ErrorFileRead:
-			ErrorExit(result, "reading from %s failed", pCmdLine->inFile);
-			break;
-		default:
-			break;
-	}
+	CheckBmpResult(result, pCmdLine->inFile);
 
 	// Perform the operations in the order in which they appeared on the command line.
-	for (int i = 0; i < pCmdLine->opQueue.index; ++i) {
-		switch (pCmdLine->opQueue.queue[i]) {
-			case OperationFlipH:
-				ImageFlipHoriz(&bmp);
-				break;
-			case OperationFlipV:
-				ImageFlipVert(&bmp);
-				break;
-			case OperationRotR:
-				ImageRotRightMult(&bmp, pCmdLine->rotArg % 4);
-				break;
-		}
-	}
+	CheckBmpResult(OpQueueRun(&pCmdLine->opQueue, &bmp, readHist), pCmdLine->inFile);
 
 	// Write the modified image to either the file name following the -o or --output option, or to the input
 	// file name.
-	BmpWrite(pCmdLine->o ? pCmdLine->outFile : pCmdLine->inFile, &bmp);
+	char *outFile = pCmdLine->o ? pCmdLine->outFile : pCmdLine->inFile;
+	CheckBmpResult(BmpWrite(outFile, &bmp), outFile);
 
 	// Even though the program is going to exit when we return, I'm going to free the BMP pixel array anyway
 	// because I don't like memory leaks.
 	BmpPixelFree(bmp.pixel, bmp.infoHeader.height);
 }
 
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: RunInPlace()
+ *
+ * DESCRIPTION
+ * If every operation in the queue is a flip or a 180 deg rotation (see OpQueueNetFlip()), the net flip is
+ * performed directly on the input file by BmpFlipInPlace() and true is returned. Otherwise, nothing is done
+ * and false is returned.
+ *------------------------------------------------------------------------------------------------------------*/
+static bool RunInPlace(tCmdLine *pCmdLine)
+{
+	bool horiz, vert;
+	if (!OpQueueNetFlip(&pCmdLine->opQueue, &horiz, &vert)) return false;
+	CheckBmpResult(BmpFlipInPlace(pCmdLine->inFile, horiz, vert), pCmdLine->inFile);
+	return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: RunTiled()
+ *
+ * DESCRIPTION
+ * Performs the operations with the tiled image backend, which reads only the tiles of the input image that
+ * are needed to produce the output.
+ *------------------------------------------------------------------------------------------------------------*/
+static void RunTiled(tCmdLine *pCmdLine)
+{
+	tTileImage image;
+	if (!TileSupports(&pCmdLine->opQueue)) {
+		ErrorExit(ErrorArg, "--tiled only supports --crop, --fliph, --flipv, and --rotr");
+	}
+	size_t cacheBytes = pCmdLine->tileCache ? (size_t)pCmdLine->tileCache << 20 : cTileCacheDefault;
+	CheckBmpResult(TileOpen(pCmdLine->inFile, TuneGet()->tileSize, cacheBytes, &image), pCmdLine->inFile);
+	char *outFile = pCmdLine->o ? pCmdLine->outFile : pCmdLine->inFile;
+	tError result = TileRender(&image, &pCmdLine->opQueue, outFile);
+	TileClose(&image);
+	bool outFailed = result == ErrorFileWrite || result == ErrorFileOpen || result == ErrorBmpLarge;
+	CheckBmpResult(result, outFailed ? outFile : pCmdLine->inFile);
+}
+
 /*--------------------------------------------------------------------------------------------------------------
  * FUNCTION: ScanCmdLine()
  *
@@ -169,7 +655,10 @@ static void ScanCmdLine(tCmdLine *pCmdLine)
 	memset(&argScan, 0, sizeof(tArgScan));
 	argScan.argc = pCmdLine->argc;
 	argScan.argv = pCmdLine->argv;
-	argScan.longOpts = "fliph;flipv;help;output:;rotr:;";
+	argScan.longOpts = "affine:;autolevels;background:;cache:;cache-mem:;cache-size:;cache-stats;client:;close:;"
+		"compare:;convert:;crop:;deadline:;deep-validate;dilate:;equalize;erode:;fliph;flipv;help;info;inline;"
+		"interp:;large-bmp;median:;numa:;open:;output:;overlay:;pending:;percentile:;planar;progress;pyramid:;"
+		"pyramid-layout:;region-stats:;rotate:;rotr:;serve:;tile-cache:;tiled;tune;validate;workers:;";
 	argScan.shortOpts = "ho:v";
 
 	// Start scanning the command line at argv[1]. Note: argv[0] is always the name of the binary.
@@ -198,31 +687,210 @@ static void ScanCmdLine(tCmdLine *pCmdLine)
 			if (pCmdLine->inFile) ErrorExit(ErrorArgUnexpStr, "unexpected string %s", argScan.arg);
 			pCmdLine->inFile = argScan.arg;
 
-		// We encountered a valid option. Was it --fliph?
+		// We encountered a valid option. Was it --affine?
+		} else if (streq(argScan.opt, "--affine")) {
+			ScanDoubleList(argScan.opt, argScan.arg, Enqueue(pCmdLine, OperationWarp)->coef, 6);
+
+		// Was it --autolevels?
+		} else if (streq(argScan.opt, "--autolevels")) {
+			Enqueue(pCmdLine, OperationAutoLevels);
+
+		// Was it --background?
+		} else if (streq(argScan.opt, "--background")) {
+			CheckDupOpt(pCmdLine->background != NULL, argScan.opt);
+			pCmdLine->background = argScan.arg;
+
+		// Was it --cache?
+		} else if (streq(argScan.opt, "--cache")) {
+			CheckDupOpt(pCmdLine->cache != NULL, argScan.opt);
+			pCmdLine->cache = argScan.arg;
+
+		// Was it --cache-mem?
+		} else if (streq(argScan.opt, "--cache-mem")) {
+			CheckDupOpt(pCmdLine->cacheMem != 0, argScan.opt);
+			pCmdLine->cacheMem = ScanIntArg(argScan.opt, argScan.arg, 1);
+
+		// Was it --cache-size?
+		} else if (streq(argScan.opt, "--cache-size")) {
+			CheckDupOpt(pCmdLine->cacheSize != 0, argScan.opt);
+			pCmdLine->cacheSize = ScanIntArg(argScan.opt, argScan.arg, 1);
+
+		// Was it --cache-stats?
+		} else if (streq(argScan.opt, "--cache-stats")) {
+			pCmdLine->cacheStats = CheckDupOpt(pCmdLine->cacheStats, argScan.opt);
+
+		// Was it --client?
+		} else if (streq(argScan.opt, "--client")) {
+			CheckDupOpt(pCmdLine->client != NULL, argScan.opt);
+			pCmdLine->client = argScan.arg;
+
+		// Was it --close?
+		} else if (streq(argScan.opt, "--close")) {
+			ScanMorphArg(argScan.opt, argScan.arg, Enqueue(pCmdLine, OperationMorph), MorphClose);
+
+		// Was it --compare?
+		} else if (streq(argScan.opt, "--compare")) {
+			CheckDupOpt(pCmdLine->compare != NULL, argScan.opt);
+			pCmdLine->compare = argScan.arg;
+
+		// Was it --convert?
+		} else if (streq(argScan.opt, "--convert")) {
+			CheckDupOpt(pCmdLine->convert != NULL, argScan.opt);
+			pCmdLine->convert = argScan.arg;
+
+		// Was it --crop?
+		} else if (streq(argScan.opt, "--crop")) {
+			tOp *op = Enqueue(pCmdLine, OperationCrop);
+			ScanIntList(argScan.opt, argScan.arg, op->arg, 4);
+			if (op->arg[0] < 0 || op->arg[1] < 0 || op->arg[2] < 1 || op->arg[3] < 1) {
+				ErrorExit(ErrorArg, "%s: invalid argument %s", argScan.opt, argScan.arg);
+			}
+
+		// Was it --deadline?
+		} else if (streq(argScan.opt, "--deadline")) {
+			CheckDupOpt(pCmdLine->deadline != 0, argScan.opt);
+			pCmdLine->deadline = ScanIntArg(argScan.opt, argScan.arg, 1);
+
+		// Was it --deep-validate?
+		} else if (streq(argScan.opt, "--deep-validate")) {
+			pCmdLine->deepValidate = CheckDupOpt(pCmdLine->deepValidate, argScan.opt);
+
+		// Was it --dilate?
+		} else if (streq(argScan.opt, "--dilate")) {
+			ScanMorphArg(argScan.opt, argScan.arg, Enqueue(pCmdLine, OperationMorph), MorphDilate);
+
+		// Was it --equalize?
+		} else if (streq(argScan.opt, "--equalize")) {
+			Enqueue(pCmdLine, OperationEqualize);
+
+		// Was it --erode?
+		} else if (streq(argScan.opt, "--erode")) {
+			ScanMorphArg(argScan.opt, argScan.arg, Enqueue(pCmdLine, OperationMorph), MorphErode);
+
+		// Was it --fliph?
 		} else if (streq(argScan.opt, "--fliph")) {
 			pCmdLine->fliph = CheckDupOpt(pCmdLine->fliph, argScan.opt);
-			pCmdLine->opQueue.queue[pCmdLine->opQueue.index++] = OperationFlipH;
+			Enqueue(pCmdLine, OperationFlipH);
 
 		// Was it --flipv?
 		} else if (streq(argScan.opt, "--flipv")) {
 			pCmdLine->flipv = CheckDupOpt(pCmdLine->flipv, argScan.opt);
-			pCmdLine->opQueue.queue[pCmdLine->opQueue.index++] = OperationFlipV;
+			Enqueue(pCmdLine, OperationFlipV);
 
 		// Was it -h or --help?
 		} else if (streq(argScan.opt, "-h") || streq(argScan.opt, "--help")) {
 			pCmdLine->h= CheckDupOpt(pCmdLine->h, argScan.opt);
 
+		// Was it --info?
+		} else if (streq(argScan.opt, "--info")) {
+			pCmdLine->info = CheckDupOpt(pCmdLine->info, argScan.opt);
+
+		// Was it --inline?
+		} else if (streq(argScan.opt, "--inline")) {
+			pCmdLine->inlineImg = CheckDupOpt(pCmdLine->inlineImg, argScan.opt);
+
+		// Was it --interp?
+		} else if (streq(argScan.opt, "--interp")) {
+			CheckDupOpt(pCmdLine->interp != NULL, argScan.opt);
+			pCmdLine->interp = argScan.arg;
+
+		// Was it --large-bmp?
+		} else if (streq(argScan.opt, "--large-bmp")) {
+			pCmdLine->largeBmp = CheckDupOpt(pCmdLine->largeBmp, argScan.opt);
+
+		// Was it --median?
+		} else if (streq(argScan.opt, "--median")) {
+			ScanRankArg(argScan.opt, argScan.arg, Enqueue(pCmdLine, OperationRank), false);
+
+		// Was it --numa?
+		} else if (streq(argScan.opt, "--numa")) {
+			CheckDupOpt(pCmdLine->numa != NULL, argScan.opt);
+			pCmdLine->numa = argScan.arg;
+
+		// Was it --open?
+		} else if (streq(argScan.opt, "--open")) {
+			ScanMorphArg(argScan.opt, argScan.arg, Enqueue(pCmdLine, OperationMorph), MorphOpen);
+
 		// Was it -o or --output?
 		} else if (streq(argScan.opt, "-o") || streq(argScan.opt, "--output")) {
 			pCmdLine->o = CheckDupOpt(pCmdLine->o, argScan.opt);
 			pCmdLine->outFile = argScan.arg;
 
+		// Was it --overlay?
+		} else if (streq(argScan.opt, "--overlay")) {
+			ScanOverlayArg(argScan.opt, argScan.arg, Enqueue(pCmdLine, OperationOverlay));
+
+		// Was it --pending?
+		} else if (streq(argScan.opt, "--pending")) {
+			CheckDupOpt(pCmdLine->pending != 0, argScan.opt);
+			pCmdLine->pending = ScanIntArg(argScan.opt, argScan.arg, 1);
+
+		// Was it --percentile?
+		} else if (streq(argScan.opt, "--percentile")) {
+			ScanRankArg(argScan.opt, argScan.arg, Enqueue(pCmdLine, OperationRank), true);
+
+		// Was it --planar?
+		} else if (streq(argScan.opt, "--planar")) {
+			pCmdLine->planar = CheckDupOpt(pCmdLine->planar, argScan.opt);
+
+		// Was it --progress?
+		} else if (streq(argScan.opt, "--progress")) {
+			pCmdLine->progress = CheckDupOpt(pCmdLine->progress, argScan.opt);
+
+		// Was it --pyramid?
+		} else if (streq(argScan.opt, "--pyramid")) {
+			CheckDupOpt(pCmdLine->pyramid != NULL, argScan.opt);
+			pCmdLine->pyramid = argScan.arg;
+
+		// Was it --pyramid-layout?
+		} else if (streq(argScan.opt, "--pyramid-layout")) {
+			CheckDupOpt(pCmdLine->pyramidLayout != NULL, argScan.opt);
+			pCmdLine->pyramidLayout = argScan.arg;
+
+		// Was it --region-stats?
+		} else if (streq(argScan.opt, "--region-stats")) {
+			CheckDupOpt(pCmdLine->regionStats != NULL, argScan.opt);
+			pCmdLine->regionStats = argScan.arg;
+
+		// Was it --rotate?
+		} else if (streq(argScan.opt, "--rotate")) {
+			double degrees;
+			ScanDoubleList(argScan.opt, argScan.arg, &degrees, 1);
+			WarpRotation(degrees, Enqueue(pCmdLine, OperationWarp)->coef);
+
 		// Was it --rotr? If so, attempt to convert the argument following --rotr to an integer. ScanRotArg()
 		// does not return if the conversion fails.
 		} else if (streq(argScan.opt, "--rotr")) {
 			pCmdLine->rotr = CheckDupOpt(pCmdLine->rotr, argScan.opt);
 			pCmdLine->rotArg = ScanRotArg(argScan.opt, argScan.arg);
-			pCmdLine->opQueue.queue[pCmdLine->opQueue.index++] = OperationRotR;
+			Enqueue(pCmdLine, OperationRotR)->arg[0] = pCmdLine->rotArg;
+
+		// Was it --serve?
+		} else if (streq(argScan.opt, "--serve")) {
+			CheckDupOpt(pCmdLine->serve != NULL, argScan.opt);
+			pCmdLine->serve = argScan.arg;
+
+		// Was it --tile-cache?
+		} else if (streq(argScan.opt, "--tile-cache")) {
+			CheckDupOpt(pCmdLine->tileCache != 0, argScan.opt);
+			pCmdLine->tileCache = ScanIntArg(argScan.opt, argScan.arg, 1);
+
+		// Was it --tiled?
+		} else if (streq(argScan.opt, "--tiled")) {
+			pCmdLine->tiled = CheckDupOpt(pCmdLine->tiled, argScan.opt);
+
+		// Was it --tune?
+		} else if (streq(argScan.opt, "--tune")) {
+			pCmdLine->tune = CheckDupOpt(pCmdLine->tune, argScan.opt);
+
+		// Was it --validate?
+		} else if (streq(argScan.opt, "--validate")) {
+			pCmdLine->validate = CheckDupOpt(pCmdLine->validate, argScan.opt);
+
+		// Was it --workers?
+		} else if (streq(argScan.opt, "--workers")) {
+			CheckDupOpt(pCmdLine->workers != 0, argScan.opt);
+			pCmdLine->workers = ScanIntArg(argScan.opt, argScan.arg, 1);
 		}
 
 		// Scan next option.
@@ -231,12 +899,145 @@ static void ScanCmdLine(tCmdLine *pCmdLine)
 
 	if (pCmdLine->h) Help();     // Help() does not return.
 
-	// Check that an input file name was specified.
-	if (!pCmdLine->inFile) {
+	ScanWarpArgs(pCmdLine);
+
+	if (pCmdLine->cacheStats && !pCmdLine->cache) ErrorExit(ErrorArg, "--cache-stats requires --cache");
+	if (pCmdLine->planar && !pCmdLine->convert) ErrorExit(ErrorArg, "--planar requires --convert");
+	if (pCmdLine->convert && !pCmdLine->o) ErrorExit(ErrorArg, "--convert requires --output");
+	if (pCmdLine->convert && (pCmdLine->client || pCmdLine->serve)) {
+		ErrorExit(ErrorArg, "--convert is not supported with --client or --serve");
+	}
+	if ((pCmdLine->deadline || pCmdLine->progress) && (pCmdLine->client || pCmdLine->serve)) {
+		ErrorExit(ErrorArg, "--deadline and --progress are not supported with --client or --serve");
+	}
+
+	// The header-only modes come last in main(), so any other mode would silently take their place.
+	bool probe = pCmdLine->info || pCmdLine->validate || pCmdLine->deepValidate;
+	if (probe && ((pCmdLine->info && (pCmdLine->validate || pCmdLine->deepValidate)) || pCmdLine->tune ||
+		pCmdLine->cacheStats || pCmdLine->serve || pCmdLine->client || pCmdLine->compare || pCmdLine->convert ||
+		pCmdLine->pyramid || pCmdLine->regionStats)) {
+		ErrorExit(ErrorArg, "--info, --validate, and --deep-validate cannot be combined with other modes");
+	}
+
+	// Check that an input file name was specified. The server gets its input files from the requests.
+	if (!pCmdLine->inFile && !pCmdLine->serve && !pCmdLine->cacheStats && !pCmdLine->tune) {
 		ErrorExit(ErrorArgRot, "expecting input file");
 	}
 }
 
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ScanDoubleList()
+ *
+ * DESCRIPTION
+ * Same as ScanIntList(), but for pCount comma separated real numbers, e.g., "1,0.25,0,0,1,0".
+ *------------------------------------------------------------------------------------------------------------*/
+static void ScanDoubleList(char *pOpt, char *pArg, double *pValues, int pCount)
+{
+	char *str = pArg, *end;
+	for (int i = 0; i < pCount; ++i) {
+		double value = strtod(str, &end);
+		bool sepOk = i < pCount-1 ? *end == ',' : *end == '\0';
+		if (end == str || !sepOk || !isfinite(value)) ErrorExit(ErrorArg, "%s: invalid argument %s", pOpt, pArg);
+		pValues[i] = value;
+		str = end + 1;
+	}
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ScanIntArg()
+ *
+ * DESCRIPTION
+ * Converts the argument pArg following the option pOpt to an integer, erroring out if it is not an integer or
+ * is less than pMin.
+ *------------------------------------------------------------------------------------------------------------*/
+static int ScanIntArg(char *pOpt, char *pArg, int pMin)
+{
+	char *end;
+	long n = strtol(pArg, &end, 10);
+	if (*pArg == '\0' || *end != '\0' || n < pMin || n > INT_MAX) {
+		ErrorExit(ErrorArg, "%s: invalid argument %s", pOpt, pArg);
+	}
+	return (int)n;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ScanIntList()
+ *
+ * DESCRIPTION
+ * Converts the argument pArg following the option pOpt, which should be pCount comma separated integers, e.g.,
+ * "10,20,300,400", to integers stored in pValues. Errors out if the conversion fails.
+ *------------------------------------------------------------------------------------------------------------*/
+static void ScanIntList(char *pOpt, char *pArg, int *pValues, int pCount)
+{
+	char *str = pArg, *end;
+	for (int i = 0; i < pCount; ++i) {
+		long n = strtol(str, &end, 10);
+		bool sepOk = i < pCount-1 ? *end == ',' : *end == '\0';
+		if (end == str || !sepOk || n < INT_MIN || n > INT_MAX) {
+			ErrorExit(ErrorArg, "%s: invalid argument %s", pOpt, pArg);
+		}
+		pValues[i] = (int)n;
+		str = end + 1;
+	}
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ScanMorphArg()
+ *
+ * DESCRIPTION
+ * Converts the argument pArg following the option pOpt, which should be the width and height of the
+ * structuring element, e.g., "5,3", to the morphological operation pMorphOp stored in pOp. Errors out if the
+ * conversion fails.
+ *------------------------------------------------------------------------------------------------------------*/
+static void ScanMorphArg(char *pOpt, char *pArg, tOp *pOp, tMorphOp pMorphOp)
+{
+	pOp->arg[0] = pMorphOp;
+	ScanIntList(pOpt, pArg, &pOp->arg[1], 2);
+	if (pOp->arg[1] < 1 || pOp->arg[2] < 1) ErrorExit(ErrorArg, "%s: invalid argument %s", pOpt, pArg);
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ScanOverlayArg()
+ *
+ * DESCRIPTION
+ * Converts the argument pArg following the option pOpt, which should be "file@x,y" or "file@x,y:opacity", to
+ * the overlay operation pOp. The file name may itself contain '@', so the position follows the last one. The
+ * opacity is a real number in [0, 1] and is stored in pOp->arg[2] scaled to [0, 255]. Errors out if the
+ * conversion fails.
+ *------------------------------------------------------------------------------------------------------------*/
+static void ScanOverlayArg(char *pOpt, char *pArg, tOp *pOp)
+{
+	char *at = strrchr(pArg, '@');
+	if (!at || at == pArg) ErrorExit(ErrorArg, "%s: invalid argument %s", pOpt, pArg);
+	double opacity = 1.0;
+	char *colon = strchr(at, ':');
+	if (colon) {
+		*colon = '\0';
+		ScanDoubleList(pOpt, colon + 1, &opacity, 1);
+		if (!(opacity >= 0.0 && opacity <= 1.0)) ErrorExit(ErrorArg, "%s: invalid opacity %s", pOpt, colon + 1);
+	}
+	ScanIntList(pOpt, at + 1, pOp->arg, 2);
+	*at = '\0';
+	pOp->arg[2] = (int)lround(opacity * 255.0);
+	pOp->path = pArg;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ScanRankArg()
+ *
+ * DESCRIPTION
+ * Converts the argument pArg following the option pOpt to the rank filter pOp. pArg should be the radius, e.g.,
+ * "2", or if pPercentile is true the radius and percentile, e.g., "2,25". Errors out if the conversion fails.
+ *------------------------------------------------------------------------------------------------------------*/
+static void ScanRankArg(char *pOpt, char *pArg, tOp *pOp, bool pPercentile)
+{
+	pOp->arg[1] = 50;
+	ScanIntList(pOpt, pArg, pOp->arg, pPercentile ? 2 : 1);
+	if (pOp->arg[0] < 1 || pOp->arg[0] > RANK_RADIUS_MAX || pOp->arg[1] < 0 || pOp->arg[1] > 100) {
+		ErrorExit(ErrorArg, "%s: invalid argument %s", pOpt, pArg);
+	}
+}
+
 /*--------------------------------------------------------------------------------------------------------------
  * FUNCTION: ScanRotArg()
  *
@@ -257,3 +1058,97 @@ static int ScanRotArg(char *pOpt, char *pArg)
 	}
 	return n;
 }
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ScanWarpArgs()
+ *
+ * DESCRIPTION
+ * --background and --interp apply to every --affine and --rotate, wherever they appear on the command line, so
+ * they are stored in the warp operations once the whole command line has been scanned.
+ *------------------------------------------------------------------------------------------------------------*/
+static void ScanWarpArgs(tCmdLine *pCmdLine)
+{
+	tWarpInterp interp = WarpBilinear;
+	if (pCmdLine->interp && streq(pCmdLine->interp, "nearest")) {
+		interp = WarpNearest;
+	} else if (pCmdLine->interp && streq(pCmdLine->interp, "bicubic")) {
+		interp = WarpBicubic;
+	} else if (pCmdLine->interp && !streq(pCmdLine->interp, "bilinear")) {
+		ErrorExit(ErrorArg, "--interp: invalid argument %s", pCmdLine->interp);
+	}
+
+	int rgb[3] = { 0, 0, 0 };
+	if (pCmdLine->background) {
+		ScanIntList("--background", pCmdLine->background, rgb, 3);
+		for (int i = 0; i < 3; ++i) {
+			if (rgb[i] < 0 || rgb[i] > 255) {
+				ErrorExit(ErrorArg, "--background: invalid argument %s", pCmdLine->background);
+			}
+		}
+	}
+
+	for (int i = 0; i < pCmdLine->opQueue.index; ++i) {
+		tOp *op = &pCmdLine->opQueue.queue[i];
+		if (op->op != OperationWarp) continue;
+		op->arg[0] = interp;
+		op->arg[1] = rgb[0] << 16 | rgb[1] << 8 | rgb[2];
+	}
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: Serve()
+ *
+ * DESCRIPTION
+ * Runs the server until it is stopped by SIGINT or SIGTERM. By default, there is one worker per CPU and twice
+ * as many pending requests as workers.
+ *------------------------------------------------------------------------------------------------------------*/
+static void Serve(tCmdLine *pCmdLine)
+{
+	tServerConfig config;
+	config.sockPath = pCmdLine->serve;
+	config.workers = pCmdLine->workers;
+	if (config.workers == 0) config.workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (config.workers < 1) config.workers = 1;
+	config.maxPending = pCmdLine->pending ? pCmdLine->pending : 2 * config.workers;
+	tCache cache;
+	config.cache = NULL;
+	if (pCmdLine->cache) {
+		OpenCache(pCmdLine, &cache);
+		config.cache = &cache;
+	}
+	if (ServerRun(&config) != ErrorNone) ErrorExit(ErrorServer, "could not serve on %s", pCmdLine->serve);
+	if (config.cache) CacheClose(config.cache);
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: Tune()
+ *
+ * DESCRIPTION
+ * Measures the best parameters for this machine and saves them in its tuning profile. The benchmarks' temporary
+ * files are written to $TMPDIR, or /tmp.
+ *------------------------------------------------------------------------------------------------------------*/
+static void Tune(tCmdLine *pCmdLine)
+{
+	char path[PATH_MAX], *tempDir = getenv("TMPDIR");
+	if (!TunePath(path)) ErrorExit(ErrorArg, "--tune: set BIMPIE_TUNE or HOME to locate the tuning profile");
+	if (!tempDir || !*tempDir) tempDir = "/tmp";
+	tError result = TuneMeasure(tempDir, stdout);
+	if (result == ErrorTune) ErrorExit(result, "--tune: out of memory for the benchmark image");
+	if (result != ErrorNone) ErrorExit(ErrorFileWrite, "writing to %s failed", tempDir);
+	CheckBmpResult(TuneSave(path), path);
+	printf("%s: saved\n", path);
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: Validate()
+ *
+ * DESCRIPTION
+ * Validates the BMP image without reading it into memory. Exits with an error if the image is not valid.
+ *------------------------------------------------------------------------------------------------------------*/
+static void Validate(tCmdLine *pCmdLine)
+{
+	const char *opt = pCmdLine->deepValidate ? "--deep-validate" : "--validate";
+	if (pCmdLine->opQueue.index > 0) ErrorExit(ErrorArg, "%s does not perform operations", opt);
+	CheckBmpResult(BmpValidate(pCmdLine->inFile, pCmdLine->deepValidate), pCmdLine->inFile);
+	printf("%s: valid\n", pCmdLine->inFile);
+}
@@ -0,0 +1,222 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * See comments in Morph.h.
+ **************************************************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include "Morph.h"
+#include "Progress.h"
+#include "Thread.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// The width in pixels of the strips of columns the column pass works on. Each step of the column pass then
+// works on a run of 192 contiguous bytes of a row.
+static const int cMorphStrip = 64;
+
+// The row pass is split between threads in chunks of at least this many rows.
+static const int cMorphMinRowsPerThread = 16;
+
+// One pass of the separable filter, along the rows or along the columns.
+typedef struct {
+	tBmp	*bmp;			// The image.
+	byte	invert;			// 0xff to dilate, i.e., to erode the complement of the image, 0 to erode.
+	byte	*scratch;		// One scratch area of scratchBytes bytes per thread.
+	size_t	scratchBytes;	// The size of a scratch area.
+	int		size;			// The length of the structuring element along the pass.
+} tMorphPass;
+
+static int		MorphAnchor(tMorphPass *pPass);
+static void		MorphCols(void *pContext, int pThread, int pBegin, int pEnd);
+static void		MorphLine(byte *pLine, int pLen, size_t pLanes, int pSize, byte *pG, byte *pH);
+static void		MorphMin(byte *restrict pOut, const byte *pA, const byte *pB, size_t pCount);
+static tError	MorphPass(tMorphPass *pPass, int pLen, int pLanes, int pCount, int pMinPerThread,
+					tThreadBody pBody);
+static void		MorphRows(void *pContext, int pThread, int pBegin, int pEnd);
+static tError	MorphSeparable(tBmp *pBmp, byte pInvert, int pWidth, int pHeight);
+
+tError MorphApply(tBmp *pBmp, tMorphOp pOp, int pWidth, int pHeight)
+{
+	tError result;
+	switch (pOp) {
+		case MorphErode:
+			return MorphSeparable(pBmp, 0, pWidth, pHeight);
+		case MorphDilate:
+			return MorphSeparable(pBmp, 0xff, pWidth, pHeight);
+		case MorphOpen:
+			result = MorphSeparable(pBmp, 0, pWidth, pHeight);
+			return result == ErrorNone ? MorphSeparable(pBmp, 0xff, pWidth, pHeight) : result;
+		case MorphClose:
+			result = MorphSeparable(pBmp, 0xff, pWidth, pHeight);
+			return result == ErrorNone ? MorphSeparable(pBmp, 0, pWidth, pHeight) : result;
+	}
+	return ErrorOpMorph;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: MorphAnchor()
+ *
+ * DESCRIPTION
+ * Returns the number of elements of the window of a pixel which come before it along the pass, the rest of
+ * the pass->size - 1 coming after it. The dilation uses the reflected element, which differs from the element
+ * of the erosion when its length is even, so that --open never brightens and --close never darkens a pixel.
+ *------------------------------------------------------------------------------------------------------------*/
+static int MorphAnchor(tMorphPass *pPass)
+{
+	int before = (pPass->size - 1) / 2;
+	return pPass->invert ? pPass->size - 1 - before : before;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: MorphCols()
+ *
+ * DESCRIPTION
+ * The body of the loop over the strips of columns [pBegin, pEnd) of the column pass. The strip is copied,
+ * complemented if dilating, into the scratch area as a line of height elements of 3 bytes per column, filtered,
+ * and copied back.
+ *------------------------------------------------------------------------------------------------------------*/
+static void MorphCols(void *pContext, int pThread, int pBegin, int pEnd)
+{
+	tMorphPass *pass = (tMorphPass *)pContext;
+	int width = pass->bmp->infoHeader.width, height = pass->bmp->infoHeader.height;
+	int size = pass->size, anchor = MorphAnchor(pass);
+	size_t padded = (size_t)height + size - 1, stripBytes = 3 * (size_t)cMorphStrip;
+	byte *line = pass->scratch + pThread * pass->scratchBytes;
+	byte *g = line + padded * stripBytes, *h = g + padded * stripBytes;
+	for (int strip = pBegin; strip < pEnd && !ProgressCancelled(); ++strip) {
+		int x0 = strip * cMorphStrip;
+		size_t lanes = 3 * (size_t)(width - x0 < cMorphStrip ? width - x0 : cMorphStrip);
+		memset(line, 0xff, anchor * lanes);
+		for (int y = 0; y < height; ++y) {
+			byte *src = (byte *)(pass->bmp->pixel[y] + x0), *dst = line + (anchor + y) * lanes;
+			for (size_t i = 0; i < lanes; ++i) dst[i] = src[i] ^ pass->invert;
+		}
+		memset(line + (anchor + height) * lanes, 0xff, (size - 1 - anchor) * lanes);
+		MorphLine(line, height, lanes, size, g, h);
+		for (int y = 0; y < height; ++y) {
+			byte *src = line + y * lanes, *dst = (byte *)(pass->bmp->pixel[y] + x0);
+			for (size_t i = 0; i < lanes; ++i) dst[i] = src[i] ^ pass->invert;
+		}
+	}
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: MorphLine()
+ *
+ * DESCRIPTION
+ * Erodes a line of pLen elements of pLanes bytes each with an element of length pSize. On entry, pLine holds
+ * the line with MorphAnchor() elements of 255 before it and the rest of pSize - 1 after it, so that pixels
+ * outside the image never win. On return, the first pLen elements of pLine are the eroded line. pG and pH are
+ * scratch areas as large as pLine.
+ *------------------------------------------------------------------------------------------------------------*/
+static void MorphLine(byte *pLine, int pLen, size_t pLanes, int pSize, byte *pG, byte *pH)
+{
+	int padded = pLen + pSize - 1;
+
+	// g is the running min from the start of each block of pSize elements, and h the running min from its end.
+	for (int p = 0; p < padded; ++p) {
+		byte *v = pLine + p * pLanes, *g = pG + p * pLanes;
+		if (p % pSize == 0) memcpy(g, v, pLanes);
+		else MorphMin(g, g - pLanes, v, pLanes);
+	}
+	for (int p = padded - 1; p >= 0; --p) {
+		byte *v = pLine + p * pLanes, *h = pH + p * pLanes;
+		if (p % pSize == pSize - 1 || p == padded - 1) memcpy(h, v, pLanes);
+		else MorphMin(h, h + pLanes, v, pLanes);
+	}
+
+	// The window of element x is [x, x + pSize - 1]. It is either one whole block, or the end of one block and
+	// the start of the next. The elements are contiguous, so the whole line is done in one run, which lets the
+	// row pass, whose elements are only 3 bytes, use vector instructions too.
+	MorphMin(pLine, pH, pG + (pSize - 1) * pLanes, pLen * pLanes);
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: MorphMin()
+ *
+ * DESCRIPTION
+ * Stores in pOut the min of each of the pCount bytes of pA and pB, 16 at a time with SSE2. pA and pB may be the
+ * same as each other, but neither may overlap pOut.
+ *------------------------------------------------------------------------------------------------------------*/
+static void MorphMin(byte *restrict pOut, const byte *pA, const byte *pB, size_t pCount)
+{
+	size_t i = 0;
+#ifdef __SSE2__
+	for (; i + 16 <= pCount; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(pA + i)), b = _mm_loadu_si128((const __m128i *)(pB + i));
+		_mm_storeu_si128((__m128i *)(pOut + i), _mm_min_epu8(a, b));
+	}
+#endif
+	for (; i < pCount; ++i) pOut[i] = pA[i] < pB[i] ? pA[i] : pB[i];
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: MorphPass()
+ *
+ * DESCRIPTION
+ * Performs one pass over the image with ThreadFor(pCount, pMinPerThread, pBody), where each line is pLen
+ * elements of at most pLanes bytes. Returns ErrorOpMorph if the scratch areas could not be allocated.
+ *------------------------------------------------------------------------------------------------------------*/
+static tError MorphPass(tMorphPass *pPass, int pLen, int pLanes, int pCount, int pMinPerThread,
+	tThreadBody pBody)
+{
+	// The line and its two running mins.
+	pPass->scratchBytes = 3 * ((size_t)pLen + pPass->size - 1) * pLanes;
+	pPass->scratch = (byte *)malloc(ThreadCount() * pPass->scratchBytes);
+	if (!pPass->scratch) return ErrorOpMorph;
+	ThreadFor(pCount, pMinPerThread, pBody, pPass);
+	free(pPass->scratch);
+	return ErrorNone;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: MorphRows()
+ *
+ * DESCRIPTION
+ * The body of the loop over the rows [pBegin, pEnd) of the row pass. Each row is copied, complemented if
+ * dilating, into the scratch area, filtered, and copied back.
+ *------------------------------------------------------------------------------------------------------------*/
+static void MorphRows(void *pContext, int pThread, int pBegin, int pEnd)
+{
+	tMorphPass *pass = (tMorphPass *)pContext;
+	int width = pass->bmp->infoHeader.width, size = pass->size, anchor = MorphAnchor(pass);
+	size_t padded = 3 * ((size_t)width + size - 1), rowBytes = 3 * (size_t)width;
+	byte *line = pass->scratch + pThread * pass->scratchBytes, *g = line + padded, *h = g + padded;
+	for (int row = pBegin; row < pEnd && !ProgressCancelled(); ++row) {
+		byte *pixel = (byte *)pass->bmp->pixel[row];
+		memset(line, 0xff, 3 * (size_t)anchor);
+		for (size_t i = 0; i < rowBytes; ++i) line[3 * anchor + i] = pixel[i] ^ pass->invert;
+		memset(line + 3 * anchor + rowBytes, 0xff, 3 * (size_t)(size - 1 - anchor));
+		MorphLine(line, width, 3, size, g, h);
+		for (size_t i = 0; i < rowBytes; ++i) pixel[i] = line[i] ^ pass->invert;
+	}
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: MorphSeparable()
+ *
+ * DESCRIPTION
+ * Erodes the image, or its complement if pInvert is 0xff, with a pWidth x pHeight element: first along the
+ * rows, then along the columns. An element longer than 2 * n - 1 for a line of n pixels covers the whole line
+ * from every pixel, as does one of exactly that length, so longer elements are shortened to it.
+ *------------------------------------------------------------------------------------------------------------*/
+static tError MorphSeparable(tBmp *pBmp, byte pInvert, int pWidth, int pHeight)
+{
+	int width = pBmp->infoHeader.width, height = pBmp->infoHeader.height;
+	tMorphPass pass;
+	pass.bmp = pBmp;
+	pass.invert = pInvert;
+	tError result = ErrorNone;
+
+	pass.size = pWidth < 2 * width - 1 ? pWidth : 2 * width - 1;
+	if (pass.size > 1) result = MorphPass(&pass, width, 3, height, cMorphMinRowsPerThread, MorphRows);
+
+	pass.size = pHeight < 2 * height - 1 ? pHeight : 2 * height - 1;
+	if (pass.size > 1 && result == ErrorNone) {
+		result = MorphPass(&pass, height, 3 * cMorphStrip, (width + cMorphStrip - 1) / cMorphStrip, 1, MorphCols);
+	}
+	return result;
+}
@@ -0,0 +1,42 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * Morphological operations with a rectangular structuring element, e.g., to clean up masks: erosion (the min
+ * of the pixels under the element), dilation (the max), opening (erosion then dilation), and closing (dilation
+ * then erosion). Each color channel is filtered separately.
+ *
+ * A rectangle is separable, so the filter is a 1D filter along the rows followed by one along the columns.
+ * Both use the van Herk/Gil-Werman algorithm, which takes 3 comparisons per pixel whatever the size of the
+ * element: the line is cut into blocks as long as the element, the running min from the start and from the end
+ * of each block are computed, and the min of a window is the min of one value of each. Dilation is erosion of
+ * the complemented image, so there is only one kernel. The column pass works on strips of columns, so it reads
+ * whole runs of each row instead of one pixel per row.
+ **************************************************************************************************************/
+#ifndef MORPH_H
+#define MORPH_H
+
+#include "Bmp.h"
+#include "Error.h"
+
+// The morphological operations.
+typedef enum {
+	MorphErode  = 0,
+	MorphDilate = 1,
+	MorphOpen   = 2,
+	MorphClose  = 3
+} tMorphOp;
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: MorphApply()
+ *
+ * DESCRIPTION
+ * Performs pOp on the image pBmp with a pWidth x pHeight structuring element, whose center is the pixel at
+ * ((pWidth - 1) / 2, (pHeight - 1) / 2) of the element. Pixels outside the image are ignored. Sizes less than
+ * 1 are taken as 1, which leaves that direction unfiltered. Returns ErrorOpMorph if memory for the filter
+ * could not be allocated, in which case the image may have been partly filtered, as it is if the job is
+ * cancelled (see Progress.h).
+ *------------------------------------------------------------------------------------------------------------*/
+tError MorphApply(tBmp *pBmp, tMorphOp pOp, int pWidth, int pHeight);
+
+#endif
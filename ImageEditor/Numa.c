@@ -0,0 +1,119 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * See comments in Numa.h.
+ **************************************************************************************************************/
+#define _GNU_SOURCE		// For cpu_set_t and pthread_setaffinity_np().
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "Numa.h"
+
+// The directory of the nodes of the host, each of which is a subdirectory nodeN with a cpulist file.
+static const char *cNumaSysDir = "/sys/devices/system/node";
+
+static cpu_set_t	sNumaAll;						// The CPUs the process may run on.
+static cpu_set_t	sNumaCpus[NUMA_NODES_MAX];		// The CPUs of each node.
+static int			sNumaNodes = 1;					// The number of nodes in effect.
+
+static bool	NumaReadCpuList(char *pPath, cpu_set_t *pCpus);
+static void	NumaReadHost();
+static void	NumaSimulate(int pNodes);
+
+bool NumaBind(int pNode)
+{
+	if (sNumaNodes < 2 || pNode < 0 || pNode >= sNumaNodes) return false;
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &sNumaCpus[pNode]) == 0;
+}
+
+void NumaInit(int pNodes)
+{
+	sNumaNodes = 1;
+	if (pNodes == NUMA_OFF || sched_getaffinity(0, sizeof(cpu_set_t), &sNumaAll) != 0) return;
+	if (pNodes == NUMA_AUTO) NumaReadHost();
+	else NumaSimulate(pNodes < NUMA_NODES_MAX ? pNodes : NUMA_NODES_MAX);
+}
+
+int NumaNodes()
+{
+	return sNumaNodes;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: NumaReadCpuList()
+ *
+ * DESCRIPTION
+ * Reads the list of CPUs in the file pPath, e.g., "0-3,8-11", into pCpus, keeping only the CPUs the process
+ * may run on. Returns false if the file could not be read or no CPU is left.
+ *------------------------------------------------------------------------------------------------------------*/
+static bool NumaReadCpuList(char *pPath, cpu_set_t *pCpus)
+{
+	FILE *list = fopen(pPath, "r");
+	if (!list) return false;
+	CPU_ZERO(pCpus);
+	int first, last;
+	char sep = ',';
+	while (sep == ',' && fscanf(list, "%d", &first) == 1) {
+		last = first;
+		if (fscanf(list, "%c", &sep) == 1 && sep == '-' && fscanf(list, "%d%c", &last, &sep) < 1) break;
+		for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+			if (CPU_ISSET(cpu, &sNumaAll)) CPU_SET(cpu, pCpus);
+		}
+	}
+	fclose(list);
+	return CPU_COUNT(pCpus) > 0;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: NumaReadHost()
+ *
+ * DESCRIPTION
+ * Reads the nodes of the host which have CPUs the process may run on. Nodes without any, e.g., memory only
+ * nodes, are skipped. Node numbers may have gaps, so the directory is listed rather than probed.
+ *------------------------------------------------------------------------------------------------------------*/
+static void NumaReadHost()
+{
+	DIR *dir = opendir(cNumaSysDir);
+	if (!dir) return;
+	struct dirent *entry;
+	int nodes = 0, node;
+	char path[512];
+	while ((entry = readdir(dir)) && nodes < NUMA_NODES_MAX) {
+		if (sscanf(entry->d_name, "node%d", &node) != 1) continue;
+		snprintf(path, sizeof(path), "%s/%s/cpulist", cNumaSysDir, entry->d_name);
+		if (NumaReadCpuList(path, &sNumaCpus[nodes])) ++nodes;
+	}
+	closedir(dir);
+	if (nodes > 0) sNumaNodes = nodes;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: NumaSimulate()
+ *
+ * DESCRIPTION
+ * Splits the CPUs of the process into pNodes simulated nodes.
+ *------------------------------------------------------------------------------------------------------------*/
+static void NumaSimulate(int pNodes)
+{
+	int cpu[CPU_SETSIZE], count = 0;
+	for (int i = 0; i < CPU_SETSIZE; ++i) {
+		if (CPU_ISSET(i, &sNumaAll)) cpu[count++] = i;
+	}
+	if (count == 0 || pNodes < 1) return;
+	for (int node = 0; node < pNodes; ++node) {
+		CPU_ZERO(&sNumaCpus[node]);
+		if (count < pNodes) CPU_SET(cpu[node % count], &sNumaCpus[node]);
+		for (int i = node * count / pNodes; count >= pNodes && i < (node + 1) * count / pNodes; ++i) {
+			CPU_SET(cpu[i], &sNumaCpus[node]);
+		}
+	}
+	sNumaNodes = pNodes;
+}
+
+void NumaUnbind()
+{
+	if (sNumaNodes > 1) pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &sNumaAll);
+}
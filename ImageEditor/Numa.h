@@ -0,0 +1,65 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * NUMA (non-uniform memory access) placement for hosts with several sockets, each with its own memory node.
+ * A thread reads memory on its own node at full bandwidth, and memory on another node at a fraction of it.
+ *
+ * The image is split into one horizontal band per node. ThreadFor() runs each chunk of a loop on a thread
+ * pinned to the CPUs of the node whose band the chunk falls in, and BmpPixelAlloc() maps a fresh, page-aligned
+ * block for the rows of each band and first touches it from such a thread, so Linux places its pages on that
+ * node. Loops over the rows of an image then only touch memory on their own node.
+ *
+ * The topology is read from /sys/devices/system/node. It can also be simulated by splitting the CPUs into a
+ * given number of nodes, e.g., to test the placement on a single node machine. With one node, or when turned
+ * off, nothing is pinned and rows are allocated as usual.
+ **************************************************************************************************************/
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <stdbool.h>
+
+// The maximum number of nodes used.
+#define NUMA_NODES_MAX 16
+
+// The arguments of NumaInit() other than a number of simulated nodes.
+#define NUMA_OFF  -1
+#define NUMA_AUTO  0
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: NumaBind()
+ *
+ * DESCRIPTION
+ * Pins the calling thread to the CPUs of node pNode. Returns false, leaving the thread as it was, if NUMA
+ * placement is not in effect or the thread could not be pinned.
+ *------------------------------------------------------------------------------------------------------------*/
+bool NumaBind(int pNode);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: NumaInit()
+ *
+ * DESCRIPTION
+ * Sets up NUMA placement: NUMA_AUTO reads the topology of the host, NUMA_OFF turns placement off, and a number
+ * of nodes from 1 to NUMA_NODES_MAX simulates that many nodes, node i having the i-th share of the CPUs (or,
+ * with fewer CPUs than nodes, CPU i mod the number of CPUs). Only the CPUs the process may run on are used.
+ * Must be called before any thread is started. Without a call, placement is off.
+ *------------------------------------------------------------------------------------------------------------*/
+void NumaInit(int pNodes);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: NumaNodes()
+ *
+ * DESCRIPTION
+ * Returns the number of nodes in effect, 1 if placement is off or the host has a single node.
+ *------------------------------------------------------------------------------------------------------------*/
+int NumaNodes();
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: NumaUnbind()
+ *
+ * DESCRIPTION
+ * Lets the calling thread, pinned by NumaBind(), run on any of the CPUs of the process again.
+ *------------------------------------------------------------------------------------------------------------*/
+void NumaUnbind();
+
+#endif
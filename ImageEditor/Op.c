@@ -0,0 +1,228 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * The operation queue: the image processing operations to be performed on an image, in order.
+ **************************************************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "Hist.h"
+#include "Image.h"
+#include "Morph.h"
+#include "Op.h"
+#include "Overlay.h"
+#include "Progress.h"
+#include "Rank.h"
+#include "Warp.h"
+
+// The fraction of the darkest and of the brightest pixels ignored by --autolevels, so that a few specks of
+// dust or glare do not limit the stretch.
+static const double cOpLevelsClip = 0.001;
+
+static char *OpPlanFile(char *pPlan, char *pFilename);
+static bool OpQueueHistAt(tOpQueue *pQueue, int pIndex);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: OpPlanFile()
+ *
+ * DESCRIPTION
+ * Writes the file an operation reads, e.g., an overlay, to the plan at pPlan, along with its size and
+ * modification time so that the plan changes when the file does. Returns the end of the plan.
+ *------------------------------------------------------------------------------------------------------------*/
+static char *OpPlanFile(char *pPlan, char *pFilename)
+{
+	struct stat fileStat;
+	if (stat(pFilename, &fileStat)) memset(&fileStat, 0, sizeof(fileStat));
+	return pPlan + sprintf(pPlan, ",%.*s@%ld@%ld.%09ld", PATH_MAX, pFilename, (long)fileStat.st_size,
+		(long)fileStat.st_mtim.tv_sec, (long)fileStat.st_mtim.tv_nsec);
+}
+
+tOp *OpQueueAdd(tOpQueue *pQueue, tOperation pOp)
+{
+	if (pQueue->index >= OP_QUEUE_MAX || pOp < OperationFlipH || pOp > OPERATION_LAST) return NULL;
+	tOp *op = &pQueue->queue[pQueue->index++];
+	memset(op, 0, sizeof(tOp));
+	op->op = pOp;
+	return op;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: OpQueueHistAt()
+ *
+ * DESCRIPTION
+ * Returns true if a histogram operation at or after pIndex will use the histogram of the image as it is
+ * before operation pIndex.
+ *------------------------------------------------------------------------------------------------------------*/
+static bool OpQueueHistAt(tOpQueue *pQueue, int pIndex)
+{
+	for (int i = pIndex; i < pQueue->index; ++i) {
+		switch (pQueue->queue[i].op) {
+			case OperationAutoLevels:
+			case OperationEqualize:
+				return true;
+			case OperationCrop:
+			case OperationMorph:
+			case OperationOverlay:
+			case OperationRank:
+			case OperationWarp:
+				return false;
+			default:
+				break;
+		}
+	}
+	return false;
+}
+
+bool OpQueueNetFlip(tOpQueue *pQueue, bool *pHoriz, bool *pVert)
+{
+	*pHoriz = *pVert = false;
+	for (int i = 0; i < pQueue->index; ++i) {
+		switch (pQueue->queue[i].op) {
+			case OperationFlipH:
+				*pHoriz = !*pHoriz;
+				break;
+			case OperationFlipV:
+				*pVert = !*pVert;
+				break;
+			case OperationRotR:
+				if (pQueue->queue[i].arg[0] % 2 != 0) return false;
+				if (pQueue->queue[i].arg[0] % 4 != 0) {
+					*pHoriz = !*pHoriz;
+					*pVert = !*pVert;
+				}
+				break;
+			default:
+				return false;
+		}
+	}
+	return true;
+}
+
+void OpQueuePlan(tOpQueue *pQueue, char *pPlan)
+{
+	// The run of flips and rotations is tracked as the 2x2 matrix mapping output coordinates to input
+	// coordinates, which is the same for every equivalent run.
+	int a = 1, b = 0, d = 0, e = 1;
+	char *plan = pPlan;
+	*plan = '\0';
+	for (int i = 0; i <= pQueue->index; ++i) {
+		tOp *op = i < pQueue->index ? &pQueue->queue[i] : NULL;
+		int p = 1, q = 0, s = 0, t = 1, n;
+		switch (op ? op->op : 0) {
+			case OperationFlipH:
+				p = -1;
+				break;
+			case OperationFlipV:
+				t = -1;
+				break;
+			case OperationRotR:
+				for (n = (op->arg[0] % 4 + 4) % 4; n > 0; --n) {
+					int a2 = -b, b2 = a, d2 = -e, e2 = d;
+					a = a2; b = b2; d = d2; e = e2;
+				}
+				break;
+			default:
+				// The run ends here. Write it out unless it amounts to nothing.
+				if (a != 1 || b != 0 || d != 0 || e != 1) plan += sprintf(plan, "d4(%d,%d,%d,%d);", a, b, d, e);
+				a = 1; b = 0; d = 0; e = 1;
+				if (op) {
+					plan += sprintf(plan, "%d(%d,%d,%d,%d", (int)op->op, op->arg[0], op->arg[1], op->arg[2],
+						op->arg[3]);
+					if (op->op == OperationWarp) {
+						for (n = 0; n < 6; ++n) plan += sprintf(plan, ",%.17g", op->coef[n]);
+					}
+					if (op->op == OperationOverlay) plan = OpPlanFile(plan, op->path);
+					plan += sprintf(plan, ");");
+				}
+				break;
+		}
+		int a2 = a * p + b * s, b2 = a * q + b * t, d2 = d * p + e * s, e2 = d * q + e * t;
+		a = a2; b = b2; d = d2; e = e2;
+	}
+}
+
+tError OpQueueRun(tOpQueue *pQueue, tBmp *pBmp, tHist *pHist)
+{
+	return OpQueueRunLut(pQueue, pBmp, pHist, NULL, NULL);
+}
+
+tError OpQueueRunLut(tOpQueue *pQueue, tBmp *pBmp, tHist *pHist, tHistLut *pLut, bool *pLutLeft)
+{
+	// The histogram of the image is kept up to date for as long as a later operation will use it.
+	tHist hist;
+	tHistLut lut;
+	tOverlay *overlay;
+	tPixel background;
+	tError result;
+	bool histValid = pHist != NULL;
+	if (pHist) hist = *pHist;
+	if (pLutLeft) *pLutLeft = false;
+
+	for (int i = 0; i < pQueue->index; ++i) {
+		int *arg = pQueue->queue[i].arg;
+		switch (pQueue->queue[i].op) {
+			case OperationFlipH:
+				ImageFlipHoriz(pBmp);
+				break;
+			case OperationFlipV:
+				ImageFlipVert(pBmp);
+				break;
+			case OperationRotR:
+				result = ImageRotRightMult(pBmp, (arg[0] % 4 + 4) % 4);
+				if (result != ErrorNone) return result;
+				break;
+			case OperationCrop:
+				result = ImageCrop(pBmp, arg[0], arg[1], arg[2], arg[3]);
+				if (result != ErrorNone) return result;
+				histValid = false;
+				break;
+			case OperationAutoLevels:
+			case OperationEqualize:
+				if (!histValid) HistCompute(pBmp, &hist);
+				if (pQueue->queue[i].op == OperationAutoLevels) HistLevels(&hist, cOpLevelsClip, &lut);
+				else HistEqualize(&hist, &lut);
+				if (pLut && i == pQueue->index - 1) {
+					*pLut = lut;
+					*pLutLeft = true;
+					break;
+				}
+				histValid = OpQueueHistAt(pQueue, i+1);
+				HistApply(pBmp, &lut, histValid ? &hist : NULL);
+				break;
+			case OperationMorph:
+				result = MorphApply(pBmp, (tMorphOp)arg[0], arg[1], arg[2]);
+				if (result != ErrorNone) return result;
+				histValid = false;
+				break;
+			case OperationOverlay:
+				if (OverlayGet(pQueue->queue[i].path, &overlay) != ErrorNone) return ErrorOpOverlay;
+				OverlayApply(pBmp, overlay, arg[0], arg[1], arg[2]);
+				OverlayRelease(overlay);
+				histValid = false;
+				break;
+			case OperationRank:
+				result = RankFilter(pBmp, arg[0], arg[1]);
+				if (result != ErrorNone) return result;
+				histValid = false;
+				break;
+			case OperationWarp:
+				background.red = (byte)(arg[1] >> 16);
+				background.green = (byte)(arg[1] >> 8);
+				background.blue = (byte)arg[1];
+				result = WarpAffine(pBmp, pQueue->queue[i].coef, (tWarpInterp)arg[0], background);
+				if (result != ErrorNone) return result;
+				histValid = false;
+				break;
+		}
+
+		// Besides the checkpoints within the kernels of Image.c, the job is checked between operations.
+		if (ProgressCancelled()) return ErrorCancelled;
+	}
+	return ErrorNone;
+}
+
+bool OpQueueWantsHist(tOpQueue *pQueue)
+{
+	return OpQueueHistAt(pQueue, 0);
+}
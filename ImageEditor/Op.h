@@ -0,0 +1,125 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * The operation queue: the image processing operations to be performed on an image, in order.
+ **************************************************************************************************************/
+#ifndef OP_H
+#define OP_H
+
+#include <limits.h>
+#include <stdbool.h>
+#include "Bmp.h"
+#include "Error.h"
+#include "Hist.h"
+
+// The maximum number of operations in an operation queue.
+#define OP_QUEUE_MAX 32
+
+// The maximum length of the string written by OpQueuePlan(), including the null terminator.
+#define OP_PLAN_MAX (OP_QUEUE_MAX * (256 + PATH_MAX))
+
+// Enumerated type for the operations to be performed in the operation queue.
+typedef enum {
+	OperationFlipH      = 1,
+	OperationFlipV      = 2,
+	OperationRotR       = 3,
+	OperationCrop       = 4,
+	OperationAutoLevels = 5,
+	OperationEqualize   = 6,
+	OperationWarp       = 7,
+	OperationOverlay    = 8,
+	OperationMorph      = 9,
+	OperationRank       = 10
+} tOperation;
+
+// The last valid tOperation value.
+#define OPERATION_LAST OperationRank
+
+// One operation and its arguments, e.g., n following --rotr is arg[0] and x,y,w,h following --crop are
+// arg[0..3]. A warp has the affine transform a..f in coef[0..5], the tWarpInterp in arg[0], and the
+// background color 0xRRGGBB in arg[1]. An overlay has the file name in path, its position x,y in arg[0..1]
+// and its opacity (0 to 255) in arg[2]. A morphological operation has the tMorphOp in arg[0] and the width and
+// height of the structuring element in arg[1..2]. A rank filter has the radius in arg[0] and the percentile
+// in arg[1]. Unused arguments are zero.
+typedef struct {
+	tOperation	op;
+	int			arg[4];
+	double		coef[6];
+	char		*path;
+} tOp;
+
+// The operation queue. Stores the operations to be performed in the order they were encountered on the
+// command line (or in a request to the server).
+typedef struct {
+	int 		index;
+	tOp			queue[OP_QUEUE_MAX];
+} tOpQueue;
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: OpQueueAdd()
+ *
+ * DESCRIPTION
+ * Appends the operation pOp, with all arguments zero, to the queue and returns a pointer to it so the
+ * arguments can be filled in. Returns NULL if the queue is full or pOp is not a valid operation.
+ *------------------------------------------------------------------------------------------------------------*/
+tOp *OpQueueAdd(tOpQueue *pQueue, tOperation pOp);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: OpQueueNetFlip()
+ *
+ * DESCRIPTION
+ * Flips and 180 deg rotations do not change the dimensions of the image, so any sequence of them is the same
+ * as flipping horizontally, vertically, both, or neither. If every operation in the queue is one of these,
+ * the net flip is stored in pHoriz and pVert and true is returned. Otherwise, false is returned.
+ *------------------------------------------------------------------------------------------------------------*/
+bool OpQueueNetFlip(tOpQueue *pQueue, bool *pHoriz, bool *pVert);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: OpQueuePlan()
+ *
+ * DESCRIPTION
+ * Writes the normalized plan of the queue to pPlan, a string which is the same for any two queues that always
+ * produce the same image. Each run of consecutive flips and rotations is composed into the one transform of
+ * the square it amounts to (e.g., --fliph --flipv and --rotr 2 are both a 180 deg rotation, and --rotr 4 is
+ * nothing at all), and the other operations are written with their arguments. pPlan must be at least
+ * OP_PLAN_MAX chars.
+ *------------------------------------------------------------------------------------------------------------*/
+void OpQueuePlan(tOpQueue *pQueue, char *pPlan);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: OpQueueRun()
+ *
+ * DESCRIPTION
+ * Performs the operations in the queue on the image pBmp in the order in which they were added. pHist is the
+ * histogram of pBmp if it is already known (see OpQueueWantsHist()), or NULL. Returns ErrorOpCrop if a crop
+ * rectangle does not overlap the image, ErrorOpWarp if a warp is not invertible or its result too large,
+ * ErrorOpOverlay if an overlay cannot be read, ErrorOpMemory if a crop or rotation runs out of memory, leaving
+ * the image as the previous operation left it, or ErrorCancelled, leaving the image in an unspecified state, if
+ * the job is cancelled (see Progress.h).
+ *------------------------------------------------------------------------------------------------------------*/
+tError OpQueueRun(tOpQueue *pQueue, tBmp *pBmp, tHist *pHist);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: OpQueueRunLut()
+ *
+ * DESCRIPTION
+ * Same as OpQueueRun(), but if the last operation is a histogram operation (--autolevels, --equalize), its LUT
+ * is stored in pLut instead of being applied to the image, and true is stored in pLutLeft. The caller can then
+ * apply the LUT in its own pass over the pixels, e.g., while converting them with ColorConvert(). Otherwise,
+ * false is stored in pLutLeft.
+ *------------------------------------------------------------------------------------------------------------*/
+tError OpQueueRunLut(tOpQueue *pQueue, tBmp *pBmp, tHist *pHist, tHistLut *pLut, bool *pLutLeft);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: OpQueueWantsHist()
+ *
+ * DESCRIPTION
+ * Returns true if the histogram of the input image would be used by OpQueueRun(), i.e., if the queue contains
+ * a histogram operation (--autolevels, --equalize) which is not preceded by a crop, warp, or overlay. Flips
+ * and rotations do not change the histogram. If so, the caller should compute the histogram while reading
+ * the image.
+ *------------------------------------------------------------------------------------------------------------*/
+bool OpQueueWantsHist(tOpQueue *pQueue);
+
+#endif
@@ -0,0 +1,392 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * See comments in Overlay.h.
+ **************************************************************************************************************/
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "File.h"
+#include "Overlay.h"
+#include "Thread.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#endif
+
+// BMP compression values which may occur in an overlay.
+static const uint32_t cOverlayBiRgb            = 0;
+static const uint32_t cOverlayBiBitfields      = 3;
+static const uint32_t cOverlayBiAlphaBitfields = 6;
+
+// The decoded overlays kept in the cache take at most this many bytes.
+static const size_t cOverlayCacheBytes = (size_t)64 << 20;
+
+// Rows are divided among threads in chunks of at least this many pixels.
+static const int cOverlayMinPixelsPerThread = 1 << 16;
+
+#ifdef __SSE2__
+// The pshufb masks which spread 4 BGR pixels to 4 BGRx pixels with x = 0, and pack them back.
+static const int8_t cOverlayExpand[16] = { 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1 };
+static const int8_t cOverlayPack[16]   = { 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1 };
+#endif
+
+// The decoded overlays, most recently used first.
+static pthread_mutex_t sOverlayLock = PTHREAD_MUTEX_INITIALIZER;
+static tOverlay *sOverlayCache = NULL;
+
+// An OverlayApply() in progress, shared by the threads. (x0, y0) - (x1, y1) is the part of the image covered
+// by the overlay.
+typedef struct {
+	tBmp		*bmp;
+	int			opacity;
+	tOverlay	*overlay;
+	int			x, y;
+	int			x0, x1, y0;
+} tOverlayJob;
+
+static byte		OverlayDiv255(int pValue);
+#ifdef __SSE2__
+static __m128i	OverlayDiv255Sse2(__m128i pValue);
+#endif
+static void		OverlayFree(tOverlay *pOverlay);
+static tError	OverlayLoad(char *pFilename, struct stat *pStat, tOverlay **pOverlay);
+static bool		OverlayMaskShift(uint32_t pMask, int *pShift);
+static void		OverlayRows(void *pJob, int pThread, int pBegin, int pEnd);
+#ifdef __SSE2__
+static int		OverlayRowSsse3(byte *pDst, const byte *pSrc, int pWidth, int pOpacity)
+					__attribute__((target("ssse3")));
+#endif
+static uint32_t	OverlayU32(byte *pData);
+
+void OverlayApply(tBmp *pBmp, tOverlay *pOverlay, int pX, int pY, int pOpacity)
+{
+	// Clip the overlay to the image. Only the rows it covers are visited.
+	long x0 = pX > 0 ? pX : 0, y0 = pY > 0 ? pY : 0;
+	long x1 = (long)pX + pOverlay->width, y1 = (long)pY + pOverlay->height;
+	if (x1 > pBmp->infoHeader.width) x1 = pBmp->infoHeader.width;
+	if (y1 > pBmp->infoHeader.height) y1 = pBmp->infoHeader.height;
+	if (x0 >= x1 || y0 >= y1 || pOpacity <= 0) return;
+
+	tOverlayJob job;
+	job.bmp = pBmp;
+	job.opacity = pOpacity < 255 ? pOpacity : 255;
+	job.overlay = pOverlay;
+	job.x = pX;
+	job.y = pY;
+	job.x0 = (int)x0;
+	job.x1 = (int)x1;
+	job.y0 = (int)y0;
+	ThreadFor((int)(y1 - y0), cOverlayMinPixelsPerThread / (int)(x1 - x0), OverlayRows, &job);
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: OverlayDiv255()
+ *
+ * DESCRIPTION
+ * Returns pValue / 255 rounded to the nearest integer, for 0 <= pValue <= 255 * 255, without dividing.
+ *------------------------------------------------------------------------------------------------------------*/
+static byte OverlayDiv255(int pValue)
+{
+	pValue += 128;
+	return (byte)((pValue + (pValue >> 8)) >> 8);
+}
+
+#ifdef __SSE2__
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: OverlayDiv255Sse2()
+ *
+ * DESCRIPTION
+ * OverlayDiv255() of each of the eight 16-bit lanes of pValue.
+ *------------------------------------------------------------------------------------------------------------*/
+static __m128i OverlayDiv255Sse2(__m128i pValue)
+{
+	pValue = _mm_add_epi16(pValue, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(pValue, _mm_srli_epi16(pValue, 8)), 8);
+}
+#endif
+
+static void OverlayFree(tOverlay *pOverlay)
+{
+	free(pOverlay->path);
+	free(pOverlay->pixel);
+	free(pOverlay);
+}
+
+tError OverlayGet(char *pFilename, tOverlay **pOverlay)
+{
+	struct stat fileStat;
+	if (stat(pFilename, &fileStat)) return ErrorFileOpen;
+
+	// On a hit, the overlay is moved to the front of the cache, which is kept in order of use.
+	pthread_mutex_lock(&sOverlayLock);
+	for (tOverlay **link = &sOverlayCache; *link; link = &(*link)->next) {
+		tOverlay *overlay = *link;
+		if (strcmp(overlay->path, pFilename) == 0 && overlay->size == fileStat.st_size &&
+			overlay->mtime == fileStat.st_mtim.tv_sec && overlay->mtimeNs == fileStat.st_mtim.tv_nsec) {
+			*link = overlay->next;
+			overlay->next = sOverlayCache;
+			sOverlayCache = overlay;
+			++overlay->refs;
+			*pOverlay = overlay;
+			pthread_mutex_unlock(&sOverlayLock);
+			return ErrorNone;
+		}
+	}
+	pthread_mutex_unlock(&sOverlayLock);
+
+	// Decode the overlay without holding the lock, so other requests are not held up.
+	tOverlay *overlay;
+	tError result = OverlayLoad(pFilename, &fileStat, &overlay);
+	if (result != ErrorNone) return result;
+	overlay->refs = 2;
+
+	// Replace any older copy of the overlay in the cache. It is freed once its last user releases it.
+	pthread_mutex_lock(&sOverlayLock);
+	tOverlay **link = &sOverlayCache;
+	while (*link) {
+		tOverlay *old = *link;
+		if (strcmp(old->path, pFilename) == 0) {
+			*link = old->next;
+			if (--old->refs == 0) OverlayFree(old);
+		} else {
+			link = &old->next;
+		}
+	}
+	overlay->next = sOverlayCache;
+	sOverlayCache = overlay;
+
+	// Evict the least recently used overlays which do not fit in the cache after the more recently used ones.
+	// The new overlay is kept even if it is larger than the whole cache.
+	size_t bytes = 0;
+	link = &sOverlayCache;
+	while (*link) {
+		tOverlay *old = *link;
+		size_t oldBytes = (size_t)old->width * old->height * 4;
+		if (old != overlay && bytes + oldBytes > cOverlayCacheBytes) {
+			*link = old->next;
+			if (--old->refs == 0) OverlayFree(old);
+		} else {
+			bytes += oldBytes;
+			link = &old->next;
+		}
+	}
+	pthread_mutex_unlock(&sOverlayLock);
+
+	*pOverlay = overlay;
+	return ErrorNone;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: OverlayLoad()
+ *
+ * DESCRIPTION
+ * Decodes the overlay in the file pFilename, whose status is pStat, into a newly allocated tOverlay. Supports
+ * 24-bit and 32-bit uncompressed BMP images with any header version, stored bottom-up or top-down, and
+ * 32-bit images whose channel masks are whole bytes.
+ *------------------------------------------------------------------------------------------------------------*/
+static tError OverlayLoad(char *pFilename, struct stat *pStat, tOverlay **pOverlay)
+{
+	size_t fileSize = (size_t)pStat->st_size;
+	if (fileSize < 54) return ErrorBmpInv;
+	byte *data = (byte *)malloc(fileSize);
+	if (!data) return ErrorFileRead;
+	FILE *stream = FileOpen(pFilename, "rb");
+	if (!stream) {
+		free(data);
+		return ErrorFileOpen;
+	}
+	int readResult = FileRead(stream, data, fileSize, 1);
+	FileClose(stream);
+	if (readResult != 0) {
+		free(data);
+		return ErrorFileRead;
+	}
+
+	// Validate the headers.
+	uint32_t pixelOffset = OverlayU32(&data[10]), infoSize = OverlayU32(&data[14]);
+	int32_t width = (int32_t)OverlayU32(&data[18]), height = (int32_t)OverlayU32(&data[22]);
+	int bpp = data[28] | data[29] << 8;
+	uint32_t compression = OverlayU32(&data[30]);
+	bool topDown = height < 0;
+	if (topDown) height = -height;
+	bool valid = data[0] == 'B' && data[1] == 'M' && infoSize >= 40 && width > 0 && height > 0 &&
+		(bpp == 24 || bpp == 32);
+
+	// The default masks of a 32-bit image are BGRA. With bitfields, the masks follow the 40-byte header, which
+	// is also where they are in the larger headers. Only the larger headers have an alpha mask.
+	uint32_t mask[4] = { 0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000 };
+	int shift[4];
+	if (valid && bpp == 32 && (compression == cOverlayBiBitfields || compression == cOverlayBiAlphaBitfields)) {
+		valid = fileSize >= 70;
+		if (valid) {
+			mask[2] = OverlayU32(&data[54]);
+			mask[1] = OverlayU32(&data[58]);
+			mask[0] = OverlayU32(&data[62]);
+			bool hasAlpha = infoSize >= 56 || compression == cOverlayBiAlphaBitfields;
+			mask[3] = hasAlpha ? OverlayU32(&data[66]) : 0;
+		}
+	} else if (compression != cOverlayBiRgb) {
+		valid = false;
+	}
+	for (int ch = 0; ch < 4 && valid; ++ch) {
+		valid = OverlayMaskShift(mask[ch], &shift[ch]) || (ch == 3 && !mask[3]);
+	}
+
+	size_t rowBytes = ((size_t)width * bpp / 8 + 3) & ~(size_t)3;
+	if (valid && (pixelOffset > fileSize || (fileSize - pixelOffset) / rowBytes < (size_t)height)) valid = false;
+	tOverlay *overlay = valid ? (tOverlay *)calloc(1, sizeof(tOverlay)) : NULL;
+	if (overlay) {
+		overlay->pixel = (byte *)malloc((size_t)width * height * 4);
+		overlay->path = (char *)malloc(strlen(pFilename) + 1);
+	}
+	if (!overlay || !overlay->pixel || !overlay->path) {
+		if (overlay) OverlayFree(overlay);
+		free(data);
+		return valid ? ErrorFileRead : ErrorBmpInv;
+	}
+
+	// Many tools write 32-bit images without alpha as BI_RGB with the fourth byte zero. Those are opaque.
+	if (bpp == 32 && compression == cOverlayBiRgb) {
+		bool anyAlpha = false;
+		for (int y = 0; y < height && !anyAlpha; ++y) {
+			byte *src = data + pixelOffset + (size_t)y * rowBytes;
+			for (int x = 0; x < width && !anyAlpha; ++x) anyAlpha = src[4 * x + 3] != 0;
+		}
+		if (!anyAlpha) mask[3] = 0;
+	}
+
+	// Decode and premultiply, top row first. In a 24-bit overlay, the key color is transparent.
+	for (int y = 0; y < height; ++y) {
+		byte *src = data + pixelOffset + (size_t)(topDown ? y : height-1 - y) * rowBytes;
+		byte *dst = overlay->pixel + (size_t)y * width * 4;
+		for (int x = 0; x < width; ++x, dst += 4) {
+			int c[4];
+			if (bpp == 24) {
+				c[0] = src[3 * x];
+				c[1] = src[3 * x + 1];
+				c[2] = src[3 * x + 2];
+				c[3] = (c[0] == 255 && c[1] == 0 && c[2] == 255) ? 0 : 255;
+			} else {
+				uint32_t value = OverlayU32(&src[4 * x]);
+				for (int ch = 0; ch < 4; ++ch) c[ch] = mask[ch] ? (int)((value & mask[ch]) >> shift[ch]) : 255;
+			}
+			for (int ch = 0; ch < 3; ++ch) dst[ch] = OverlayDiv255(c[ch] * c[3]);
+			dst[3] = (byte)c[3];
+		}
+	}
+	free(data);
+
+	strcpy(overlay->path, pFilename);
+	overlay->width = width;
+	overlay->height = height;
+	overlay->size = pStat->st_size;
+	overlay->mtime = pStat->st_mtim.tv_sec;
+	overlay->mtimeNs = pStat->st_mtim.tv_nsec;
+	*pOverlay = overlay;
+	return ErrorNone;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: OverlayMaskShift()
+ *
+ * DESCRIPTION
+ * Returns true if pMask is eight contiguous bits, storing the position of its lowest bit in pShift.
+ *------------------------------------------------------------------------------------------------------------*/
+static bool OverlayMaskShift(uint32_t pMask, int *pShift)
+{
+	for (int shift = 0; shift <= 24; shift += 8) {
+		if (pMask == (uint32_t)0xff << shift) {
+			*pShift = shift;
+			return true;
+		}
+	}
+	return false;
+}
+
+void OverlayRelease(tOverlay *pOverlay)
+{
+	pthread_mutex_lock(&sOverlayLock);
+	if (--pOverlay->refs == 0) OverlayFree(pOverlay);
+	pthread_mutex_unlock(&sOverlayLock);
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: OverlayRows()
+ *
+ * DESCRIPTION
+ * The body of the parallel loop over the rows covered by the overlay. With premultiplied colors, compositing
+ * is out = overlay * opacity + image * (1 - alpha * opacity), in 8-bit fixed point.
+ *------------------------------------------------------------------------------------------------------------*/
+static void OverlayRows(void *pJob, int pThread, int pBegin, int pEnd)
+{
+	tOverlayJob *job = (tOverlayJob *)pJob;
+	tOverlay *overlay = job->overlay;
+	int width = job->x1 - job->x0, opacity = job->opacity;
+
+	for (int row = pBegin; row < pEnd; ++row) {
+		int y = job->y0 + row;
+		tPixel *dst = &job->bmp->pixel[y][job->x0];
+		byte *src = overlay->pixel + ((size_t)(y - job->y) * overlay->width + (job->x0 - job->x)) * 4;
+		int x = 0;
+#ifdef __SSE2__
+		if (__builtin_cpu_supports("ssse3")) x = OverlayRowSsse3((byte *)dst, src, width, opacity);
+		src += 4 * x;
+#endif
+		for (; x < width; ++x, src += 4) {
+			int alpha = OverlayDiv255(src[3] * opacity);
+			if (alpha == 0) continue;
+			int keep = 255 - alpha;
+			dst[x].blue = OverlayDiv255(src[0] * opacity) + OverlayDiv255(dst[x].blue * keep);
+			dst[x].green = OverlayDiv255(src[1] * opacity) + OverlayDiv255(dst[x].green * keep);
+			dst[x].red = OverlayDiv255(src[2] * opacity) + OverlayDiv255(dst[x].red * keep);
+		}
+	}
+}
+
+#ifdef __SSE2__
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: OverlayRowSsse3()
+ *
+ * DESCRIPTION
+ * Does the work of OverlayRows() for one row of pWidth pixels pDst and the overlay pixels pSrc, 4 pixels at a
+ * time, and returns the number of pixels done. The 12 bytes of 4 image pixels are spread to 16 with pshufb so
+ * that they line up with the overlay pixels, and the products are 16-bit. The pixels which are not covered
+ * are not skipped, as blending them leaves them as they are. As 16 bytes of the image are loaded, the last 2
+ * pixels of the row are left to the caller.
+ *------------------------------------------------------------------------------------------------------------*/
+static int OverlayRowSsse3(byte *pDst, const byte *pSrc, int pWidth, int pOpacity)
+{
+	__m128i expand = _mm_loadu_si128((const __m128i *)cOverlayExpand);
+	__m128i pack = _mm_loadu_si128((const __m128i *)cOverlayPack);
+	__m128i opacity = _mm_set1_epi16((short)pOpacity), full = _mm_set1_epi16(255), zero = _mm_setzero_si128();
+
+	int x = 0;
+	for (; x + 6 <= pWidth; x += 4) {
+		__m128i src = _mm_loadu_si128((const __m128i *)(pSrc + 4 * x));
+		__m128i dst = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(pDst + 3 * x)), expand);
+		__m128i out[2];
+		for (int i = 0; i < 2; ++i) {
+			__m128i src16 = i ? _mm_unpackhi_epi8(src, zero) : _mm_unpacklo_epi8(src, zero);
+			__m128i dst16 = i ? _mm_unpackhi_epi8(dst, zero) : _mm_unpacklo_epi8(dst, zero);
+			__m128i color = OverlayDiv255Sse2(_mm_mullo_epi16(src16, opacity));
+			__m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(color, 0xff), 0xff);
+			__m128i keep = _mm_sub_epi16(full, alpha);
+			out[i] = _mm_add_epi16(color, OverlayDiv255Sse2(_mm_mullo_epi16(dst16, keep)));
+		}
+		__m128i result = _mm_shuffle_epi8(_mm_packus_epi16(out[0], out[1]), pack);
+		_mm_storel_epi64((__m128i *)(pDst + 3 * x), result);
+		uint32_t last = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(result, 8));
+		memcpy(pDst + 3 * x + 8, &last, sizeof(last));
+	}
+	return x;
+}
+#endif
+
+static uint32_t OverlayU32(byte *pData)
+{
+	return (uint32_t)pData[0] | (uint32_t)pData[1] << 8 | (uint32_t)pData[2] << 16 | (uint32_t)pData[3] << 24;
+}
@@ -0,0 +1,62 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * Overlays, e.g., a watermark or logo, composited onto an image with --overlay. An overlay is a 32-bit BMP
+ * image with an alpha channel, or a 24-bit BMP image where the key color magenta (255, 0, 255) is transparent.
+ *
+ * An overlay is decoded and premultiplied by its alpha once, then kept in a process wide cache keyed by its
+ * path, so a batch of requests to the server which stamp the same overlay share one decoded copy. A cached
+ * overlay is reloaded if its file is modified. The cache holds at most 64 MB of decoded overlays, evicting the
+ * least recently used ones first. Compositing uses 8-bit fixed point arithmetic, 4 pixels at a time with
+ * SSSE3 if the processor has it, and only touches the rows of the image which the overlay covers.
+ **************************************************************************************************************/
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+#include <sys/types.h>
+#include <time.h>
+#include "Bmp.h"
+#include "Error.h"
+
+// A decoded overlay.
+typedef struct tOverlay {
+	int				height;
+	time_t			mtime;		// The modification time and size of the file when it was decoded.
+	long			mtimeNs;
+	struct tOverlay	*next;		// The next overlay in the cache.
+	char			*path;
+	byte			*pixel;		// width x height premultiplied BGRA pixels, top row first.
+	int				refs;		// The number of users of the overlay, including the cache if it is current.
+	off_t			size;
+	int				width;
+} tOverlay;
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: OverlayApply()
+ *
+ * DESCRIPTION
+ * Composites pOverlay onto pBmp with its upper left corner at (pX, pY), which may be outside the image, and
+ * its alpha scaled by pOpacity (0 to 255).
+ *------------------------------------------------------------------------------------------------------------*/
+void OverlayApply(tBmp *pBmp, tOverlay *pOverlay, int pX, int pY, int pOpacity);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: OverlayGet()
+ *
+ * DESCRIPTION
+ * Returns in pOverlay the decoded overlay in the file pFilename, from the cache if it is there and the file
+ * has not changed. The overlay must be released with OverlayRelease(). Returns ErrorFileOpen or ErrorFileRead
+ * if the file cannot be read, or ErrorBmpInv if it is not a supported BMP image.
+ *------------------------------------------------------------------------------------------------------------*/
+tError OverlayGet(char *pFilename, tOverlay **pOverlay);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: OverlayRelease()
+ *
+ * DESCRIPTION
+ * Releases an overlay returned by OverlayGet().
+ *------------------------------------------------------------------------------------------------------------*/
+void OverlayRelease(tOverlay *pOverlay);
+
+#endif
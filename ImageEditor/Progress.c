@@ -0,0 +1,96 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * See comments in Progress.h.
+ **************************************************************************************************************/
+#include <signal.h>
+#include <stdio.h>
+#include <time.h>
+#include "Main.h"
+#include "Progress.h"
+
+// The progress of a stage is displayed at most this often, in ms.
+static const long long cProgressIntervalMs = 1000;
+
+// The job being tracked.
+typedef struct {
+	volatile sig_atomic_t	cancelled;	// The deadline has passed. Set by any thread.
+	long long	deadline;		// The time at which the job is cancelled, in ms, or 0 for no deadline.
+	long		done;			// The number of units of the stage completed.
+	bool		on;				// ProgressInit() was called.
+	bool		report;			// Progress is displayed on stderr.
+	long long	reported;		// The time at which progress was last displayed, in ms.
+	char		*stage;			// The name of the stage.
+	long		total;			// The number of units of the stage.
+	char		*unit;			// The name of the units.
+} tProgress;
+
+static tProgress sProgress;
+
+static long long	ProgressNowMs();
+static void			ProgressReport();
+
+void ProgressBegin(char *pStage, long pTotal, char *pUnit)
+{
+	if (!sProgress.on) return;
+	sProgress.stage = pStage;
+	sProgress.total = pTotal;
+	sProgress.unit = pUnit;
+	sProgress.done = 0;
+	sProgress.reported = ProgressNowMs();
+}
+
+bool ProgressCancelled()
+{
+	if (!sProgress.on || sProgress.deadline == 0) return false;
+	if (!sProgress.cancelled && ProgressNowMs() >= sProgress.deadline) sProgress.cancelled = true;
+	return sProgress.cancelled;
+}
+
+void ProgressInit(long pDeadlineMs, bool pReport)
+{
+	sProgress.on = true;
+	sProgress.report = pReport;
+	sProgress.deadline = pDeadlineMs > 0 ? ProgressNowMs() + pDeadlineMs : 0;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ProgressNowMs()
+ *
+ * DESCRIPTION
+ * Returns the time of a monotonic clock in ms.
+ *------------------------------------------------------------------------------------------------------------*/
+static long long ProgressNowMs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ProgressReport()
+ *
+ * DESCRIPTION
+ * Displays the progress of the current stage on stderr.
+ *------------------------------------------------------------------------------------------------------------*/
+static void ProgressReport()
+{
+	int percent = sProgress.total > 0 ? (int)(100 * (long long)sProgress.done / sProgress.total) : 100;
+	fprintf(stderr, "%s: %s: %ld of %ld %s (%d%%)\n", cBinary, sProgress.stage, sProgress.done, sProgress.total,
+		sProgress.unit, percent);
+}
+
+bool ProgressStep(long pCount)
+{
+	if (!sProgress.on) return true;
+	sProgress.done += pCount;
+	if (sProgress.report) {
+		long long now = ProgressNowMs();
+		if (sProgress.done >= sProgress.total || now - sProgress.reported >= cProgressIntervalMs) {
+			ProgressReport();
+			sProgress.reported = now;
+		}
+	}
+	return !ProgressCancelled();
+}
@@ -0,0 +1,57 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * Progress reporting and cancellation of the job given on the command line. The long loops of a job, i.e.,
+ * the read and write loops in Bmp.c, the kernels in Image.c, and the tile loop in Tile.c, begin a stage with
+ * the number of units it has (rows, columns, or tiles) and count them off as they complete them. Each count
+ * is also a checkpoint: once the job's deadline has passed, the loop stops early and its caller returns
+ * ErrorCancelled. The rank, morphology, and warp kernels also stop at their next row, strip, or tile, and the
+ * other operations are checked between one operation and the next. Output files are written to a temporary
+ * file which only replaces the file when it is complete, so a cancelled job leaves no output.
+ *
+ * Nothing is tracked until ProgressInit() is called, so the server, whose worker threads share the read and
+ * write functions, is not affected. ProgressBegin() and ProgressStep() are only called by one thread at a time,
+ * but ProgressCancelled() may be called by any thread, e.g., by the threads of a ThreadFor() loop.
+ **************************************************************************************************************/
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <stdbool.h>
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ProgressBegin()
+ *
+ * DESCRIPTION
+ * Begins the stage pStage, e.g., "read", of pTotal units named pUnit, e.g., "rows".
+ *------------------------------------------------------------------------------------------------------------*/
+void ProgressBegin(char *pStage, long pTotal, char *pUnit);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ProgressCancelled()
+ *
+ * DESCRIPTION
+ * Returns true if the job is to be cancelled because its deadline has passed.
+ *------------------------------------------------------------------------------------------------------------*/
+bool ProgressCancelled();
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ProgressInit()
+ *
+ * DESCRIPTION
+ * Starts tracking the job. If pDeadlineMs is greater than 0, the job is cancelled pDeadlineMs ms from now. If
+ * pReport is true, the progress of each stage is displayed on stderr about once a second, and when the stage
+ * is complete.
+ *------------------------------------------------------------------------------------------------------------*/
+void ProgressInit(long pDeadlineMs, bool pReport);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ProgressStep()
+ *
+ * DESCRIPTION
+ * Counts pCount more units of the current stage as complete. Returns false if the job is to be cancelled, in
+ * which case the loop should stop.
+ *------------------------------------------------------------------------------------------------------------*/
+bool ProgressStep(long pCount);
+
+#endif
@@ -0,0 +1,294 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * See comments in Pyramid.h.
+ **************************************************************************************************************/
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "Bmp.h"
+#include "File.h"
+#include "Pyramid.h"
+#include "Thread.h"
+#include "Tune.h"
+
+// The maximum number of levels. An image at most 2^31 pixels wide is halved down to 1 x 1 in 31 steps.
+#define PYRAMID_LEVELS_MAX 32
+
+// Note: This constant is declared in Pyramid.h.
+const int cPyramidTileDefault = 256;
+
+// Writing a tile is mostly I/O, so a thread is worth starting for a couple of tiles.
+static const int cPyramidMinTilesPerThread = 2;
+
+// A level of the pyramid.
+typedef struct {
+	tPixel	*band;		// The row of tiles being filled: tileSize rows of width pixels.
+	int		height;		// The height of the level in pixels.
+	int		name;		// The number of the level in the names of the output files.
+	int		rows;		// The number of rows of the level produced so far.
+	int		width;		// The width of the level in pixels.
+} tPyramidLevel;
+
+// The state of a pyramid being written.
+typedef struct {
+	bool			failed[THREAD_MAX];			// failed[i] is set if thread i could not write a tile.
+	tPyramidLevel	*flushing;					// The level whose band of tiles is being written.
+	tPyramidLayout	layout;						// The layout of the output directory.
+	tPyramidLevel	level[PYRAMID_LEVELS_MAX];	// The levels, level[0] being the image.
+	int				levels;						// The number of levels.
+	char			name[FILENAME_MAX];			// The name of the image without extension, for PyramidDzi.
+	char			*outDir;					// The output directory.
+	int				tileSize;					// The width and height of the tiles in pixels.
+} tPyramid;
+
+static void		PyramidAddRow(tPyramid *pPyramid, int pLevel);
+static bool		PyramidDirs(tPyramid *pPyramid);
+static void		PyramidHalve(tPixel *pTop, tPixel *pBottom, int pWidth, tPixel *pOut);
+static bool		PyramidMkdir(char *pPath);
+static tPixel	*PyramidNextRow(tPyramid *pPyramid, int pLevel);
+static bool		PyramidTilePath(tPyramid *pPyramid, tPyramidLevel *pLevel, int pTx, int pTy, char *pPath);
+static void		PyramidTiles(void *pContext, int pThread, int pBegin, int pEnd);
+static bool		PyramidWriteDzi(tPyramid *pPyramid);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: PyramidAddRow()
+ *
+ * DESCRIPTION
+ * Called when the next row of level pLevel has been stored at PyramidNextRow(). Once it completes a pair of
+ * rows (or is the last, unpaired, row), the pair is averaged into the next row of the next level. Once it
+ * completes a row of tiles (or is the last row), the tiles are written.
+ *------------------------------------------------------------------------------------------------------------*/
+static void PyramidAddRow(tPyramid *pPyramid, int pLevel)
+{
+	tPyramidLevel *level = &pPyramid->level[pLevel];
+	int size = pPyramid->tileSize, y = level->rows++;
+	bool last = level->rows == level->height;
+
+	// The tile size is even, so both rows of a pair are always in the band.
+	if (pLevel + 1 < pPyramid->levels && (y % 2 == 1 || last)) {
+		tPixel *top = level->band + (size_t)((y - y % 2) % size) * level->width;
+		tPixel *bottom = level->band + (size_t)(y % size) * level->width;
+		PyramidHalve(top, bottom, level->width, PyramidNextRow(pPyramid, pLevel + 1));
+		PyramidAddRow(pPyramid, pLevel + 1);
+	}
+
+	if (level->rows % size == 0 || last) {
+		pPyramid->flushing = level;
+		ThreadFor((level->width + size - 1) / size, cPyramidMinTilesPerThread, PyramidTiles, pPyramid);
+	}
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: PyramidDirs()
+ *
+ * DESCRIPTION
+ * Creates the output directory and the directories the tiles are written to. Returns false on failure.
+ *------------------------------------------------------------------------------------------------------------*/
+static bool PyramidDirs(tPyramid *pPyramid)
+{
+	char path[PATH_MAX];
+	if (!PyramidMkdir(pPyramid->outDir)) return false;
+	if (pPyramid->layout == PyramidDzi) {
+		if (snprintf(path, sizeof(path), "%s/%s_files", pPyramid->outDir, pPyramid->name) >= (int)sizeof(path) ||
+			!PyramidMkdir(path)) return false;
+	}
+	for (int i = 0; i < pPyramid->levels; ++i) {
+		tPyramidLevel *level = &pPyramid->level[i];
+		if (pPyramid->layout == PyramidDzi) {
+			if (snprintf(path, sizeof(path), "%s/%s_files/%d", pPyramid->outDir, pPyramid->name, level->name) >=
+				(int)sizeof(path) || !PyramidMkdir(path)) return false;
+			continue;
+		}
+		if (snprintf(path, sizeof(path), "%s/%d", pPyramid->outDir, level->name) >= (int)sizeof(path) ||
+			!PyramidMkdir(path)) return false;
+		for (int tx = 0; tx * pPyramid->tileSize < level->width; ++tx) {
+			if (snprintf(path, sizeof(path), "%s/%d/%d", pPyramid->outDir, level->name, tx) >= (int)sizeof(path) ||
+				!PyramidMkdir(path)) return false;
+		}
+	}
+	return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: PyramidHalve()
+ *
+ * DESCRIPTION
+ * Averages each 2 x 2 square of the rows pTop and pBottom, which are pWidth pixels wide, into one pixel of the
+ * row pOut, which is (pWidth + 1) / 2 pixels wide. pTop and pBottom are the same row when the level has an odd
+ * height, and the last column is repeated when it has an odd width.
+ *------------------------------------------------------------------------------------------------------------*/
+static void PyramidHalve(tPixel *pTop, tPixel *pBottom, int pWidth, tPixel *pOut)
+{
+	for (int x = 0; x < (pWidth + 1) / 2; ++x) {
+		int x0 = 2 * x, x1 = x0 + 1 < pWidth ? x0 + 1 : x0;
+		pOut[x].blue = (byte)((pTop[x0].blue + pTop[x1].blue + pBottom[x0].blue + pBottom[x1].blue + 2) >> 2);
+		pOut[x].green = (byte)((pTop[x0].green + pTop[x1].green + pBottom[x0].green + pBottom[x1].green + 2) >> 2);
+		pOut[x].red = (byte)((pTop[x0].red + pTop[x1].red + pBottom[x0].red + pBottom[x1].red + 2) >> 2);
+	}
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: PyramidMkdir()
+ *
+ * DESCRIPTION
+ * Creates the directory pPath unless it already exists. Returns false on failure.
+ *------------------------------------------------------------------------------------------------------------*/
+static bool PyramidMkdir(char *pPath)
+{
+	struct stat dirStat;
+	if (mkdir(pPath, 0755) != 0 && errno != EEXIST) return false;
+	return stat(pPath, &dirStat) == 0 && S_ISDIR(dirStat.st_mode);
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: PyramidNextRow()
+ *
+ * DESCRIPTION
+ * Returns where the next row of level pLevel is to be stored in its band.
+ *------------------------------------------------------------------------------------------------------------*/
+static tPixel *PyramidNextRow(tPyramid *pPyramid, int pLevel)
+{
+	tPyramidLevel *level = &pPyramid->level[pLevel];
+	return level->band + (size_t)(level->rows % pPyramid->tileSize) * level->width;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: PyramidTilePath()
+ *
+ * DESCRIPTION
+ * Stores the path of the tile in column pTx, row pTy of level pLevel in pPath, which has room for PATH_MAX
+ * chars. Returns false if the path is too long.
+ *------------------------------------------------------------------------------------------------------------*/
+static bool PyramidTilePath(tPyramid *pPyramid, tPyramidLevel *pLevel, int pTx, int pTy, char *pPath)
+{
+	int n;
+	if (pPyramid->layout == PyramidDzi) {
+		n = snprintf(pPath, PATH_MAX, "%s/%s_files/%d/%d_%d.bmp", pPyramid->outDir, pPyramid->name, pLevel->name,
+			pTx, pTy);
+	} else {
+		n = snprintf(pPath, PATH_MAX, "%s/%d/%d/%d.bmp", pPyramid->outDir, pLevel->name, pTx, pTy);
+	}
+	return n < PATH_MAX;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: PyramidTiles()
+ *
+ * DESCRIPTION
+ * The body of the loop over the columns of tiles [pBegin, pEnd) of the band of the level being flushed, which
+ * writes each tile to its own file.
+ *------------------------------------------------------------------------------------------------------------*/
+static void PyramidTiles(void *pContext, int pThread, int pBegin, int pEnd)
+{
+	tPyramid *pyramid = (tPyramid *)pContext;
+	tPyramidLevel *level = pyramid->flushing;
+	int size = pyramid->tileSize, ty = (level->rows - 1) / size, rows = level->rows - ty * size;
+	char path[PATH_MAX];
+	tBmp tile;
+	for (int tx = pBegin; tx < pEnd && !pyramid->failed[pThread]; ++tx) {
+		int cols = level->width - tx * size < size ? level->width - tx * size : size;
+		BmpInit(&tile, cols, rows);
+		FILE *stream = PyramidTilePath(pyramid, level, tx, ty, path) ? FileOpen(path, "wb") : NULL;
+		bool ok = stream && BmpWriteHeaders(stream, &tile) == ErrorNone;
+		for (int row = rows-1; row >= 0 && ok; --row) {
+			ok = BmpWriteRow(stream, level->band + (size_t)row * level->width + tx * size, cols) == ErrorNone;
+		}
+		if (stream) ok = fclose(stream) == 0 && ok;
+		if (!ok) pyramid->failed[pThread] = true;
+	}
+}
+
+tError PyramidWrite(char *pFilename, char *pOutDir, tPyramidLayout pLayout, int pTileSize)
+{
+	tBmp bmp;
+	tError result = BmpProbe(pFilename, &bmp);
+	if (result != ErrorNone) return result;
+	if (bmp.infoHeader.bitsPerPixel != 24) return ErrorBmpGray;
+
+	tPyramid *pyramid = (tPyramid *)calloc(1, sizeof(tPyramid));
+	if (!pyramid) return ErrorFileRead;
+	pyramid->layout = pLayout;
+	pyramid->outDir = pOutDir;
+	pyramid->tileSize = pTileSize;
+	char *base = strrchr(pFilename, '/');
+	snprintf(pyramid->name, sizeof(pyramid->name), "%s", base ? base + 1 : pFilename);
+	char *dot = strrchr(pyramid->name, '.');
+	if (dot && dot != pyramid->name) *dot = '\0';
+
+	// DZI halves the image down to 1 x 1, XYZ until it fits in one tile. Either way, the image is the highest
+	// numbered level.
+	int width = bmp.infoHeader.width, height = bmp.infoHeader.height;
+	for (int w = width, h = height; ; w = (w + 1) / 2, h = (h + 1) / 2) {
+		pyramid->level[pyramid->levels].width = w;
+		pyramid->level[pyramid->levels++].height = h;
+		if (pLayout == PyramidDzi ? w == 1 && h == 1 : w <= pTileSize && h <= pTileSize) break;
+	}
+	for (int i = 0; i < pyramid->levels; ++i) {
+		tPyramidLevel *level = &pyramid->level[i];
+		level->name = pyramid->levels-1 - i;
+		level->band = (tPixel *)malloc((size_t)pTileSize * level->width * sizeof(tPixel));
+		if (!level->band) result = ErrorFileRead;
+	}
+	if (result == ErrorNone && !PyramidDirs(pyramid)) result = ErrorFileOpen;
+
+	// The source scanlines are stored bottom to top, so they are read in chunks of the tuned I/O size from the
+	// end of the file backwards and fed to level 0 top to bottom.
+	size_t lineBytes = (size_t)(BmpFileSize(&bmp) - bmp.header.pixelOffset) / height;
+	int lines = TuneGet()->ioBytes / (int)(lineBytes < INT_MAX ? lineBytes : INT_MAX);
+	lines = lines < 1 ? 1 : lines < height ? lines : height;
+	byte *chunk = result == ErrorNone ? (byte *)malloc(lines * lineBytes) : NULL;
+	FILE *stream = chunk ? FileOpen(pFilename, "rb") : NULL;
+	if (result == ErrorNone && !chunk) result = ErrorFileRead;
+	if (result == ErrorNone && !stream) result = ErrorFileOpen;
+	for (int y0 = 0; y0 < height && result == ErrorNone; y0 += lines) {
+		int count = height - y0 < lines ? height - y0 : lines;
+		off_t offset = bmp.header.pixelOffset + (off_t)(height - y0 - count) * (off_t)lineBytes;
+		if (FileReadAt(stream, chunk, count * lineBytes, offset) != 0) {
+			result = ErrorFileRead;
+			break;
+		}
+		for (int i = 0; i < count; ++i) {
+			memcpy(PyramidNextRow(pyramid, 0), chunk + (count-1 - i) * lineBytes, 3 * (size_t)width);
+			PyramidAddRow(pyramid, 0);
+		}
+		for (int i = 0; i < THREAD_MAX; ++i) if (pyramid->failed[i]) result = ErrorFileWrite;
+	}
+	if (stream) FileClose(stream);
+	free(chunk);
+
+	// The .dzi file is written last, so a viewer never finds it before all of the tiles.
+	if (result == ErrorNone && pLayout == PyramidDzi && !PyramidWriteDzi(pyramid)) result = ErrorFileWrite;
+
+	for (int i = 0; i < pyramid->levels; ++i) free(pyramid->level[i].band);
+	free(pyramid);
+	return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: PyramidWriteDzi()
+ *
+ * DESCRIPTION
+ * Writes the Deep Zoom descriptor outdir/name.dzi. Returns false on failure.
+ *------------------------------------------------------------------------------------------------------------*/
+static bool PyramidWriteDzi(tPyramid *pPyramid)
+{
+	char path[PATH_MAX];
+	if (snprintf(path, sizeof(path), "%s/%s.dzi", pPyramid->outDir, pPyramid->name) >= (int)sizeof(path)) {
+		return false;
+	}
+	FILE *stream = FileOpen(path, "wt");
+	if (!stream) return false;
+	fprintf(stream, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+	fprintf(stream, "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" Format=\"bmp\" Overlap=\"0\" "
+		"TileSize=\"%d\">\n", pPyramid->tileSize);
+	fprintf(stream, "  <Size Width=\"%d\" Height=\"%d\"/>\n", pPyramid->level[0].width, pPyramid->level[0].height);
+	fprintf(stream, "</Image>\n");
+	bool failed = ferror(stream) != 0;
+	return fclose(stream) == 0 && !failed;
+}
@@ -0,0 +1,43 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * Exports an image as a pyramid of tiles for zoomable viewers. Level 0 of the pyramid is the image itself and
+ * each following level is the previous one downsampled 2x in both directions (2 x 2 box filter), rounded up.
+ * Each level is cut into square tiles, the ones on the right and bottom edges being smaller, which are written
+ * as BMP files.
+ *
+ * The source is read once, top to bottom. Each level keeps a band of one row of tiles: when two rows of a level
+ * have arrived they are averaged into the next row of the next level, and when a band is full its tiles are
+ * written and it is reused. So every level is produced at once, and memory use is one tile row per level,
+ * i.e., less than two tile rows of the source, whatever the height of the image.
+ **************************************************************************************************************/
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include "Error.h"
+
+extern const int cPyramidTileDefault;
+
+// The layouts of the output directory.
+typedef enum {
+	// Deep Zoom (DZI): outdir/name.dzi describes the image and the tiles are outdir/name_files/level/col_row.bmp,
+	// where level 0 is 1 x 1 and the highest level is the image.
+	PyramidDzi = 0,
+	// XYZ (slippy map): the tiles are outdir/z/x/y.bmp, where z = 0 is the first level which fits in one tile
+	// and the highest z is the image.
+	PyramidXyz = 1
+} tPyramidLayout;
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: PyramidWrite()
+ *
+ * DESCRIPTION
+ * Writes the pyramid of pTileSize x pTileSize tiles (pTileSize is even) of the BMP image pFilename to the
+ * directory pOutDir, which is created if needed, in layout pLayout. Returns ErrorFileOpen if a directory could
+ * not be created, ErrorFileWrite if a tile could not be written, ErrorBmpGray for an 8-bit gray image, and the
+ * errors of BmpProbe().
+ *------------------------------------------------------------------------------------------------------------*/
+tError PyramidWrite(char *pFilename, char *pOutDir, tPyramidLayout pLayout, int pTileSize);
+
+#endif
@@ -0,0 +1,284 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * See comments in Rank.h.
+ **************************************************************************************************************/
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Progress.h"
+#include "Rank.h"
+#include "Thread.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// The width in pixels of the strips filtered by the histogram algorithm. Each strip also keeps the histograms
+// of the r columns on either side of it, so wider strips waste less work on them.
+static const int cRankStrip = 128;
+
+// The sorting networks work on runs of this many bytes (64 pixels) of a row at once, so that the 32 runs of
+// values being sorted stay in the L1 cache.
+static const int cRankRun = 192;
+
+// The networks sort 16 or 32 values. The 9 or 25 values of a window are padded with this many zeros and then
+// with 255s, so the value of rank t ends up at index t + cRankPadLow.
+static const int cRankPadLow = 3;
+
+// The sorting network path is split between threads in chunks of at least this many rows.
+static const int cRankMinRowsPerThread = 8;
+
+#define RankMax(a, b) ((a) > (b) ? (a) : (b))
+#define RankMin(a, b) ((a) < (b) ? (a) : (b))
+
+// A rank filter being performed.
+typedef struct {
+	tBmp		*bmp;			// The image, which is only read.
+	tPixel		**out;			// The filtered image.
+	int			radius;			// The radius of the window.
+	int			rank;			// The rank of the wanted value among the values of a window, from 0.
+	byte		*scratch;		// One scratch area of scratchBytes bytes per thread.
+	size_t		scratchBytes;	// The size of a scratch area.
+} tRank;
+
+static int	RankClamp(int pValue, int pMax);
+static void	RankColumns(tRank *pRank, uint16_t *pCoarse, uint16_t *pFine, int pX0, int pCols, int pRow,
+				int pDelta);
+static void	RankExchange(byte *restrict pA, byte *restrict pB);
+static void	RankNetwork(void *pContext, int pThread, int pBegin, int pEnd);
+static void	RankRow(tRank *pRank, uint16_t *pCoarse, uint16_t *pFine, int pChannel, int pX0, int pX1, int pY);
+static void	RankSort(byte *pValues, int pCount);
+static void	RankStrips(void *pContext, int pThread, int pBegin, int pEnd);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: RankClamp()
+ *
+ * DESCRIPTION
+ * Returns pValue clamped to [0, pMax], i.e., the row or column of the edge pixel which stands in for a pixel
+ * outside the image.
+ *------------------------------------------------------------------------------------------------------------*/
+static int RankClamp(int pValue, int pMax)
+{
+	return pValue < 0 ? 0 : pValue > pMax ? pMax : pValue;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: RankColumns()
+ *
+ * DESCRIPTION
+ * Adds (pDelta = 1) or removes (pDelta = -1) the pixels of row pRow to or from the pCols column histograms of
+ * a strip, where column histogram col is the one of image column pX0 - r + col.
+ *------------------------------------------------------------------------------------------------------------*/
+static void RankColumns(tRank *pRank, uint16_t *pCoarse, uint16_t *pFine, int pX0, int pCols, int pRow,
+	int pDelta)
+{
+	tPixel *row = pRank->bmp->pixel[pRow];
+	int width = pRank->bmp->infoHeader.width;
+	for (int col = 0; col < pCols; ++col) {
+		byte *pixel = (byte *)&row[RankClamp(pX0 - pRank->radius + col, width - 1)];
+		for (int c = 0; c < 3; ++c) {
+			pCoarse[(col * 3 + c) * 16 + (pixel[c] >> 4)] += (uint16_t)pDelta;
+			pFine[(col * 3 + c) * 256 + pixel[c]] += (uint16_t)pDelta;
+		}
+	}
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: RankExchange()
+ *
+ * DESCRIPTION
+ * One compare-exchange of a sorting network on a whole run: afterwards pA holds the min and pB the max of each
+ * lane. With SSE2, 16 lanes are done at once with pminub and pmaxub.
+ *------------------------------------------------------------------------------------------------------------*/
+static void RankExchange(byte *restrict pA, byte *restrict pB)
+{
+	int lane = 0;
+#ifdef __SSE2__
+	for (; lane + 16 <= cRankRun; lane += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(pA + lane));
+		__m128i b = _mm_loadu_si128((const __m128i *)(pB + lane));
+		_mm_storeu_si128((__m128i *)(pA + lane), _mm_min_epu8(a, b));
+		_mm_storeu_si128((__m128i *)(pB + lane), _mm_max_epu8(a, b));
+	}
+#endif
+	for (; lane < cRankRun; ++lane) {
+		byte lo = RankMin(pA[lane], pB[lane]), hi = RankMax(pA[lane], pB[lane]);
+		pA[lane] = lo;
+		pB[lane] = hi;
+	}
+}
+
+tError RankFilter(tBmp *pBmp, int pRadius, int pPercent)
+{
+	int width = pBmp->infoHeader.width, height = pBmp->infoHeader.height;
+	tRank rank;
+	rank.bmp = pBmp;
+	rank.radius = RankClamp(pRadius, RANK_RADIUS_MAX);
+	if (rank.radius == 0) return ErrorNone;
+	int count = (2 * rank.radius + 1) * (2 * rank.radius + 1);
+	rank.rank = (RankClamp(pPercent, 100) * (count - 1) + 50) / 100;
+
+	// The scratch area holds the runs being sorted, or the coarse and fine histograms of the columns of a strip.
+	if (rank.radius <= 2) {
+		rank.scratchBytes = (size_t)(count <= 16 ? 16 : 32) * cRankRun;
+	} else {
+		rank.scratchBytes = (size_t)(cRankStrip + 2 * rank.radius) * 3 * (16 + 256) * sizeof(uint16_t);
+	}
+	rank.scratch = (byte *)malloc(ThreadCount() * rank.scratchBytes);
+	rank.out = rank.scratch ? BmpPixelAlloc(width, height) : NULL;
+	if (!rank.out) {
+		free(rank.scratch);
+		return ErrorOpRank;
+	}
+
+	if (rank.radius <= 2) ThreadFor(height, cRankMinRowsPerThread, RankNetwork, &rank);
+	else ThreadFor((width + cRankStrip - 1) / cRankStrip, 1, RankStrips, &rank);
+
+	free(rank.scratch);
+	BmpPixelFree(pBmp->pixel, height);
+	pBmp->pixel = rank.out;
+	return ErrorNone;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: RankNetwork()
+ *
+ * DESCRIPTION
+ * The body of the loop over the rows [pBegin, pEnd) of the sorting network path. For each run of a row, the
+ * value of every window position is gathered into its own run of the scratch area, so that value k of the
+ * window of lane i is at scratch[k * cRankRun + i], and the runs are sorted lane by lane.
+ *------------------------------------------------------------------------------------------------------------*/
+static void RankNetwork(void *pContext, int pThread, int pBegin, int pEnd)
+{
+	tRank *rank = (tRank *)pContext;
+	int width = rank->bmp->infoHeader.width, height = rank->bmp->infoHeader.height, rowBytes = 3 * width;
+	int side = 2 * rank->radius + 1, count = side * side, sorted = count <= 16 ? 16 : 32;
+	byte *values = rank->scratch + pThread * rank->scratchBytes;
+	for (int row = pBegin; row < pEnd && !ProgressCancelled(); ++row) {
+		for (int lane0 = 0; lane0 < rowBytes; lane0 += cRankRun) {
+			int lanes = rowBytes - lane0 < cRankRun ? rowBytes - lane0 : cRankRun;
+			int x0 = lane0 / 3, x1 = (lane0 + lanes) / 3;
+			for (int k = 0; k < count; ++k) {
+				int dy = k / side - rank->radius, dx = k % side - rank->radius;
+				byte *src = (byte *)rank->bmp->pixel[RankClamp(row + dy, height - 1)];
+				byte *dst = values + k * cRankRun;
+				if (x0 + dx >= 0 && x1 - 1 + dx < width) {
+					memcpy(dst, src + lane0 + 3 * dx, lanes);
+				} else {
+					for (int i = 0; i < lanes; ++i) {
+						dst[i] = src[3 * RankClamp((lane0 + i) / 3 + dx, width - 1) + (lane0 + i) % 3];
+					}
+				}
+			}
+			memset(values + count * cRankRun, 0, cRankPadLow * cRankRun);
+			memset(values + (count + cRankPadLow) * cRankRun, 0xff, (sorted - count - cRankPadLow) * cRankRun);
+			RankSort(values, sorted);
+			memcpy((byte *)rank->out[row] + lane0, values + (rank->rank + cRankPadLow) * cRankRun, lanes);
+		}
+	}
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: RankRow()
+ *
+ * DESCRIPTION
+ * Filters channel pChannel of the pixels [pX0, pX1) of row pY of a strip, whose column histograms are up to
+ * date for row pY. luc[k] is the window center for which the fine bins of coarse bin k were last brought up
+ * to date: they are updated column by column when they are only a little behind, and summed again from the
+ * column histograms when they are far behind.
+ *------------------------------------------------------------------------------------------------------------*/
+static void RankRow(tRank *pRank, uint16_t *pCoarse, uint16_t *pFine, int pChannel, int pX0, int pX1, int pY)
+{
+	int r = pRank->radius, side = 2 * r + 1, t = pRank->rank;
+	uint16_t coarse[16], fine[256];
+	int luc[16];
+	memset(coarse, 0, sizeof(coarse));
+	for (int col = 0; col < side; ++col) {
+		for (int k = 0; k < 16; ++k) coarse[k] += pCoarse[(col * 3 + pChannel) * 16 + k];
+	}
+	for (int k = 0; k < 16; ++k) luc[k] = -side;
+
+	byte *out = (byte *)pRank->out[pY];
+	for (int x = pX0; x < pX1; ++x) {
+		int center = x - pX0 + r;
+		if (x > pX0) {
+			uint16_t *in = pCoarse + ((center + r) * 3 + pChannel) * 16;
+			uint16_t *gone = pCoarse + ((center - r - 1) * 3 + pChannel) * 16;
+			for (int k = 0; k < 16; ++k) coarse[k] += in[k] - gone[k];
+		}
+
+		// The window holds side * side > t values, so the search always ends within the bins.
+		int k = 0, b = 0, sum = 0;
+		while (sum + coarse[k] <= t) sum += coarse[k++];
+		uint16_t *bins = fine + 16 * k;
+		if (center - luc[k] > r) {
+			memset(bins, 0, 16 * sizeof(uint16_t));
+			for (int col = center - r; col <= center + r; ++col) {
+				uint16_t *in = pFine + (col * 3 + pChannel) * 256 + 16 * k;
+				for (int i = 0; i < 16; ++i) bins[i] += in[i];
+			}
+		} else {
+			for (int col = luc[k] + 1; col <= center; ++col) {
+				uint16_t *in = pFine + ((col + r) * 3 + pChannel) * 256 + 16 * k;
+				uint16_t *gone = pFine + ((col - r - 1) * 3 + pChannel) * 256 + 16 * k;
+				for (int i = 0; i < 16; ++i) bins[i] += in[i] - gone[i];
+			}
+		}
+		luc[k] = center;
+		while (sum + bins[b] <= t) sum += bins[b++];
+		out[3 * x + pChannel] = (byte)(16 * k + b);
+	}
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: RankSort()
+ *
+ * DESCRIPTION
+ * Sorts pCount (a power of two) runs of values lane by lane with Batcher's odd-even merge sort network: after
+ * sorting, pValues[k * cRankRun + i] is the value of rank k of lane i. Every lane is sorted, including those
+ * past the end of a short run at the end of a row, so that each compare-exchange is a loop of fixed length.
+ *------------------------------------------------------------------------------------------------------------*/
+static void RankSort(byte *pValues, int pCount)
+{
+	for (int p = 1; p < pCount; p *= 2) {
+		for (int k = p; k >= 1; k /= 2) {
+			for (int j = k % p; j + k < pCount; j += 2 * k) {
+				for (int i = 0; i < k && i + j + k < pCount; ++i) {
+					if ((i + j) / (2 * p) == (i + j + k) / (2 * p)) {
+						RankExchange(pValues + (i + j) * cRankRun, pValues + (i + j + k) * cRankRun);
+					}
+				}
+			}
+		}
+	}
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: RankStrips()
+ *
+ * DESCRIPTION
+ * The body of the loop over the strips [pBegin, pEnd) of the histogram path. The column histograms of a strip
+ * start with the window of row 0 and move down one row at a time.
+ *------------------------------------------------------------------------------------------------------------*/
+static void RankStrips(void *pContext, int pThread, int pBegin, int pEnd)
+{
+	tRank *rank = (tRank *)pContext;
+	int width = rank->bmp->infoHeader.width, height = rank->bmp->infoHeader.height, r = rank->radius;
+	uint16_t *coarse = (uint16_t *)(rank->scratch + pThread * rank->scratchBytes);
+	uint16_t *fine = coarse + (size_t)(cRankStrip + 2 * r) * 3 * 16;
+	for (int strip = pBegin; strip < pEnd; ++strip) {
+		int x0 = strip * cRankStrip, x1 = x0 + cRankStrip < width ? x0 + cRankStrip : width;
+		int cols = x1 - x0 + 2 * r;
+		memset(coarse, 0, (size_t)cols * 3 * 16 * sizeof(uint16_t));
+		memset(fine, 0, (size_t)cols * 3 * 256 * sizeof(uint16_t));
+		for (int y = -r; y <= r; ++y) RankColumns(rank, coarse, fine, x0, cols, RankClamp(y, height - 1), 1);
+		for (int y = 0; y < height && !ProgressCancelled(); ++y) {
+			if (y > 0) {
+				RankColumns(rank, coarse, fine, x0, cols, RankClamp(y - r - 1, height - 1), -1);
+				RankColumns(rank, coarse, fine, x0, cols, RankClamp(y + r, height - 1), 1);
+			}
+			for (int c = 0; c < 3; ++c) RankRow(rank, coarse, fine, c, x0, x1, y);
+		}
+	}
+}
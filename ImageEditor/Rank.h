@@ -0,0 +1,40 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * Rank filters, e.g., the median filter, for removing noise: each pixel is replaced by the value of a given
+ * rank (percentile) among the pixels of the (2r+1) x (2r+1) square around it. Each color channel is filtered
+ * separately. Pixels outside the image are taken to be copies of the nearest edge pixel.
+ *
+ * For radius 1 and 2, the 9 or 25 values of each pixel are sorted by a sorting network, applied to a run of
+ * pixels at once so the compare-exchanges are loops of independent byte min/max operations.
+ *
+ * Larger radii use the constant time algorithm of Perreault and Hebert. Every column keeps the histogram of
+ * its 2r+1 pixels in the window, which is updated with one pixel in and one out when moving down a row. The
+ * histogram of the window is the sum of 2r+1 column histograms and is updated with one column in and one out
+ * when moving right. Histograms have two levels, 16 coarse bins of 16 fine bins each: the coarse bins find the
+ * range of the wanted value and only the 16 fine bins of that range are then brought up to date and searched.
+ * Each thread filters its own vertical strip of the image.
+ **************************************************************************************************************/
+#ifndef RANK_H
+#define RANK_H
+
+#include "Bmp.h"
+#include "Error.h"
+
+// The largest radius of a rank filter. The window histogram counts then fit in 16 bits.
+#define RANK_RADIUS_MAX 127
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: RankFilter()
+ *
+ * DESCRIPTION
+ * Replaces each pixel of pBmp by the pPercent percentile (0 to 100, 50 being the median) of the square of
+ * radius pRadius around it. With n pixels in the square, the percentile is the value of rank
+ * round(pPercent * (n - 1) / 100) from 0, in increasing order. pRadius is clamped to [0, RANK_RADIUS_MAX], and
+ * radius 0 leaves the image unchanged. Returns ErrorOpRank if memory for the filter could not be allocated, in
+ * which case the image is unchanged. If the job is cancelled (see Progress.h), the filter stops early.
+ *------------------------------------------------------------------------------------------------------------*/
+tError RankFilter(tBmp *pBmp, int pRadius, int pPercent);
+
+#endif
@@ -0,0 +1,553 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * See comments in Server.h.
+ **************************************************************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "Bmp.h"
+#include "File.h"
+#include "Hist.h"
+#include "Main.h"
+#include "Server.h"
+
+// Note: These constants are declared in Server.h.
+const uint32_t cServerInlineIn  = 1;
+const uint32_t cServerInlineOut = 2;
+
+static const uint32_t cServerMagic      = 0x504d4942;  // "BIMP" in little endian.
+static const uint32_t cServerMaxPayload = 1u << 30;    // Largest image or path accepted in a request.
+static const int      cServerTimeoutSec = 30;          // A stalled client is dropped after this long.
+
+// A growable buffer. Each worker keeps its buffers between requests so that, once warmed up, serving a
+// request does not allocate I/O buffers.
+typedef struct {
+	byte	*data;
+	size_t	cap;
+} tServerBuf;
+
+// An accepted connection waiting for a worker.
+typedef struct {
+	int			fd;
+	long long	acceptUs;
+} tServerConn;
+
+// The worker pool and its queue of pending connections, which is a ring buffer of config->maxPending
+// entries.
+typedef struct {
+	tServerConfig	*config;
+	int				count;
+	int				head;
+	pthread_cond_t	notEmpty;
+	pthread_cond_t	notFull;
+	tServerConn		*pending;
+	pthread_mutex_t	lock;
+	bool			stopping;
+} tServerPool;
+
+// Set by the SIGINT/SIGTERM handler.
+static volatile sig_atomic_t sServerStop = 0;
+
+static bool			ServerAbsPath(char *pPath, char *pAbs);
+static bool			ServerBufGrow(tServerBuf *pBuf, size_t pSize);
+static bool			ServerCacheGet(tCache *pCache, char *pKey, uint32_t pFlags, char *pOutPath,
+						tServerBuf *pOut, uint32_t *pDataLen);
+static void			ServerHandle(tCache *pCache, tServerConn *pConn, tServerBuf *pIn, tServerBuf *pOut,
+						tServerBuf *pPaths);
+static long long	ServerNowUs();
+static void			ServerOnSignal(int pSig);
+static int			ServerRecv(int pFd, void *pBlock, size_t pSize);
+static int			ServerRecvU32(int pFd, uint32_t *pValue);
+static int			ServerSendAll(int pFd, void *pBlock, size_t pSize);
+static int			ServerSendU32(int pFd, uint32_t pValue);
+static void			*ServerWorker(void *pPool);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ServerAbsPath()
+ *
+ * DESCRIPTION
+ * The server does not share our working directory, so relative paths are made absolute before being sent.
+ * pAbs must be at least PATH_MAX chars.
+ *------------------------------------------------------------------------------------------------------------*/
+static bool ServerAbsPath(char *pPath, char *pAbs)
+{
+	if (*pPath == '/') return snprintf(pAbs, PATH_MAX, "%s", pPath) < PATH_MAX;
+	char cwd[PATH_MAX];
+	if (!getcwd(cwd, sizeof(cwd))) return false;
+	return snprintf(pAbs, PATH_MAX, "%s/%s", cwd, pPath) < PATH_MAX;
+}
+
+static bool ServerBufGrow(tServerBuf *pBuf, size_t pSize)
+{
+	if (pSize <= pBuf->cap) return true;
+	byte *data = (byte *)realloc(pBuf->data, pSize);
+	if (!data) return false;
+	pBuf->data = data;
+	pBuf->cap = pSize;
+	return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ServerCacheGet()
+ *
+ * DESCRIPTION
+ * Looks up the result of a request in the cache. On a hit, the result is copied into pOut (setting pDataLen)
+ * or to the file pOutPath, depending on whether the request wants the result inline, and true is returned.
+ *------------------------------------------------------------------------------------------------------------*/
+static bool ServerCacheGet(tCache *pCache, char *pKey, uint32_t pFlags, char *pOutPath, tServerBuf *pOut,
+	uint32_t *pDataLen)
+{
+	if (!(pFlags & cServerInlineOut)) return CacheGetFile(pCache, pKey, pOutPath);
+	size_t size;
+	byte *data = CacheGetBytes(pCache, pKey, &size);
+	bool hit = data && size <= cServerMaxPayload && ServerBufGrow(pOut, size);
+	if (hit) {
+		memcpy(pOut->data, data, size);
+		*pDataLen = (uint32_t)size;
+	}
+	free(data);
+	return hit;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ServerHandle()
+ *
+ * DESCRIPTION
+ * Reads one request from the connection, performs it (or finds its result in pCache, if not NULL), and sends
+ * the response. pIn, pOut, and pPaths are the worker's buffers for the input image, the output image, and the
+ * file names in the operations.
+ *------------------------------------------------------------------------------------------------------------*/
+static void ServerHandle(tCache *pCache, tServerConn *pConn, tServerBuf *pIn, tServerBuf *pOut,
+	tServerBuf *pPaths)
+{
+	tServerTiming timing = { 0 };
+	tOpQueue opQueue;
+	uint32_t magic, flags, opCount, inLen, outLen, dataLen = 0;
+	char outPath[PATH_MAX];
+	char *source = "<invalid>";
+	tError result = ErrorNone;
+
+	long long start = ServerNowUs();
+	timing.queueUs = (uint32_t)(start - pConn->acceptUs);
+
+	// Read and check the request. If the request cannot be read, there is no one to reply to.
+	memset(&opQueue, 0, sizeof(opQueue));
+	if (ServerRecvU32(pConn->fd, &magic) || ServerRecvU32(pConn->fd, &flags) ||
+		ServerRecvU32(pConn->fd, &opCount)) return;
+	if (magic != cServerMagic || opCount > OP_QUEUE_MAX) result = ErrorServerProto;
+	size_t pathAt[OP_QUEUE_MAX], pathsLen = 0;
+	for (uint32_t i = 0; i < opCount && result == ErrorNone; ++i) {
+		uint32_t op, arg[4], pathLen;
+		double coef[6];
+		if (ServerRecvU32(pConn->fd, &op) || ServerRecv(pConn->fd, arg, sizeof(arg)) ||
+			ServerRecv(pConn->fd, coef, sizeof(coef)) || ServerRecvU32(pConn->fd, &pathLen)) return;
+		tOp *queued = OpQueueAdd(&opQueue, (tOperation)op);
+		if (!queued || pathLen >= PATH_MAX || (op == OperationOverlay) != (pathLen > 0) ||
+			!ServerBufGrow(pPaths, pathsLen + pathLen + 1)) {
+			result = ErrorServerProto;
+		} else {
+			for (int j = 0; j < 4; ++j) queued->arg[j] = (int32_t)arg[j];
+			memcpy(queued->coef, coef, sizeof(coef));
+			if (ServerRecv(pConn->fd, pPaths->data + pathsLen, pathLen)) return;
+			pPaths->data[pathsLen + pathLen] = '\0';
+			pathAt[i] = pathsLen;
+			pathsLen += pathLen + 1;
+		}
+	}
+
+	// The paths are only pointed to once they have all been received, as pPaths may move as it grows.
+	for (int i = 0; i < opQueue.index && result == ErrorNone; ++i) {
+		if (opQueue.queue[i].op == OperationOverlay) opQueue.queue[i].path = (char *)pPaths->data + pathAt[i];
+	}
+	if (result == ErrorNone) {
+		if (ServerRecvU32(pConn->fd, &inLen)) return;
+		if (inLen == 0 || inLen > cServerMaxPayload || !ServerBufGrow(pIn, inLen + 1)) result = ErrorServerProto;
+	}
+	if (result == ErrorNone) {
+		if (ServerRecv(pConn->fd, pIn->data, inLen) || ServerRecvU32(pConn->fd, &outLen)) return;
+		pIn->data[inLen] = '\0';
+		source = (flags & cServerInlineIn) ? "<inline>" : (char *)pIn->data;
+		if (outLen >= sizeof(outPath)) result = ErrorServerProto;
+	}
+	if (result == ErrorNone) {
+		if (ServerRecv(pConn->fd, outPath, outLen)) return;
+		outPath[outLen] = '\0';
+		if (!(flags & cServerInlineOut) && outLen == 0) result = ErrorServerProto;
+	}
+
+	// Look the request up in the cache. On a hit, the image is neither read, processed, nor written.
+	char key[CACHE_KEY_MAX];
+	bool cached = false;
+	if (result == ErrorNone && pCache) {
+		if (flags & cServerInlineIn) CacheKey(key, pIn->data, inLen, &opQueue);
+		else result = CacheKeyFile(key, (char *)pIn->data, &opQueue);
+		if (result == ErrorNone) cached = ServerCacheGet(pCache, key, flags, outPath, pOut, &dataLen);
+	}
+
+	// Read the image, from the request itself or from the file it names, along with its histogram if it will be
+	// used.
+	tBmp bmp;
+	tHist hist;
+	tHist *readHist = OpQueueWantsHist(&opQueue) ? &hist : NULL;
+	bmp.pixel = NULL;
+	if (result == ErrorNone && !cached) {
+		if (flags & cServerInlineIn) {
+			FILE *stream = fmemopen(pIn->data, inLen, "rb");
+			result = stream ? BmpReadStream(stream, inLen, &bmp, readHist) : ErrorFileRead;
+			if (stream) fclose(stream);
+		} else {
+			result = BmpRead((char *)pIn->data, &bmp, readHist);
+		}
+	}
+	long long readEnd = ServerNowUs();
+	timing.readUs = (uint32_t)(readEnd - start);
+
+	if (result == ErrorNone && !cached) result = OpQueueRun(&opQueue, &bmp, readHist);
+	long long opEnd = ServerNowUs();
+	timing.opUs = (uint32_t)(opEnd - readEnd);
+
+	// Write the image, into our output buffer or to the requested file. One extra byte is allocated because
+	// fmemopen() may want to store a terminating null byte. An image too large for a response is an error.
+	if (result == ErrorNone && !cached) {
+		if (flags & cServerInlineOut) {
+			off_t fileSize = BmpFileSize(&bmp);
+			dataLen = fileSize <= (off_t)cServerMaxPayload ? (uint32_t)fileSize : 0;
+			FILE *stream = NULL;
+			if (dataLen && ServerBufGrow(pOut, dataLen + 1)) stream = fmemopen(pOut->data, dataLen + 1, "wb");
+			result = stream ? BmpWriteStream(stream, &bmp) : ErrorFileWrite;
+			if (stream) fclose(stream);
+			if (result != ErrorNone) dataLen = 0;
+		} else {
+			result = BmpWrite(outPath, &bmp);
+		}
+		if (result == ErrorNone && pCache) {
+			if (flags & cServerInlineOut) CachePutBytes(pCache, key, pOut->data, dataLen);
+			else CachePutFile(pCache, key, outPath);
+		}
+	}
+	if (bmp.pixel) BmpPixelFree(bmp.pixel, bmp.infoHeader.height);
+	timing.writeUs = (uint32_t)(ServerNowUs() - opEnd);
+
+	// Send the response. If the client went away, there is nothing more to do.
+	if (ServerSendU32(pConn->fd, cServerMagic) == 0 && ServerSendU32(pConn->fd, (uint32_t)result) == 0 &&
+		ServerSendU32(pConn->fd, timing.queueUs) == 0 && ServerSendU32(pConn->fd, timing.readUs) == 0 &&
+		ServerSendU32(pConn->fd, timing.opUs) == 0 && ServerSendU32(pConn->fd, timing.writeUs) == 0 &&
+		ServerSendU32(pConn->fd, dataLen) == 0) {
+		ServerSendAll(pConn->fd, pOut->data, dataLen);
+	}
+
+	printf("%s: request %s%s: status %d, queue %u us, read %u us, ops %u us, write %u us\n", cBinary,
+		source, cached ? " (cached)" : "", (int)result, (unsigned)timing.queueUs,
+		(unsigned)timing.readUs, (unsigned)timing.opUs, (unsigned)timing.writeUs);
+	fflush(stdout);
+}
+
+static long long ServerNowUs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void ServerOnSignal(int pSig)
+{
+	sServerStop = 1;
+}
+
+static int ServerRecv(int pFd, void *pBlock, size_t pSize)
+{
+	char *block = (char *)pBlock;
+	while (pSize > 0) {
+		ssize_t n = recv(pFd, block, pSize, 0);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		block += n; pSize -= n;
+	}
+	return 0;
+}
+
+static int ServerRecvU32(int pFd, uint32_t *pValue)
+{
+	return ServerRecv(pFd, pValue, sizeof(*pValue));
+}
+
+tError ServerRun(tServerConfig *pConfig)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(pConfig->sockPath) >= sizeof(addr.sun_path)) return ErrorServer;
+	strcpy(addr.sun_path, pConfig->sockPath);
+
+	// Remove a socket left behind by a previous server, but never some other kind of file, nor the socket of a
+	// server which is still running, i.e., one which answers. The probe does not block, so a running server
+	// whose backlog is full (EAGAIN) also counts as answering.
+	struct stat fileStat;
+	if (stat(pConfig->sockPath, &fileStat) == 0 && S_ISSOCK(fileStat.st_mode)) {
+		int probeFd = socket(AF_UNIX, SOCK_STREAM, 0);
+		bool answers = probeFd >= 0 && fcntl(probeFd, F_SETFL, O_NONBLOCK) == 0 &&
+			(connect(probeFd, (struct sockaddr *)&addr, sizeof(addr)) == 0 || errno == EAGAIN);
+		if (probeFd >= 0) close(probeFd);
+		if (answers) return ErrorServer;
+		unlink(pConfig->sockPath);
+	}
+
+	int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listenFd < 0) return ErrorServer;
+	if (bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) || listen(listenFd, pConfig->maxPending)) {
+		close(listenFd);
+		return ErrorServer;
+	}
+
+	// SIGINT and SIGTERM stop the server. They are blocked while the workers are created so that only the
+	// main thread receives them, interrupting accept(). A client going away must not kill the server.
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = ServerOnSignal;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	action.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &action, NULL);
+	sigset_t stopSigs;
+	sigemptyset(&stopSigs);
+	sigaddset(&stopSigs, SIGINT);
+	sigaddset(&stopSigs, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &stopSigs, NULL);
+
+	tServerPool pool;
+	memset(&pool, 0, sizeof(pool));
+	pool.config = pConfig;
+	pool.pending = (tServerConn *)malloc(pConfig->maxPending * sizeof(tServerConn));
+	pthread_t *workers = (pthread_t *)malloc(pConfig->workers * sizeof(pthread_t));
+	if (!pool.pending || !workers) {
+		pthread_sigmask(SIG_UNBLOCK, &stopSigs, NULL);
+		free(workers);
+		free(pool.pending);
+		close(listenFd);
+		unlink(pConfig->sockPath);
+		return ErrorServer;
+	}
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.notEmpty, NULL);
+	pthread_cond_init(&pool.notFull, NULL);
+
+	// If a worker cannot be created, the ones that were are stopped again and the server does not start.
+	int started = 0;
+	while (started < pConfig->workers && pthread_create(&workers[started], NULL, ServerWorker, &pool) == 0) {
+		++started;
+	}
+	pthread_sigmask(SIG_UNBLOCK, &stopSigs, NULL);
+	tError result = started == pConfig->workers ? ErrorNone : ErrorServer;
+
+	if (result == ErrorNone) {
+		printf("%s: serving on %s with %d workers\n", cBinary, pConfig->sockPath, pConfig->workers);
+		fflush(stdout);
+	}
+
+	while (result == ErrorNone && !sServerStop) {
+		// Backpressure: while every pending slot is taken, stop accepting connections. The timed wait lets us
+		// notice a stop signal.
+		pthread_mutex_lock(&pool.lock);
+		while (pool.count == pConfig->maxPending && !sServerStop) {
+			struct timespec until;
+			clock_gettime(CLOCK_REALTIME, &until);
+			until.tv_nsec += 100000000;
+			if (until.tv_nsec >= 1000000000) { until.tv_sec += 1; until.tv_nsec -= 1000000000; }
+			pthread_cond_timedwait(&pool.notFull, &pool.lock, &until);
+		}
+		pthread_mutex_unlock(&pool.lock);
+		if (sServerStop) break;
+
+		int fd = accept(listenFd, NULL, NULL);
+		if (fd < 0) continue;
+		struct timeval timeout = { cServerTimeoutSec, 0 };
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+		pthread_mutex_lock(&pool.lock);
+		tServerConn *conn = &pool.pending[(pool.head + pool.count) % pConfig->maxPending];
+		conn->fd = fd;
+		conn->acceptUs = ServerNowUs();
+		++pool.count;
+		pthread_cond_signal(&pool.notEmpty);
+		pthread_mutex_unlock(&pool.lock);
+	}
+
+	// Let the workers finish the requests already accepted, then shut down.
+	pthread_mutex_lock(&pool.lock);
+	pool.stopping = true;
+	pthread_cond_broadcast(&pool.notEmpty);
+	pthread_mutex_unlock(&pool.lock);
+	for (int i = 0; i < started; ++i) {
+		pthread_join(workers[i], NULL);
+	}
+	close(listenFd);
+	unlink(pConfig->sockPath);
+	free(workers);
+	free(pool.pending);
+	pthread_cond_destroy(&pool.notFull);
+	pthread_cond_destroy(&pool.notEmpty);
+	pthread_mutex_destroy(&pool.lock);
+	return result;
+}
+
+tError ServerSend(char *pSockPath, tOpQueue *pQueue, char *pInFile, char *pOutFile, bool pInline,
+	tServerTiming *pTiming)
+{
+	char inPath[PATH_MAX], outPath[PATH_MAX];
+	if (!ServerAbsPath(pInFile, inPath) || !ServerAbsPath(pOutFile, outPath)) return ErrorFileOpen;
+
+	// Read the image when it is to be sent inline.
+	tServerBuf in = { NULL, 0 };
+	uint32_t inLen = (uint32_t)strlen(inPath);
+	if (pInline) {
+		off_t fileSize = FileSize(pInFile);
+		if (fileSize <= 0 || fileSize > (off_t)cServerMaxPayload) {
+			return fileSize < 0 ? ErrorFileOpen : ErrorBmpInv;
+		}
+		FILE *stream = FileOpen(pInFile, "rb");
+		if (!stream) return ErrorFileOpen;
+		inLen = (uint32_t)fileSize;
+		bool ok = ServerBufGrow(&in, inLen) && FileRead(stream, in.data, inLen, 1) == 0;
+		FileClose(stream);
+		if (!ok) {
+			free(in.data);
+			return ErrorFileRead;
+		}
+	}
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(pSockPath) >= sizeof(addr.sun_path)) return ErrorServer;
+	strcpy(addr.sun_path, pSockPath);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		if (fd >= 0) close(fd);
+		free(in.data);
+		return ErrorServer;
+	}
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &action, NULL);
+
+	// Send the request.
+	tError result = ErrorNone;
+	uint32_t flags = pInline ? cServerInlineIn | cServerInlineOut : 0;
+	uint32_t outLen = pInline ? 0 : (uint32_t)strlen(outPath);
+	int failed = ServerSendU32(fd, cServerMagic) || ServerSendU32(fd, flags) ||
+		ServerSendU32(fd, (uint32_t)pQueue->index);
+	for (int i = 0; i < pQueue->index && !failed; ++i) {
+		tOp *op = &pQueue->queue[i];
+		char opPath[PATH_MAX] = "";
+		if (op->path && !ServerAbsPath(op->path, opPath)) failed = 1;
+		uint32_t pathLen = (uint32_t)strlen(opPath);
+		failed = failed || ServerSendU32(fd, (uint32_t)op->op) || ServerSendAll(fd, op->arg, sizeof(op->arg)) ||
+			ServerSendAll(fd, op->coef, sizeof(op->coef)) || ServerSendU32(fd, pathLen) ||
+			ServerSendAll(fd, opPath, pathLen);
+	}
+	failed = failed || ServerSendU32(fd, inLen) || ServerSendAll(fd, pInline ? (void *)in.data : inPath, inLen) ||
+		ServerSendU32(fd, outLen) || ServerSendAll(fd, outPath, outLen);
+
+	// Receive the response.
+	uint32_t magic, status, dataLen;
+	failed = failed || ServerRecvU32(fd, &magic) || ServerRecvU32(fd, &status) ||
+		ServerRecvU32(fd, &pTiming->queueUs) || ServerRecvU32(fd, &pTiming->readUs) ||
+		ServerRecvU32(fd, &pTiming->opUs) || ServerRecvU32(fd, &pTiming->writeUs) || ServerRecvU32(fd, &dataLen);
+	if (failed || magic != cServerMagic || dataLen > cServerMaxPayload) {
+		result = ErrorServerProto;
+	} else {
+		result = (tError)(int32_t)status;
+	}
+
+	// Write the image returned inline.
+	if (result == ErrorNone && pInline) {
+		if (!ServerBufGrow(&in, dataLen) || ServerRecv(fd, in.data, dataLen)) {
+			result = ErrorServerProto;
+		} else {
+			// As the output is often the input file, it is only replaced once the image is complete.
+			char tempName[FILENAME_MAX];
+			FILE *stream = FileOpenTemp(pOutFile, tempName);
+			if (!stream) {
+				result = ErrorFileOpen;
+			} else if (FileWrite(stream, in.data, dataLen, 1) != 0) {
+				FileDiscard(stream, tempName);
+				result = ErrorFileWrite;
+			} else if (FileCommit(stream, tempName, pOutFile) != 0) {
+				result = ErrorFileWrite;
+			}
+		}
+	}
+
+	close(fd);
+	free(in.data);
+	return result;
+}
+
+static int ServerSendAll(int pFd, void *pBlock, size_t pSize)
+{
+	char *block = (char *)pBlock;
+	while (pSize > 0) {
+		ssize_t n = send(pFd, block, pSize, 0);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		block += n; pSize -= n;
+	}
+	return 0;
+}
+
+static int ServerSendU32(int pFd, uint32_t pValue)
+{
+	return ServerSendAll(pFd, &pValue, sizeof(pValue));
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ServerWorker()
+ *
+ * DESCRIPTION
+ * Worker thread. Takes pending connections off the queue and serves them until the server stops and the
+ * queue is empty.
+ *------------------------------------------------------------------------------------------------------------*/
+static void *ServerWorker(void *pPool)
+{
+	tServerPool *pool = (tServerPool *)pPool;
+	tServerBuf in = { NULL, 0 }, out = { NULL, 0 }, paths = { NULL, 0 };
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		while (pool->count == 0 && !pool->stopping) {
+			pthread_cond_wait(&pool->notEmpty, &pool->lock);
+		}
+		if (pool->count == 0) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		tServerConn conn = pool->pending[pool->head];
+		pool->head = (pool->head + 1) % pool->config->maxPending;
+		--pool->count;
+		pthread_cond_signal(&pool->notFull);
+		pthread_mutex_unlock(&pool->lock);
+
+		ServerHandle(pool->config->cache, &conn, &in, &out, &paths);
+		close(conn.fd);
+	}
+
+	free(in.data);
+	free(out.data);
+	free(paths.data);
+	return NULL;
+}
@@ -0,0 +1,84 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * A long running server which performs image processing requests received over a Unix domain socket, and
+ * the client used to send it requests.
+ *
+ * PROTOCOL
+ * All integers are 32-bit in host byte order (client and server are always on the same machine). A request
+ * is:
+ *
+ *     magic 'BIMP', flags, opCount, opCount x (op, arg[4], coef[6], pathLen, path[pathLen]), inLen, in[inLen],
+ *     outLen, out[outLen]
+ *
+ * where coef[] are 64-bit doubles (the coefficients of --affine and --rotate, otherwise zero) and path is the
+ * absolute path of the file an operation reads (the --overlay image, otherwise empty).
+ *
+ * If bit 0 of flags (cServerInlineIn) is set, 'in' is the BMP image itself, otherwise it is the absolute path
+ * of the BMP file. If bit 1 (cServerInlineOut) is set, the modified image is returned in the response and
+ * 'out' is empty, otherwise 'out' is the absolute path to write the modified image to. The response is:
+ *
+ *     magic 'BIMP', status, queueUs, readUs, opUs, writeUs, dataLen, data[dataLen]
+ *
+ * where status is a tError, the xxxUs values are the time in microseconds the request spent waiting for a
+ * worker, reading the image, performing the operations, and writing the image, and data is the modified
+ * image when cServerInlineOut was requested.
+ **************************************************************************************************************/
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "Cache.h"
+#include "Error.h"
+#include "Op.h"
+
+extern const uint32_t cServerInlineIn;
+extern const uint32_t cServerInlineOut;
+
+// Server configuration.
+typedef struct {
+	tCache	*cache;		// The cache of results, or NULL for no cache.
+	int		maxPending;	// Max accepted requests waiting for a worker before accept() stops.
+	char	*sockPath;	// The path of the Unix domain socket to listen on.
+	int		workers;	// The number of worker threads, i.e., the max number of requests processed at once.
+} tServerConfig;
+
+// Per-request timings in microseconds, as reported by the server.
+typedef struct {
+	uint32_t	queueUs;
+	uint32_t	readUs;
+	uint32_t	opUs;
+	uint32_t	writeUs;
+} tServerTiming;
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ServerRun()
+ *
+ * DESCRIPTION
+ * Listens on the socket pConfig->sockPath and serves requests until SIGINT or SIGTERM is received. Requests
+ * are processed by a pool of pConfig->workers threads, each of which keeps its I/O buffers between requests.
+ * Accepted requests wait in a queue of at most pConfig->maxPending entries; when it is full, no more
+ * connections are accepted so that clients wait in the listen backlog. A socket left at pConfig->sockPath by a
+ * server which has stopped is replaced. Returns ErrorServer if another server is still listening on it, if the
+ * socket could not be set up, or if the workers could not be started, otherwise ErrorNone once the server has
+ * shut down.
+ *------------------------------------------------------------------------------------------------------------*/
+tError ServerRun(tServerConfig *pConfig);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ServerSend()
+ *
+ * DESCRIPTION
+ * Sends a request to the server listening on pSockPath to perform the operations in pQueue on the BMP image
+ * pInFile and write the modified image to pOutFile. If pInline is true, the image bytes are sent to and
+ * returned by the server, and this function writes pOutFile, which, as with BmpWrite(), is only replaced once
+ * the image is complete. Otherwise, only the paths are sent and the server reads and writes the files itself.
+ * The server's timings are stored in pTiming. Returns the status reported by the server, or
+ * ErrorServer/ErrorServerProto if the server could not be reached or replied with garbage.
+ *------------------------------------------------------------------------------------------------------------*/
+tError ServerSend(char *pSockPath, tOpQueue *pQueue, char *pInFile, char *pOutFile, bool pInline,
+	tServerTiming *pTiming);
+
+#endif
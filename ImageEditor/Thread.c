@@ -0,0 +1,75 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * See comments in Thread.h.
+ **************************************************************************************************************/
+#include <pthread.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include "Numa.h"
+#include "Thread.h"
+#include "Tune.h"
+
+// One chunk of a ThreadFor() loop.
+typedef struct {
+	int			begin;
+	tThreadBody	body;
+	void		*context;
+	int			end;
+	int			node;		// The NUMA node the chunk runs on, or -1.
+	int			thread;
+} tThreadChunk;
+
+static void *ThreadRun(void *pChunk);
+
+int ThreadCount()
+{
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	if (TuneGet()->threads > 0 && TuneGet()->threads < count) count = TuneGet()->threads;
+	if (count < 1) return 1;
+	return count < THREAD_MAX ? (int)count : THREAD_MAX;
+}
+
+void ThreadFor(int pCount, int pMinPerThread, tThreadBody pBody, void *pContext)
+{
+	if (pCount <= 0) return;
+	int threads = ThreadCount();
+	if (pMinPerThread < 1) pMinPerThread = 1;
+	if (threads > pCount / pMinPerThread) threads = pCount / pMinPerThread;
+	if (threads < 1) threads = 1;
+
+	// Chunk i is iterations [i * pCount / threads, (i+1) * pCount / threads). With NUMA placement, the range
+	// is also split into one band per node, and each chunk runs on the node of its band.
+	int nodes = NumaNodes();
+	tThreadChunk chunk[THREAD_MAX];
+	pthread_t thread[THREAD_MAX];
+	bool started[THREAD_MAX];
+	for (int i = 0; i < threads; ++i) {
+		chunk[i].begin = (int)((long long)i * pCount / threads);
+		chunk[i].end = (int)((long long)(i + 1) * pCount / threads);
+		chunk[i].body = pBody;
+		chunk[i].context = pContext;
+		chunk[i].node = nodes > 1 ? i * nodes / threads : -1;
+		chunk[i].thread = i;
+	}
+
+	// If a thread cannot be started, its chunk is performed by the calling thread.
+	for (int i = 1; i < threads; ++i) {
+		started[i] = pthread_create(&thread[i], NULL, ThreadRun, &chunk[i]) == 0;
+	}
+	ThreadRun(&chunk[0]);
+	for (int i = 1; i < threads; ++i) {
+		if (started[i]) pthread_join(thread[i], NULL);
+		else ThreadRun(&chunk[i]);
+	}
+	if (nodes > 1) NumaUnbind();
+}
+
+static void *ThreadRun(void *pChunk)
+{
+	tThreadChunk *chunk = (tThreadChunk *)pChunk;
+	if (chunk->node >= 0) NumaBind(chunk->node);
+	chunk->body(chunk->context, chunk->thread, chunk->begin, chunk->end);
+	return NULL;
+}
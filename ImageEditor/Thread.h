@@ -0,0 +1,40 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * A parallel for loop over a range of iterations, e.g., the rows of an image, which divides the range into one
+ * contiguous chunk per thread.
+ **************************************************************************************************************/
+#ifndef THREAD_H
+#define THREAD_H
+
+// The maximum number of threads used by ThreadFor().
+#define THREAD_MAX 64
+
+// The body of a parallel for loop. Performs iterations [pBegin, pEnd) on behalf of thread number pThread,
+// where 0 <= pThread < ThreadCount().
+typedef void (*tThreadBody)(void *pContext, int pThread, int pBegin, int pEnd);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ThreadCount()
+ *
+ * DESCRIPTION
+ * Returns the maximum number of threads used by ThreadFor(), which is the number of online processors (at most
+ * THREAD_MAX), or fewer if the tuning profile says so. Callers which keep per-thread state allocate this many
+ * slots.
+ *------------------------------------------------------------------------------------------------------------*/
+int ThreadCount();
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ThreadFor()
+ *
+ * DESCRIPTION
+ * Performs iterations [0, pCount) of the loop pBody using up to ThreadCount() threads, each of which performs
+ * at least pMinPerThread iterations, so small loops are not slowed down by starting threads. The calling
+ * thread performs the first chunk itself. Returns when all iterations have been performed. With NUMA placement
+ * (see Numa.h), chunk i runs pinned to node i * nodes / threads, so the chunks of node n cover the n-th of
+ * the nodes bands of [0, pCount).
+ *------------------------------------------------------------------------------------------------------------*/
+void ThreadFor(int pCount, int pMinPerThread, tThreadBody pBody, void *pContext);
+
+#endif
@@ -0,0 +1,294 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * See comments in Tile.h.
+ **************************************************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include "File.h"
+#include "Progress.h"
+#include "Tile.h"
+
+// Note: These constants are declared in Tile.h.
+const size_t cTileCacheDefault = 64 << 20;
+
+// The cache always has room for this many tiles. An output tile maps to a source region that may straddle
+// four source tiles, so fewer would make the cache thrash.
+static const size_t cTileCacheMinTiles = 4;
+
+// Maps the pixel in column x, row y of the output image to the pixel in column a*x + b*y + c, row d*x + e*y
+// + f of the source image. Flips, rotations and crops only ever produce coefficients a, b, d, e in {-1, 0, 1}.
+typedef struct {
+	int	a, b, c;
+	int	d, e, f;
+} tTileMap;
+
+static tError	TileCompile(tTileImage *pImage, tOpQueue *pQueue, int *pWidth, int *pHeight, tTileMap *pMap);
+static void		TileEvict(tTileImage *pImage);
+static void		TileLink(tTileImage *pImage, tTile *pTile);
+static void		TileMapThen(tTileMap *pMap, int pA, int pB, int pC, int pD, int pE, int pF);
+static bool		TileRenderTile(tTileImage *pImage, tTileMap *pMap, tPixel *pOut, int pStride, int pX0, int pY0,
+					int pWidth, int pHeight);
+static void		TileUnlink(tTileImage *pImage, tTile *pTile);
+
+void TileClose(tTileImage *pImage)
+{
+	while (pImage->oldest) TileEvict(pImage);
+	free(pImage->index);
+	FileClose(pImage->stream);
+	pImage->index = NULL;
+	pImage->stream = NULL;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: TileCompile()
+ *
+ * DESCRIPTION
+ * Composes the operations in the queue into one mapping from the output image to the source image, and
+ * calculates the dimensions of the output image.
+ *------------------------------------------------------------------------------------------------------------*/
+static tError TileCompile(tTileImage *pImage, tOpQueue *pQueue, int *pWidth, int *pHeight, tTileMap *pMap)
+{
+	int width = pImage->bmp.infoHeader.width, height = pImage->bmp.infoHeader.height;
+	tTileMap identity = { 1, 0, 0, 0, 1, 0 };
+	*pMap = identity;
+
+	// Each operation maps a pixel (x', y') of its output to the pixel (x, y) of its input, which is then
+	// mapped to the source by the operations before it.
+	for (int i = 0; i < pQueue->index; ++i) {
+		int *arg = pQueue->queue[i].arg;
+		switch (pQueue->queue[i].op) {
+			case OperationFlipH:
+				TileMapThen(pMap, -1, 0, width-1, 0, 1, 0);
+				break;
+			case OperationFlipV:
+				TileMapThen(pMap, 1, 0, 0, 0, -1, height-1);
+				break;
+			case OperationRotR:
+				for (int n = (arg[0] % 4 + 4) % 4; n > 0; --n) {
+					TileMapThen(pMap, 0, 1, 0, -1, 0, height-1);
+					int temp = width; width = height; height = temp;
+				}
+				break;
+			case OperationCrop:
+				if (arg[0] < 0 || arg[1] < 0 || arg[0] >= width || arg[1] >= height) return ErrorOpCrop;
+				if (arg[2] <= 0 || arg[3] <= 0) return ErrorOpCrop;
+				TileMapThen(pMap, 1, 0, arg[0], 0, 1, arg[1]);
+				width = arg[2] < width - arg[0] ? arg[2] : width - arg[0];
+				height = arg[3] < height - arg[1] ? arg[3] : height - arg[1];
+				break;
+			default:
+				// TileSupports() rejects every other operation.
+				break;
+		}
+	}
+
+	*pWidth = width;
+	*pHeight = height;
+	return ErrorNone;
+}
+
+static void TileEvict(tTileImage *pImage)
+{
+	tTile *tile = pImage->oldest;
+	TileUnlink(pImage, tile);
+	pImage->index[tile->ty * pImage->tilesX + tile->tx] = NULL;
+	pImage->bytes -= (size_t)pImage->tileSize * pImage->tileSize * sizeof(tPixel);
+	free(tile->pixel);
+	free(tile);
+}
+
+tTile *TileGet(tTileImage *pImage, int pTx, int pTy)
+{
+	tTile **slot = &pImage->index[pTy * pImage->tilesX + pTx];
+	if (*slot) {
+		// Cache hit. Move the tile to the front of the LRU list.
+		TileUnlink(pImage, *slot);
+		TileLink(pImage, *slot);
+		return *slot;
+	}
+
+	// Cache miss. Make room by evicting the least recently used tiles, then read the tile.
+	int size = pImage->tileSize;
+	size_t tileBytes = (size_t)size * size * sizeof(tPixel);
+	while (pImage->oldest && pImage->bytes + tileBytes > pImage->maxBytes) TileEvict(pImage);
+	tTile *tile = (tTile *)malloc(sizeof(tTile));
+	if (!tile) return NULL;
+	tile->pixel = (tPixel *)malloc(tileBytes);
+	if (!tile->pixel) {
+		free(tile);
+		return NULL;
+	}
+	tile->tx = pTx;
+	tile->ty = pTy;
+
+	// Read the part of each scanline covered by the tile. Scanlines are stored bottom to top.
+	int width = pImage->bmp.infoHeader.width, height = pImage->bmp.infoHeader.height;
+	int x0 = pTx * size, y0 = pTy * size;
+	int w = width - x0 < size ? width - x0 : size, h = height - y0 < size ? height - y0 : size;
+	for (int row = 0; row < h; ++row) {
+		off_t offset = pImage->bmp.header.pixelOffset + (off_t)(height-1 - (y0 + row)) * pImage->lineBytes +
+			(off_t)x0 * sizeof(tPixel);
+		if (FileReadAt(pImage->stream, tile->pixel + (size_t)row * size, w * sizeof(tPixel), offset) != 0) {
+			free(tile->pixel);
+			free(tile);
+			return NULL;
+		}
+	}
+
+	TileLink(pImage, tile);
+	*slot = tile;
+	pImage->bytes += tileBytes;
+	++pImage->loads;
+	return tile;
+}
+
+static void TileLink(tTileImage *pImage, tTile *pTile)
+{
+	pTile->newer = NULL;
+	pTile->older = pImage->newest;
+	if (pImage->newest) pImage->newest->newer = pTile;
+	else pImage->oldest = pTile;
+	pImage->newest = pTile;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: TileMapThen()
+ *
+ * DESCRIPTION
+ * Appends an operation to the mapping pMap, where the operation maps pixel (x', y') of its output to pixel
+ * (pA*x' + pB*y' + pC, pD*x' + pE*y' + pF) of its input.
+ *------------------------------------------------------------------------------------------------------------*/
+static void TileMapThen(tTileMap *pMap, int pA, int pB, int pC, int pD, int pE, int pF)
+{
+	tTileMap m = *pMap;
+	pMap->a = m.a * pA + m.b * pD;
+	pMap->b = m.a * pB + m.b * pE;
+	pMap->c = m.a * pC + m.b * pF + m.c;
+	pMap->d = m.d * pA + m.e * pD;
+	pMap->e = m.d * pB + m.e * pE;
+	pMap->f = m.d * pC + m.e * pF + m.f;
+}
+
+tError TileOpen(char *pFilename, int pTileSize, size_t pMaxBytes, tTileImage *pImage)
+{
+	memset(pImage, 0, sizeof(tTileImage));
+	tError result = BmpProbe(pFilename, &pImage->bmp);
+	if (result != ErrorNone) return result;
+	if (pImage->bmp.infoHeader.bitsPerPixel != 24) return ErrorBmpGray;
+	pImage->stream = FileOpen(pFilename, "rb");
+	if (!pImage->stream) return ErrorFileOpen;
+
+	int width = pImage->bmp.infoHeader.width, height = pImage->bmp.infoHeader.height;
+	size_t tileBytes = (size_t)pTileSize * pTileSize * sizeof(tPixel);
+	pImage->tileSize = pTileSize;
+	pImage->tilesX = (width + pTileSize - 1) / pTileSize;
+	pImage->tilesY = (height + pTileSize - 1) / pTileSize;
+	pImage->lineBytes = (size_t)((BmpFileSize(&pImage->bmp) - pImage->bmp.header.pixelOffset) / height);
+	pImage->maxBytes = pMaxBytes > cTileCacheMinTiles * tileBytes ? pMaxBytes : cTileCacheMinTiles * tileBytes;
+	pImage->index = (tTile **)calloc((size_t)pImage->tilesX * pImage->tilesY, sizeof(tTile *));
+	if (!pImage->index) {
+		FileClose(pImage->stream);
+		return ErrorFileRead;
+	}
+	return ErrorNone;
+}
+
+tError TileRender(tTileImage *pImage, tOpQueue *pQueue, char *pFilename)
+{
+	int width, height;
+	tTileMap map;
+	tError result = TileCompile(pImage, pQueue, &width, &height, &map);
+	if (result != ErrorNone) return result;
+
+	// The fields of the info header which are not about the layout, e.g., the resolution, are those of the
+	// source, as when the whole image is read and written.
+	tBmp out;
+	BmpInit(&out, width, height);
+	memcpy(out.infoHeader.zeros, pImage->bmp.infoHeader.zeros, sizeof(out.infoHeader.zeros));
+	char tempName[FILENAME_MAX];
+	FILE *stream = FileOpenTemp(pFilename, tempName);
+	if (!stream) return ErrorFileOpen;
+	result = BmpWriteHeaders(stream, &out);
+
+	int size = pImage->tileSize;
+	tPixel *band = (tPixel *)malloc((size_t)size * width * sizeof(tPixel));
+	if (!band) result = ErrorFileWrite;
+
+	// Scanlines are stored bottom to top, so the bands of output tiles are rendered bottom to top too.
+	long tilesX = (width + size - 1) / size, tilesY = (height + size - 1) / size;
+	ProgressBegin("render", tilesX * tilesY, "tiles");
+	for (int y0 = (height-1) / size * size; y0 >= 0 && result == ErrorNone; y0 -= size) {
+		int rows = height - y0 < size ? height - y0 : size;
+		for (int x0 = 0; x0 < width && result == ErrorNone; x0 += size) {
+			int cols = width - x0 < size ? width - x0 : size;
+			if (!TileRenderTile(pImage, &map, band + x0, width, x0, y0, cols, rows)) result = ErrorFileRead;
+			else if (!ProgressStep(1)) result = ErrorCancelled;
+		}
+		for (int row = rows-1; row >= 0 && result == ErrorNone; --row) {
+			result = BmpWriteRow(stream, band + (size_t)row * width, width);
+		}
+	}
+
+	free(band);
+	if (result != ErrorNone) {
+		FileDiscard(stream, tempName);
+	} else if (FileCommit(stream, tempName, pFilename) != 0) {
+		result = ErrorFileWrite;
+	}
+	return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: TileRenderTile()
+ *
+ * DESCRIPTION
+ * Renders the pWidth x pHeight output tile whose upper left pixel is (pX0, pY0) into pOut, which has a row
+ * stride of pStride pixels. Stepping one pixel right in the output steps (a, d) in the source, so the source
+ * coordinates are updated incrementally and the source tile is only looked up when it changes.
+ *------------------------------------------------------------------------------------------------------------*/
+static bool TileRenderTile(tTileImage *pImage, tTileMap *pMap, tPixel *pOut, int pStride, int pX0, int pY0,
+	int pWidth, int pHeight)
+{
+	int size = pImage->tileSize;
+	tTile *tile = NULL;
+	for (int y = 0; y < pHeight; ++y) {
+		int sx = pMap->a * pX0 + pMap->b * (pY0 + y) + pMap->c;
+		int sy = pMap->d * pX0 + pMap->e * (pY0 + y) + pMap->f;
+		tPixel *out = pOut + (size_t)y * pStride;
+		for (int x = 0; x < pWidth; ++x, sx += pMap->a, sy += pMap->d) {
+			int tx = sx / size, ty = sy / size;
+			if (!tile || tile->tx != tx || tile->ty != ty) {
+				tile = TileGet(pImage, tx, ty);
+				if (!tile) return false;
+			}
+			out[x] = tile->pixel[(size_t)(sy - ty * size) * size + (sx - tx * size)];
+		}
+	}
+	return true;
+}
+
+bool TileSupports(tOpQueue *pQueue)
+{
+	for (int i = 0; i < pQueue->index; ++i) {
+		switch (pQueue->queue[i].op) {
+			case OperationCrop:
+			case OperationFlipH:
+			case OperationFlipV:
+			case OperationRotR:
+				break;
+			default:
+				return false;
+		}
+	}
+	return true;
+}
+
+static void TileUnlink(tTileImage *pImage, tTile *pTile)
+{
+	if (pTile->newer) pTile->newer->older = pTile->older;
+	else pImage->newest = pTile->older;
+	if (pTile->older) pTile->older->newer = pTile->newer;
+	else pImage->oldest = pTile->newer;
+}
@@ -0,0 +1,95 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * A tiled image backend. Instead of reading the whole pixel array into memory like BmpRead(), the source image
+ * is divided into square tiles which are read from the file the first time they are touched and kept in a
+ * least recently used (LRU) cache whose size is capped. The operations in an operation queue are compiled
+ * into one mapping from output pixels to source pixels, and the output is rendered one tile at a time, so
+ * only the source tiles that contribute to the output are ever read.
+ **************************************************************************************************************/
+#ifndef TILE_H
+#define TILE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include "Bmp.h"
+#include "Error.h"
+#include "Op.h"
+
+extern const size_t cTileCacheDefault;
+
+// A cached tile. Tiles on the right and bottom edges of the image may be smaller than tileSize x tileSize.
+typedef struct tTile {
+	tPixel			*pixel;		// The tile's pixels, row by row, with a row stride of tileSize pixels.
+	struct tTile	*newer;		// The next more recently used tile in the LRU list.
+	struct tTile	*older;		// The next less recently used tile in the LRU list.
+	int				tx;			// The column of the tile in the grid of tiles.
+	int				ty;			// The row of the tile in the grid of tiles.
+} tTile;
+
+// A source image opened with TileOpen().
+typedef struct {
+	tBmp		bmp;		// The headers of the image. bmp.pixel is always NULL.
+	size_t		bytes;		// The number of bytes of pixels in the cache.
+	tTile		**index;	// tilesX x tilesY table of pointers to the cached tiles, NULL if not cached.
+	size_t		lineBytes;	// The size of a scanline in the file, including padding.
+	long		loads;		// The number of tiles read from the file.
+	size_t		maxBytes;	// The cap on bytes. The least recently used tiles are evicted to stay under it.
+	tTile		*newest;	// The most recently used tile.
+	tTile		*oldest;	// The least recently used tile.
+	FILE		*stream;	// The open image file.
+	int			tilesX;		// The number of columns of tiles.
+	int			tilesY;		// The number of rows of tiles.
+	int			tileSize;	// The width and height of a tile in pixels.
+} tTileImage;
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: TileClose()
+ *
+ * DESCRIPTION
+ * Closes the image file and frees the tile cache.
+ *------------------------------------------------------------------------------------------------------------*/
+void TileClose(tTileImage *pImage);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: TileGet()
+ *
+ * DESCRIPTION
+ * Returns the tile in column pTx, row pTy of the tile grid, reading it from the file if it is not cached.
+ * Returns NULL if the tile could not be read.
+ *------------------------------------------------------------------------------------------------------------*/
+tTile *TileGet(tTileImage *pImage, int pTx, int pTy);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: TileOpen()
+ *
+ * DESCRIPTION
+ * Opens the BMP image pFilename as a tiled image with pTileSize x pTileSize tiles and a cache of at most
+ * pMaxBytes bytes of pixels (at least one tile is always cached). Only the headers are read. Returns
+ * ErrorBmpGray for an 8-bit gray image, as only 24-bit images are read.
+ *------------------------------------------------------------------------------------------------------------*/
+tError TileOpen(char *pFilename, int pTileSize, size_t pMaxBytes, tTileImage *pImage);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: TileRender()
+ *
+ * DESCRIPTION
+ * Performs the operations in pQueue on the tiled image pImage and writes the result to the BMP file
+ * pFilename, which may be the file pImage was opened from. The output is rendered one tile at a time into a
+ * band of tileSize scanlines which is written out before the next band is rendered. The file is written via a
+ * temporary file and a rename. Returns ErrorOpCrop if a crop rectangle does not overlap the image, or
+ * ErrorCancelled if the job is cancelled (see Progress.h).
+ *------------------------------------------------------------------------------------------------------------*/
+tError TileRender(tTileImage *pImage, tOpQueue *pQueue, char *pFilename);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: TileSupports()
+ *
+ * DESCRIPTION
+ * Returns true if every operation in pQueue can be performed by TileRender(). These are the operations which
+ * move pixels without changing them: crop, flips, and rotations.
+ *------------------------------------------------------------------------------------------------------------*/
+bool TileSupports(tOpQueue *pQueue);
+
+#endif
@@ -0,0 +1,311 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * See comments in Tune.h.
+ **************************************************************************************************************/
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "Bmp.h"
+#include "File.h"
+#include "Hist.h"
+#include "Image.h"
+#include "Op.h"
+#include "String.h"
+#include "Thread.h"
+#include "Tile.h"
+#include "Tune.h"
+
+// Note: This constant is declared in Tune.h.
+const tTune cTuneDefault = { 1 << 18, 64, 0, 256 };
+
+// The size of the synthetic image the kernels are benchmarked on. It is much larger than the caches, as the
+// images we process are.
+static const int cTuneWidth  = 2048;
+static const int cTuneHeight = 1536;
+
+// Each candidate is timed this many times and its fastest time is kept, which filters out the noise caused by
+// other processes.
+static const int cTuneReps = 3;
+
+// A larger candidate replaces a smaller one only if it is faster by more than this fraction, so that noise
+// does not make the profile flip between equally good values.
+static const double cTuneMargin = 0.03;
+
+// The candidate values of the parameters. The thread counts are the powers of two up to the number of online
+// processors, and the number of online processors.
+static const int cTuneIoBytes[]   = { 1 << 14, 1 << 16, 1 << 18, 1 << 20, 1 << 22 };
+static const int cTuneRotBlocks[] = { 8, 16, 32, 64, 128, 256 };
+static const int cTuneTileSizes[] = { 64, 128, 256, 512 };
+
+// The state shared by the benchmarks.
+typedef struct {
+	tBmp		bmp;						// The synthetic image.
+	char		inFile[FILENAME_MAX];		// The temporary file the image is written to.
+	char		outFile[FILENAME_MAX];		// The temporary file --tiled renders to.
+	tOpQueue	queue;						// The operations --tiled performs.
+} tTuneBench;
+
+// A benchmark. Performs the kernel once with the parameters in effect and returns ErrorFileWrite if a
+// temporary file could not be written or read, ErrorTune if memory ran out, or ErrorNone.
+typedef tError (*tTuneKernel)(tTuneBench *pBench);
+
+static tTune sTune;
+static const tTune *sInEffect = &cTuneDefault;
+
+static tError	TuneBest(FILE *pReport, char *pName, int *pParam, const int *pValues, int pCount,
+					tTuneKernel pKernel, tTuneBench *pBench);
+static tError	TuneKernelHist(tTuneBench *pBench);
+static tError	TuneKernelIo(tTuneBench *pBench);
+static tError	TuneKernelRot(tTuneBench *pBench);
+static tError	TuneKernelTile(tTuneBench *pBench);
+static double	TuneNow();
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: TuneBest()
+ *
+ * DESCRIPTION
+ * Times pKernel with each of the pCount candidate values pValues of the parameter *pParam, which is left set
+ * to the fastest one. Returns the error of the kernel if it failed.
+ *------------------------------------------------------------------------------------------------------------*/
+static tError TuneBest(FILE *pReport, char *pName, int *pParam, const int *pValues, int pCount,
+	tTuneKernel pKernel, tTuneBench *pBench)
+{
+	int best = pValues[0];
+	double bestTime = 0.0;
+	for (int i = 0; i < pCount; ++i) {
+		*pParam = pValues[i];
+		double time = 0.0;
+		for (int rep = 0; rep < cTuneReps; ++rep) {
+			double start = TuneNow();
+			tError result = pKernel(pBench);
+			if (result != ErrorNone) return result;
+			double elapsed = TuneNow() - start;
+			if (rep == 0 || elapsed < time) time = elapsed;
+		}
+		fprintf(pReport, "    %-10s %8d  %9.2f ms\n", pName, pValues[i], time * 1000.0);
+		if (i == 0 || time < bestTime * (1.0 - cTuneMargin)) {
+			best = pValues[i];
+			bestTime = time;
+		}
+	}
+	*pParam = best;
+	fprintf(pReport, "%s %d\n", pName, best);
+	return ErrorNone;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: TuneKernelHist()
+ *
+ * DESCRIPTION
+ * The benchmark of the thread count: computing the histogram, which is limited by memory bandwidth as most of
+ * the parallel kernels are.
+ *------------------------------------------------------------------------------------------------------------*/
+static tError TuneKernelHist(tTuneBench *pBench)
+{
+	tHist hist;
+	HistCompute(&pBench->bmp, &hist);
+	return ErrorNone;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: TuneKernelIo()
+ *
+ * DESCRIPTION
+ * The benchmark of the I/O size: writing the image to a file and reading it back.
+ *------------------------------------------------------------------------------------------------------------*/
+static tError TuneKernelIo(tTuneBench *pBench)
+{
+	tBmp copy;
+	if (BmpWrite(pBench->inFile, &pBench->bmp) != ErrorNone) return ErrorFileWrite;
+	if (BmpRead(pBench->inFile, &copy, NULL) != ErrorNone) return ErrorFileWrite;
+	BmpPixelFree(copy.pixel, copy.infoHeader.height);
+	return ErrorNone;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: TuneKernelRot()
+ *
+ * DESCRIPTION
+ * The benchmark of the rotation block size: rotating the image right. Successive runs alternate between the
+ * two orientations of the image. If the rotated image cannot be allocated, the image is left as it is.
+ *------------------------------------------------------------------------------------------------------------*/
+static tError TuneKernelRot(tTuneBench *pBench)
+{
+	return ImageRotRight(&pBench->bmp) == ErrorNone ? ErrorNone : ErrorTune;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: TuneKernelTile()
+ *
+ * DESCRIPTION
+ * The benchmark of the tile size: rotating the image file right with --tiled.
+ *------------------------------------------------------------------------------------------------------------*/
+static tError TuneKernelTile(tTuneBench *pBench)
+{
+	tTileImage image;
+	if (TileOpen(pBench->inFile, sTune.tileSize, cTileCacheDefault, &image) != ErrorNone) return ErrorFileWrite;
+	tError result = TileRender(&image, &pBench->queue, pBench->outFile);
+	TileClose(&image);
+	return result == ErrorNone ? ErrorNone : ErrorFileWrite;
+}
+
+const tTune *TuneGet()
+{
+	return sInEffect;
+}
+
+tError TuneLoad(char *pFilename)
+{
+	FILE *stream = FileOpen(pFilename, "rt");
+	if (!stream) return ErrorFileOpen;
+
+	tTune tune = *sInEffect;
+	char line[256], name[64];
+	long value;
+	int end;
+	bool valid = true;
+	while (valid && fgets(line, sizeof(line), stream)) {
+		char *text = line + strspn(line, " \t\r\n");
+		if (*text == '\0' || *text == '#') continue;
+		end = 0;
+		valid = sscanf(line, "%63s %ld %n", name, &value, &end) == 2 && line[end] == '\0';
+		if (!valid) continue;
+		if (streq(name, "io-bytes")) {
+			valid = value >= 4096 && value <= 1 << 28;
+			tune.ioBytes = (int)value;
+		} else if (streq(name, "rot-block")) {
+			valid = value >= 1 && value <= 4096;
+			tune.rotBlock = (int)value;
+		} else if (streq(name, "threads")) {
+			valid = value >= 0 && value <= THREAD_MAX;
+			tune.threads = (int)value;
+		} else if (streq(name, "tile-size")) {
+			valid = value >= 16 && value <= 4096;
+			tune.tileSize = (int)value;
+		}
+	}
+	FileClose(stream);
+	if (!valid) return ErrorTune;
+	sTune = tune;
+	sInEffect = &sTune;
+	return ErrorNone;
+}
+
+tError TuneMeasure(char *pTempDir, FILE *pReport)
+{
+	tTuneBench bench;
+	memset(&bench, 0, sizeof(tTuneBench));
+	sTune = *sInEffect;
+	sInEffect = &sTune;
+
+	// Reserve the names of the temporary files.
+	char prefix[FILENAME_MAX];
+	FILE *stream[2] = { NULL, NULL };
+	if (snprintf(prefix, sizeof(prefix), "%s/bimpie-tune", pTempDir) < (int)sizeof(prefix)) {
+		stream[0] = FileOpenTemp(prefix, bench.inFile);
+		stream[1] = FileOpenTemp(prefix, bench.outFile);
+	}
+	for (int i = 0; i < 2; ++i) if (stream[i]) fclose(stream[i]);
+	if (!stream[0] || !stream[1]) {
+		if (stream[0]) remove(bench.inFile);
+		if (stream[1]) remove(bench.outFile);
+		return ErrorFileWrite;
+	}
+
+	// The synthetic image is a pattern which, unlike a constant image, gives the histogram a realistic spread.
+	bench.bmp.header.sigB = 'B';
+	bench.bmp.header.sigM = 'M';
+	bench.bmp.header.pixelOffset = 0x36;
+	bench.bmp.infoHeader.size = 0x28;
+	bench.bmp.infoHeader.width = cTuneWidth;
+	bench.bmp.infoHeader.height = cTuneHeight;
+	bench.bmp.infoHeader.colorPlanes = 1;
+	bench.bmp.infoHeader.bitsPerPixel = 24;
+	bench.bmp.pixel = BmpPixelAlloc(cTuneWidth, cTuneHeight);
+	if (!bench.bmp.pixel) {
+		remove(bench.inFile);
+		remove(bench.outFile);
+		return ErrorTune;
+	}
+	for (int row = 0; row < cTuneHeight; ++row) {
+		for (int col = 0; col < cTuneWidth; ++col) {
+			bench.bmp.pixel[row][col].blue = (byte)(col ^ row);
+			bench.bmp.pixel[row][col].green = (byte)(col + 3 * row);
+			bench.bmp.pixel[row][col].red = (byte)(col * row >> 4);
+		}
+	}
+	OpQueueAdd(&bench.queue, OperationRotR)->arg[0] = 1;
+
+	// The thread counts are measured with every thread allowed to run.
+	int threads[THREAD_MAX + 1], threadCount = 0;
+	sTune.threads = 0;
+	int online = ThreadCount();
+	for (int n = 1; n < online; n *= 2) threads[threadCount++] = n;
+	threads[threadCount++] = online;
+
+	tError result = TuneBest(pReport, "threads", &sTune.threads, threads, threadCount, TuneKernelHist, &bench);
+	if (result == ErrorNone) {
+		result = TuneBest(pReport, "rot-block", &sTune.rotBlock, cTuneRotBlocks,
+			sizeof(cTuneRotBlocks) / sizeof(cTuneRotBlocks[0]), TuneKernelRot, &bench);
+	}
+	if (result == ErrorNone) {
+		result = TuneBest(pReport, "io-bytes", &sTune.ioBytes, cTuneIoBytes,
+			sizeof(cTuneIoBytes) / sizeof(cTuneIoBytes[0]), TuneKernelIo, &bench);
+	}
+	if (result == ErrorNone) {
+		result = TuneBest(pReport, "tile-size", &sTune.tileSize, cTuneTileSizes,
+			sizeof(cTuneTileSizes) / sizeof(cTuneTileSizes[0]), TuneKernelTile, &bench);
+	}
+
+	// Using every online processor is stored as 0, so that the profile still works if processors are added.
+	if (sTune.threads == online) sTune.threads = 0;
+
+	BmpPixelFree(bench.bmp.pixel, bench.bmp.infoHeader.height);
+	remove(bench.inFile);
+	remove(bench.outFile);
+	return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: TuneNow()
+ *
+ * DESCRIPTION
+ * Returns the time in seconds on a clock which is not affected by changes to the time of day.
+ *------------------------------------------------------------------------------------------------------------*/
+static double TuneNow()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + now.tv_nsec / 1e9;
+}
+
+bool TunePath(char *pPath)
+{
+	char *env = getenv("BIMPIE_TUNE"), *home = getenv("HOME"), host[256];
+	if (env && *env) return snprintf(pPath, PATH_MAX, "%s", env) < PATH_MAX;
+	if (!home || !*home) return false;
+	if (gethostname(host, sizeof(host)) != 0) strcpy(host, "localhost");
+	host[sizeof(host) - 1] = '\0';
+	return snprintf(pPath, PATH_MAX, "%s/.bimpie-tune-%s", home, host) < PATH_MAX;
+}
+
+tError TuneSave(char *pFilename)
+{
+	char tempName[FILENAME_MAX];
+	FILE *stream = FileOpenTemp(pFilename, tempName);
+	if (!stream) return ErrorFileWrite;
+	fprintf(stream, "# Tuning profile written by bimpie --tune.\n");
+	fprintf(stream, "io-bytes %d\n", sInEffect->ioBytes);
+	fprintf(stream, "rot-block %d\n", sInEffect->rotBlock);
+	fprintf(stream, "threads %d\n", sInEffect->threads);
+	fprintf(stream, "tile-size %d\n", sInEffect->tileSize);
+	if (ferror(stream)) {
+		FileDiscard(stream, tempName);
+		return ErrorFileWrite;
+	}
+	return FileCommit(stream, tempName, pFilename) == 0 ? ErrorNone : ErrorFileWrite;
+}
@@ -0,0 +1,77 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * The machine dependent parameters of the image kernels and of image I/O, e.g., the number of threads and the
+ * size of the blocks a rotation is performed in. --tune measures the best values on the current machine and
+ * saves them in a tuning profile, which later runs load at startup. Without a profile, the defaults are used.
+ *
+ * A tuning profile is a text file with one "name value" pair per line. Lines starting with '#' are comments.
+ **************************************************************************************************************/
+#ifndef TUNE_H
+#define TUNE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include "Error.h"
+
+// The tunable parameters.
+typedef struct {
+	int		ioBytes;	// Bytes of scanlines read or written at once by the Bmp functions.
+	int		rotBlock;	// Width and height in pixels of the blocks ImageRotRight() copies one at a time.
+	int		threads;	// Max number of threads used by ThreadFor(), 0 for one per online processor.
+	int		tileSize;	// Width and height in pixels of the tiles of --tiled.
+} tTune;
+
+extern const tTune cTuneDefault;
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: TuneGet()
+ *
+ * DESCRIPTION
+ * Returns the parameters in effect: cTuneDefault until a profile is loaded or measured.
+ *------------------------------------------------------------------------------------------------------------*/
+const tTune *TuneGet();
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: TuneLoad()
+ *
+ * DESCRIPTION
+ * Loads the tuning profile pFilename. Returns ErrorFileOpen if there is no such file, and ErrorTune if the
+ * file is not a valid profile, in which case the parameters in effect are left unchanged. Unknown names are
+ * ignored so that profiles written by newer versions can be read; missing names keep their default values.
+ *------------------------------------------------------------------------------------------------------------*/
+tError TuneLoad(char *pFilename);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: TuneMeasure()
+ *
+ * DESCRIPTION
+ * Benchmarks the candidate values of each parameter on a synthetic image and puts the fastest into effect. The
+ * I/O benchmarks write and read a temporary file in pTempDir. The time of every candidate is written to
+ * pReport. Takes a few seconds. Returns ErrorFileWrite if the temporary file could not be written, and
+ * ErrorTune if there is not enough memory for the synthetic image or its rotation.
+ *------------------------------------------------------------------------------------------------------------*/
+tError TuneMeasure(char *pTempDir, FILE *pReport);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: TunePath()
+ *
+ * DESCRIPTION
+ * Stores the path of this machine's tuning profile in pPath, which has room for PATH_MAX chars: the value of
+ * the environment variable BIMPIE_TUNE if it is set, otherwise ~/.bimpie-tune-<hostname>. The host name is part
+ * of the name because home directories are often shared by machines which need different profiles. Returns
+ * false if there is no home directory.
+ *------------------------------------------------------------------------------------------------------------*/
+bool TunePath(char *pPath);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: TuneSave()
+ *
+ * DESCRIPTION
+ * Writes the parameters in effect to the tuning profile pFilename, via a temporary file and a rename so that
+ * a concurrent run never loads half a profile. Returns ErrorFileWrite on failure.
+ *------------------------------------------------------------------------------------------------------------*/
+tError TuneSave(char *pFilename);
+
+#endif
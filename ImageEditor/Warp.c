@@ -0,0 +1,304 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * See comments in Warp.h.
+ **************************************************************************************************************/
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include "Progress.h"
+#include "Thread.h"
+#include "Warp.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// The width and height of the output tiles rendered by each thread.
+static const int cWarpTile = 64;
+
+// Transforms whose determinant is smaller than this are treated as not invertible.
+static const double cWarpMinDet = 1e-9;
+
+// The largest output canvas, in pixels.
+static const double cWarpMaxPixels = (double)(1 << 29);
+
+// The corners of the transformed image are rounded to whole pixels if they are this close to one, so that
+// the rounding errors of sin() and cos() do not add a row or column to, e.g., a rotation by 90 degs.
+static const double cWarpSnap = 1e-6;
+
+// Input coordinates are in 16.16 fixed point, and sampling weights use the top 8 bits of the fraction.
+#define WARP_FRAC_BITS 16
+#define WARP_PHASES    256
+
+// A warp in progress, shared by the threads.
+typedef struct {
+	tPixel		background;
+	double		c, f;				// The translation of the forward transform.
+	double		ia, ib, id, ie;		// The matrix of the inverse transform.
+	tWarpInterp	interp;
+	tPixel		**out;
+	int			outWidth;
+	int			outHeight;
+	tBmp		*src;
+	int			taps;				// The sampled neighborhood is taps x taps pixels.
+	int			tilesX;
+	int			weight[WARP_PHASES][4];	// The weights of the taps for each phase, summing to 256.
+	double		x0, y0;				// The position of the upper left corner of the canvas.
+} tWarpJob;
+
+static int64_t	WarpFloor(int64_t pFixed);
+static void		WarpInitWeights(tWarpJob *pJob);
+static tPixel	WarpSample(tWarpJob *pJob, int64_t pU, int64_t pV);
+#ifdef __SSE2__
+static int		WarpTapsSse2(tWarpJob *pJob, int64_t pX0, int64_t pY0, int *pWx, int *pWy, int *pSum);
+#endif
+static void		WarpTiles(void *pJob, int pThread, int pBegin, int pEnd);
+
+tError WarpAffine(tBmp *pBmp, double *pCoef, tWarpInterp pInterp, tPixel pBackground)
+{
+	for (int i = 0; i < 6; ++i) {
+		if (!isfinite(pCoef[i])) return ErrorOpWarp;
+	}
+	double a = pCoef[0], b = pCoef[1], c = pCoef[2], d = pCoef[3], e = pCoef[4], f = pCoef[5];
+	double det = a * e - b * d;
+	if (fabs(det) < cWarpMinDet) return ErrorOpWarp;
+
+	// The canvas is the bounding box of the four transformed corners of the image.
+	int width = pBmp->infoHeader.width, height = pBmp->infoHeader.height;
+	double minX = INFINITY, maxX = -INFINITY, minY = INFINITY, maxY = -INFINITY;
+	for (int corner = 0; corner < 4; ++corner) {
+		double x = (corner & 1) ? width : 0, y = (corner & 2) ? height : 0;
+		double tx = a * x + b * y + c, ty = d * x + e * y + f;
+		if (tx < minX) minX = tx;
+		if (tx > maxX) maxX = tx;
+		if (ty < minY) minY = ty;
+		if (ty > maxY) maxY = ty;
+	}
+	minX = floor(minX + cWarpSnap);
+	minY = floor(minY + cWarpSnap);
+	maxX = ceil(maxX - cWarpSnap);
+	maxY = ceil(maxY - cWarpSnap);
+	if (maxX - minX < 1 || maxY - minY < 1 || (maxX - minX) * (maxY - minY) > cWarpMaxPixels) return ErrorOpWarp;
+
+	tWarpJob job;
+	job.background = pBackground;
+	job.c = c;
+	job.f = f;
+	job.ia = e / det;
+	job.ib = -b / det;
+	job.id = -d / det;
+	job.ie = a / det;
+	job.interp = pInterp;
+	job.outWidth = (int)(maxX - minX);
+	job.outHeight = (int)(maxY - minY);
+	job.out = BmpPixelAlloc(job.outWidth, job.outHeight);
+	if (!job.out) return ErrorOpWarp;
+	job.src = pBmp;
+	job.tilesX = (job.outWidth + cWarpTile - 1) / cWarpTile;
+	job.x0 = minX;
+	job.y0 = minY;
+	WarpInitWeights(&job);
+
+	int tiles = job.tilesX * ((job.outHeight + cWarpTile - 1) / cWarpTile);
+	ThreadFor(tiles, 1, WarpTiles, &job);
+
+	BmpPixelFree(pBmp->pixel, pBmp->infoHeader.height);
+	pBmp->infoHeader.width = job.outWidth;
+	pBmp->infoHeader.height = job.outHeight;
+	pBmp->pixel = job.out;
+	return ErrorNone;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: WarpFloor()
+ *
+ * DESCRIPTION
+ * Returns the integer part of the 16.16 fixed point number pFixed, rounded down, also when it is negative.
+ *------------------------------------------------------------------------------------------------------------*/
+static int64_t WarpFloor(int64_t pFixed)
+{
+	int64_t one = (int64_t)1 << WARP_FRAC_BITS;
+	return pFixed >= 0 ? pFixed / one : -((-pFixed + one - 1) / one);
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: WarpInitWeights()
+ *
+ * DESCRIPTION
+ * Computes the weights of the taps for each phase, i.e., each fraction of a pixel the sampled point may be
+ * past the first tap's pixel, rounded to integers which sum to 256.
+ *------------------------------------------------------------------------------------------------------------*/
+static void WarpInitWeights(tWarpJob *pJob)
+{
+	pJob->taps = pJob->interp == WarpBicubic ? 4 : pJob->interp == WarpBilinear ? 2 : 1;
+	for (int phase = 0; phase < WARP_PHASES; ++phase) {
+		double t = (double)phase / WARP_PHASES, w[4] = { 1.0, 0.0, 0.0, 0.0 };
+		if (pJob->interp == WarpBilinear) {
+			w[0] = 1.0 - t;
+			w[1] = t;
+		} else if (pJob->interp == WarpBicubic) {
+			// Catmull-Rom weights of the pixels at -1, 0, 1, and 2 relative to the point's pixel.
+			w[0] = ((-0.5 * t + 1.0) * t - 0.5) * t;
+			w[1] = (1.5 * t - 2.5) * t * t + 1.0;
+			w[2] = ((-1.5 * t + 2.0) * t + 0.5) * t;
+			w[3] = (0.5 * t - 0.5) * t * t;
+		}
+
+		// Give the rounding error to the largest weight so that flat areas keep their exact color.
+		int sum = 0, largest = 0;
+		for (int k = 0; k < 4; ++k) {
+			pJob->weight[phase][k] = (int)lround(w[k] * 256.0);
+			sum += pJob->weight[phase][k];
+			if (w[k] > w[largest]) largest = k;
+		}
+		pJob->weight[phase][largest] += 256 - sum;
+	}
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: WarpSample()
+ *
+ * DESCRIPTION
+ * Returns the color of the input image at the point (pU, pV), in 16.16 fixed point pixel coordinates where
+ * pixel (i, j) is at (i, j). Pixels outside the image have the background color, so the edges of the image
+ * are blended into the background.
+ *------------------------------------------------------------------------------------------------------------*/
+static tPixel WarpSample(tWarpJob *pJob, int64_t pU, int64_t pV)
+{
+	int width = pJob->src->infoHeader.width, height = pJob->src->infoHeader.height;
+	int64_t half = (int64_t)1 << (WARP_FRAC_BITS - 1);
+
+	if (pJob->taps == 1) {
+		int64_t x = WarpFloor(pU + half), y = WarpFloor(pV + half);
+		if (x < 0 || y < 0 || x >= width || y >= height) return pJob->background;
+		return pJob->src->pixel[y][x];
+	}
+
+	// The first tap is the pixel before the point's pixel for bicubic sampling.
+	int64_t xi = WarpFloor(pU), yi = WarpFloor(pV);
+	int *wx = pJob->weight[(pU - xi * ((int64_t)1 << WARP_FRAC_BITS)) >> (WARP_FRAC_BITS - 8)];
+	int *wy = pJob->weight[(pV - yi * ((int64_t)1 << WARP_FRAC_BITS)) >> (WARP_FRAC_BITS - 8)];
+	int64_t x0 = xi - (pJob->taps == 4), y0 = yi - (pJob->taps == 4);
+	if (x0 + pJob->taps <= 0 || y0 + pJob->taps <= 0 || x0 >= width || y0 >= height) return pJob->background;
+	bool inside = x0 >= 0 && y0 >= 0 && x0 + pJob->taps <= width && y0 + pJob->taps <= height;
+
+	int sum[3] = { 0, 0, 0 }, ky = 0;
+#ifdef __SSE2__
+	if (inside) ky = WarpTapsSse2(pJob, x0, y0, wx, wy, sum);
+#endif
+	for (; ky < pJob->taps; ++ky) {
+		int64_t y = y0 + ky;
+		tPixel *row = (inside || (y >= 0 && y < height)) ? pJob->src->pixel[y] : NULL;
+		int rowSum[3] = { 0, 0, 0 };
+		for (int kx = 0; kx < pJob->taps; ++kx) {
+			int64_t x = x0 + kx;
+			tPixel *tap = (row && (inside || (x >= 0 && x < width))) ? &row[x] : &pJob->background;
+			rowSum[0] += wx[kx] * tap->blue;
+			rowSum[1] += wx[kx] * tap->green;
+			rowSum[2] += wx[kx] * tap->red;
+		}
+		for (int ch = 0; ch < 3; ++ch) sum[ch] += wy[ky] * rowSum[ch];
+	}
+
+	// The weights sum to 256 in each direction. Bicubic weights can be negative, so clamp.
+	byte value[3];
+	for (int ch = 0; ch < 3; ++ch) {
+		int v = (sum[ch] + (1 << 15)) / (1 << 16);
+		value[ch] = sum[ch] < 0 ? 0 : v > 255 ? 255 : (byte)v;
+	}
+	tPixel pixel = { value[0], value[1], value[2] };
+	return pixel;
+}
+
+#ifdef __SSE2__
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: WarpTapsSse2()
+ *
+ * DESCRIPTION
+ * Does the work of the loop over the taps of WarpSample() when they are all inside the image, adding to pSum
+ * and returning the number of rows of taps done. The channels of two neighboring taps are interleaved into the
+ * 16-bit lanes blue, blue, green, green, red, red, so that pmaddwd multiplies them by their weights pWx and sums
+ * each channel over the two taps at once. The sums are exactly those of the scalar loop.
+ *------------------------------------------------------------------------------------------------------------*/
+static int WarpTapsSse2(tWarpJob *pJob, int64_t pX0, int64_t pY0, int *pWx, int *pWy, int *pSum)
+{
+	__m128i weight01 = _mm_setr_epi16((short)pWx[0], (short)pWx[1], (short)pWx[0], (short)pWx[1], (short)pWx[0],
+		(short)pWx[1], 0, 0);
+	__m128i weight23 = _mm_setr_epi16((short)pWx[2], (short)pWx[3], (short)pWx[2], (short)pWx[3], (short)pWx[2],
+		(short)pWx[3], 0, 0);
+	__m128i zero = _mm_setzero_si128();
+
+	for (int ky = 0; ky < pJob->taps; ++ky) {
+		// Only the bytes of the taps are read, as the row may end right after them.
+		const byte *tap = (const byte *)&pJob->src->pixel[pY0 + ky][pX0];
+		int32_t head;
+		memcpy(&head, tap, sizeof(head));
+		__m128i bytes;
+		if (pJob->taps == 4) {
+			int32_t tail;
+			memcpy(&tail, tap + 8, sizeof(tail));
+			bytes = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)tap), _mm_cvtsi32_si128(tail));
+		} else {
+			uint16_t tail;
+			memcpy(&tail, tap + 4, sizeof(tail));
+			bytes = _mm_insert_epi16(_mm_cvtsi32_si128(head), tail, 2);
+		}
+
+		// Pairing each tap's lanes with those of the next tap, 3 lanes on, gives b0 b1 g0 g1 r0 r1 in the first 6.
+		__m128i lanes = _mm_unpacklo_epi8(bytes, zero);
+		__m128i rowSum = _mm_madd_epi16(_mm_unpacklo_epi16(lanes, _mm_srli_si128(lanes, 6)), weight01);
+		if (pJob->taps == 4) {
+			lanes = _mm_unpacklo_epi8(_mm_srli_si128(bytes, 6), zero);
+			rowSum = _mm_add_epi32(rowSum, _mm_madd_epi16(_mm_unpacklo_epi16(lanes, _mm_srli_si128(lanes, 6)),
+				weight23));
+		}
+		pSum[0] += pWy[ky] * _mm_cvtsi128_si32(rowSum);
+		pSum[1] += pWy[ky] * _mm_cvtsi128_si32(_mm_srli_si128(rowSum, 4));
+		pSum[2] += pWy[ky] * _mm_cvtsi128_si32(_mm_srli_si128(rowSum, 8));
+	}
+	return pJob->taps;
+}
+#endif
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: WarpTiles()
+ *
+ * DESCRIPTION
+ * The body of the parallel loop over the output tiles, which are numbered row by row. The input point of the
+ * first pixel of each row of a tile is computed exactly, then stepped incrementally across the row.
+ *------------------------------------------------------------------------------------------------------------*/
+static void WarpTiles(void *pJob, int pThread, int pBegin, int pEnd)
+{
+	tWarpJob *job = (tWarpJob *)pJob;
+	double one = (double)((int64_t)1 << WARP_FRAC_BITS);
+	int64_t stepU = llround(job->ia * one), stepV = llround(job->id * one);
+
+	for (int tile = pBegin; tile < pEnd && !ProgressCancelled(); ++tile) {
+		int tx = tile % job->tilesX * cWarpTile, ty = tile / job->tilesX * cWarpTile;
+		int w = job->outWidth - tx < cWarpTile ? job->outWidth - tx : cWarpTile;
+		int h = job->outHeight - ty < cWarpTile ? job->outHeight - ty : cWarpTile;
+		for (int y = ty; y < ty + h; ++y) {
+			// The center of the output pixel, relative to the translation, mapped back to the input. The
+			// input pixel (i, j) has its center at (i + 0.5, j + 0.5).
+			double px = job->x0 + tx + 0.5 - job->c, py = job->y0 + y + 0.5 - job->f;
+			int64_t u = llround((job->ia * px + job->ib * py - 0.5) * one);
+			int64_t v = llround((job->id * px + job->ie * py - 0.5) * one);
+			tPixel *out = &job->out[y][tx];
+			for (int x = 0; x < w; ++x, u += stepU, v += stepV) out[x] = WarpSample(job, u, v);
+		}
+	}
+}
+
+void WarpRotation(double pDegrees, double *pCoef)
+{
+	// With y down, this matrix turns the x axis toward the y axis, i.e., clockwise on screen.
+	double rad = pDegrees * 3.14159265358979323846 / 180.0;
+	double cs = cos(rad), sn = sin(rad);
+	pCoef[0] = cs;
+	pCoef[1] = -sn;
+	pCoef[2] = 0.0;
+	pCoef[3] = sn;
+	pCoef[4] = cs;
+	pCoef[5] = 0.0;
+}
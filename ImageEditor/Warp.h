@@ -0,0 +1,50 @@
+/***************************************************************************************************************
+ * Nicholas Mel
+ *
+ * DESCRIPTION
+ * Affine warps: rotation by an arbitrary angle, shear, scale, or any combination of them. The affine transform
+ * maps the pixel (x, y) of the input image to (a*x + b*y + c, d*x + e*y + f) in the output image, where (x, y)
+ * are continuous coordinates with the origin at the upper left corner of the image, x to the right and y down.
+ * The output canvas is sized automatically to the bounding box of the transformed image, so a translation
+ * (c, f) only shifts the image by its fractional part, and the area of the canvas outside the transformed
+ * image is filled with a background color.
+ *
+ * The output is rendered in tiles, which are divided among threads. Each output pixel is mapped back to the
+ * input image by the inverse transform. Within a row of a tile, stepping one pixel right always adds the same
+ * step to the input coordinates, so they are updated incrementally in 16.16 fixed point rather than by
+ * multiplying by the matrix for each pixel.
+ **************************************************************************************************************/
+#ifndef WARP_H
+#define WARP_H
+
+#include "Bmp.h"
+#include "Error.h"
+
+// The sampling (interpolation) method used to find the color of an output pixel from the input pixels near the
+// point it maps to.
+typedef enum {
+	WarpBilinear = 0,	// Weighted average of the 2 x 2 nearest pixels. The default.
+	WarpNearest  = 1,	// The nearest pixel. Fastest, but jagged.
+	WarpBicubic  = 2	// Catmull-Rom spline through the 4 x 4 nearest pixels. Sharpest.
+} tWarpInterp;
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: WarpAffine()
+ *
+ * DESCRIPTION
+ * Transforms the image pBmp by the affine transform pCoef = { a, b, c, d, e, f } (see above), sampling with
+ * pInterp and filling the rest of the output canvas with pBackground. Returns ErrorOpWarp if the transform is
+ * not invertible or the output canvas would be too large or cannot be allocated, leaving the image unchanged.
+ * If the job is cancelled (see Progress.h), the output is left partly rendered.
+ *------------------------------------------------------------------------------------------------------------*/
+tError WarpAffine(tBmp *pBmp, double *pCoef, tWarpInterp pInterp, tPixel pBackground);
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: WarpRotation()
+ *
+ * DESCRIPTION
+ * Stores in pCoef the affine transform which rotates an image pDegrees clockwise, like --rotr.
+ *------------------------------------------------------------------------------------------------------------*/
+void WarpRotation(double pDegrees, double *pCoef);
+
+#endif